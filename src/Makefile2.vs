@@ -23,7 +23,8 @@ OBJS = mate1ply.obj misc.obj timeman.obj evaluate.obj position.obj \
 	 tt.obj main.obj move.obj \
 	 movegen.obj search.obj uci.obj movepick.obj thread.obj ucioption.obj \
 	 benchmark.obj book.obj \
-	 shogi.obj mate.obj problem.obj
+	 shogi.obj mate.obj problem.obj bitboard.obj perform.obj \
+	 selfplay.obj kif.obj learner.obj
 
 CC=cl
 LD=link
@@ -19,16 +19,27 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <vector>
 
+#include "misc.h"
+#include "movepick.h"
+#include "perform.h"
 #include "position.h"
 #include "search.h"
 #include "ucioption.h"
 #if defined(NANOHA)
 #include "movegen.h"
 #include "evaluate.h"
+#include "rkiss.h"
+#include "thread.h"
+#include "tt.h"
 #endif
 
 using namespace std;
@@ -94,6 +105,42 @@ static const string Defaults[] = {
 #endif
 };
 
+/// load_positions() は局面の一覧を読み込む. fenFile が "default" なら defaults
+/// (空文字列で終わる配列)を使う. ファイルは1行1局面で、先頭の "sfen " は省いてよい.
+
+static vector<string> load_positions(const string& fenFile, const string defaults[]) {
+
+    vector<string> list;
+
+    if (fenFile == "default")
+    {
+        for (int i = 0; !defaults[i].empty(); i++)
+            list.push_back(defaults[i]);
+        return list;
+    }
+
+    string fen;
+    ifstream f(fenFile.c_str());
+
+    if (!f.is_open())
+    {
+        cerr << "Unable to open file " << fenFile << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    while (getline(f, fen))
+    {
+        if (!fen.empty() && fen[fen.size() - 1] == '\r')
+            fen.erase(fen.size() - 1);
+        if (fen.compare(0, 5, "sfen ") == 0)
+            fen.erase(0, 5);
+        if (!fen.empty())
+            list.push_back(fen);
+    }
+
+    return list;
+}
+
 
 /// benchmark() runs a simple benchmark by letting Stockfish analyze a set
 /// of positions for a given limit each.  There are five parameters; the
@@ -108,7 +155,7 @@ void benchmark(int argc, char* argv[]) {
     vector<string> fenList;
     SearchLimits limits;
     int64_t totalNodes;
-    int time;
+    TimePoint time;
 
     // Assign default values to missing arguments
     string ttSize  = argc > 2 ? argv[2] : "512";
@@ -130,33 +177,23 @@ void benchmark(int argc, char* argv[]) {
         limits.maxDepth = atoi(valStr.c_str());
 
     // Do we need to load positions from a given FEN file ?
-    if (fenFile != "default")
-    {
-        string fen;
-        ifstream f(fenFile.c_str());
-
-        if (!f.is_open())
-        {
-            cerr << "Unable to open file " << fenFile << endl;
-            exit(EXIT_FAILURE);
-        }
-
-        while (getline(f, fen))
-            if (!fen.empty())
-                fenList.push_back(fen);
-
-        f.close();
-    }
-    else // Load default positions
-        for (int i = 0; !Defaults[i].empty(); i++)
-            fenList.push_back(Defaults[i]);
+    fenList = load_positions(fenFile, Defaults);
 
     // Ok, let's start the benchmark !
     totalNodes = 0;
 #if defined(NANOHA)
     int64_t totalTNodes = 0;
 #endif
-    time = get_system_time();
+#if defined(CHK_PERFORM)
+    PerfCounters perfStart = perf_counters();
+#endif
+#if defined(PROFILE_SEARCH)
+    SearchProfile profileStart = search_profile();
+#endif
+#if defined(SEARCH_STATS)
+    clear_iteration_stats();
+#endif
+    time = now();
 
     for (size_t i = 0; i < fenList.size(); i++)
     {
@@ -189,17 +226,33 @@ void benchmark(int argc, char* argv[]) {
         }
     }
 
-    time = get_system_time() - time;
+    time = now() - time;
 
     cerr << "\n==============================="
-         << "\nTotal time (ms) : " << time
+         << "\nTotal time (ms) : " << to_msec(time)
          << "\nNodes searched  : " << totalNodes
 #if !defined(NANOHA)
-         << "\nNodes/second    : " << (int)(totalNodes / (time / 1000.0)) << endl;
+         << "\nNodes/second    : " << (int)(totalNodes / (time / 1000000.0)) << endl;
 #else
          << "\nTNodes searched : " << totalTNodes
-         << "\nNodes/second    : " << (int)(totalNodes / (time / 1000.0))
-         << "\nNodes/s(all)    : " << (int)((totalNodes+totalTNodes) / (time / 1000.0)) << endl;
+         << "\nNodes/second    : " << (int)(totalNodes / (time / 1000000.0))
+         << "\nNodes/s(all)    : " << (int)((totalNodes+totalTNodes) / (time / 1000000.0)) << endl;
+#endif
+#if defined(CHK_PERFORM)
+    if (valType != "perft")
+    {
+        const PerfCounters pc = perf_counters_since(perfStart);
+        print_move_pick_stats(pc);
+        cerr << "\nCounters: " << perf_counters_to_string(pc) << endl;
+    }
+#endif
+#if defined(PROFILE_SEARCH)
+    if (valType != "perft")
+        print_search_profile(search_profile_since(profileStart));
+#endif
+#if defined(SEARCH_STATS)
+    if (valType != "perft")
+        print_iteration_stats();
 #endif
 }
 
@@ -207,7 +260,7 @@ void benchmark(int argc, char* argv[]) {
 
 namespace {
     struct ResultMate1 {
-        int msec;
+        TimePoint usec;
         int result;
         Move m;
     };
@@ -220,10 +273,10 @@ namespace {
         }
         cerr << endl;
     }
-    string conv_per_s(const double loops, int t)
+    string conv_per_s(const double loops, TimePoint t)
     {
         if (t == 0) t++;
-        double nps = loops * 1000 / t;
+        double nps = loops * 1000000 / t;
         char buf[64];
         if (nps > 1000*1000) {snprintf(buf, sizeof(buf), "%.3f M", nps / 1000000.0); }
         else if (nps > 1000) {snprintf(buf, sizeof(buf), "%.3f k", nps / 1000.0); }
@@ -236,7 +289,7 @@ namespace {
 void bench_mate(int argc, char* argv[]) {
 
     vector<string> sfenList;
-    int time;
+    TimePoint time;
     vector<ResultMate1> result;
     int type = (string(argv[1]) == "mate1") ? 0 : 1;
     const char *typestr[] = { "Mate1ply", "Mate3play" };
@@ -248,33 +301,7 @@ void bench_mate(int argc, char* argv[]) {
 
     cerr << "Benchmark type: " << typestr[type] << " routine." << endl;
 
-    if (fenFile != "default")
-    {
-        string fen;
-        ifstream f(fenFile.c_str());
-
-        if (!f.is_open())
-        {
-            cerr << "Unable to open file " << fenFile << endl;
-            exit(EXIT_FAILURE);
-        }
-
-        while (getline(f, fen)) {
-            if (!fen.empty()) {
-                if (fen.compare(0, 5, "sfen ") == 0) {
-                    fen.erase(0, 5);
-                }
-                sfenList.push_back(fen);
-            }
-        }
-
-        f.close();
-    }
-    else {
-        for (int i = 0; !Defaults[i].empty(); i++) {
-            sfenList.push_back(Defaults[i]);
-        }
-    }
+    sfenList = load_positions(fenFile, Defaults);
 
     // ベンチ開始
     int loops = (bLoop ? 1000*1000 : 1000); // 1M回
@@ -282,8 +309,8 @@ void bench_mate(int argc, char* argv[]) {
 
     ResultMate1 record;
 
-    time = get_system_time();
-    int total = 0;
+    time = now();
+    TimePoint total = 0;
     size_t i;
     for (i = 0; i < sfenList.size(); i++)
     {
@@ -299,7 +326,7 @@ void bench_mate(int argc, char* argv[]) {
 
         volatile int v = 0;
         int j;
-        int rap_time = get_system_time();
+        TimePoint rap_time = now();
         if (type == 0) {
             // 1手詰め
             if (pos.side_to_move() == BLACK) {
@@ -318,24 +345,24 @@ void bench_mate(int argc, char* argv[]) {
                 v = pos.Mate3(pos.side_to_move(), move);
             }
         }
-        rap_time = get_system_time() - rap_time;
+        rap_time = now() - rap_time;
         total += rap_time;
         if (bLoop && bDisplay) pos.print_csa(move);
 
-        record.msec = rap_time;
+        record.usec = rap_time;
         record.result = v;
         record.m = move;
         result.push_back(record);
 
-        if (bLoop) cerr << v << "\t" << move_to_csa(move) << "  " << rap_time << "(ms)  "
+        if (bLoop) cerr << v << "\t" << move_to_csa(move) << "  " << to_msec(rap_time) << "(ms)  "
                         << conv_per_s(loops, rap_time) << " times/s" << endl;
     }
 
-    time = get_system_time() - time;
+    time = now() - time;
     if (time == 0) time = 1;
 
     cerr << "\n==============================="
-         << "\nTotal time (ms) : " << time << "(" << total << ")";
+         << "\nTotal time (ms) : " << to_msec(time) << "(" << to_msec(total) << ")";
     cerr << "\n  Average : " << conv_per_s(static_cast<const double>(loops*sfenList.size()), time) << " times/s" << endl;
 
     int solved = 0;
@@ -349,7 +376,7 @@ void bench_mate(int argc, char* argv[]) {
     }
     cerr << "Mate    =  " << solved  << endl;
     cerr << "Unknown =  " << unknown << endl;
-    cerr << "Ave.time=  " << double(time) / result.size() << "(ms)" << endl;
+    cerr << "Ave.time=  " << to_msec(time) / result.size() << "(ms)" << endl;
     cerr << "Lopps   =  " << loops << endl;
     cerr << "Average =  " << conv_per_s(static_cast<const double>(loops*result.size()), time) << " times/s" << endl;
 }
@@ -357,7 +384,7 @@ void bench_mate(int argc, char* argv[]) {
 void bench_genmove(int argc, char* argv[]) {
 
     vector<string> sfenList;
-    int time;
+    TimePoint time;
 
     // デフォルト値を設定
     string fenFile = argc > 2 ? argv[2] : "default";
@@ -365,37 +392,9 @@ void bench_genmove(int argc, char* argv[]) {
 
     cerr << "Benchmark type: generate moves." << endl;
 
-    if (fenFile != "default")
-    {
-        string fen;
-        ifstream f(fenFile.c_str());
-
-        if (!f.is_open())
-        {
-            cerr << "Unable to open file " << fenFile << endl;
-            exit(EXIT_FAILURE);
-        }
-
-        while (getline(f, fen)) {
-            if (!fen.empty()) {
-                if (fen.compare(0, 5, "sfen ") == 0) {
-                    fen.erase(0, 5);
-                }
-                sfenList.push_back(fen);
-            }
-        }
-
-        f.close();
-        cerr << "SFEN file is" << fenFile << "." << endl;
-    }
-    else {
-        for (int i = 0; !GenMoves[i].empty(); i++) {
-            sfenList.push_back(GenMoves[i]);
-        }
-        cerr << "SFENs is default." << endl;
-    }
+    sfenList = load_positions(fenFile, GenMoves);
 
-    time = get_system_time();
+    time = now();
 
     MoveStack ss[MAX_MOVES];
     volatile MoveStack *mlist = NULL;
@@ -414,50 +413,77 @@ void bench_genmove(int argc, char* argv[]) {
 #endif
 
         cerr << "\nBench position: " << i + 1 << '/' << sfenList.size() << endl;
-        int rap_time = get_system_time();
+        TimePoint rap_time = now();
         for (j = 0; j < loops; j++) {
             mlist = generate<MV_LEGAL>(pos, ss);
         }
-        rap_time = get_system_time() - rap_time;
+        rap_time = now() - rap_time;
         if (bDisplay) pos.print_csa();
-        cerr << "  Genmove(" << mlist - ss << "): " << rap_time << "(ms), " << conv_per_s(loops, rap_time) << "times/s" << endl;
+        cerr << "  Genmove(" << mlist - ss << "): " << to_msec(rap_time) << "(ms), " << conv_per_s(loops, rap_time) << "times/s" << endl;
         if (bDisplay) disp_moves(ss, mlist - ss);
 
-        rap_time = get_system_time();
+        rap_time = now();
         for (j = 0; j < loops; j++) {
             mlist = generate<MV_CAPTURE>(pos, ss);
         }
-        rap_time = get_system_time() - rap_time;
-        cerr << "  Gencapture(" << mlist - ss << "): " << rap_time << "(ms), " << conv_per_s(loops, rap_time) << "times/s" << endl;
+        rap_time = now() - rap_time;
+        cerr << "  Gencapture(" << mlist - ss << "): " << to_msec(rap_time) << "(ms), " << conv_per_s(loops, rap_time) << "times/s" << endl;
         if (bDisplay) disp_moves(ss, mlist - ss);
 
-        rap_time = get_system_time();
+        rap_time = now();
         for (j = 0; j < loops; j++) {
             mlist = generate<MV_NON_CAPTURE>(pos, ss);
         }
-        rap_time = get_system_time() - rap_time;
-        cerr << "  noncapture(" << mlist - ss << "): " << rap_time << "(ms), " << conv_per_s(loops, rap_time) << "times/s" << endl;
+        rap_time = now() - rap_time;
+        cerr << "  noncapture(" << mlist - ss << "): " << to_msec(rap_time) << "(ms), " << conv_per_s(loops, rap_time) << "times/s" << endl;
         if (bDisplay) disp_moves(ss, mlist - ss);
 
-        rap_time = get_system_time();
+        rap_time = now();
         for (j = 0; j < loops; j++) {
             mlist = generate<MV_CHECK>(pos, ss);
         }
-        rap_time = get_system_time() - rap_time;
-        cerr << "  gen_check(" << mlist - ss << "): " << rap_time << "(ms), " << conv_per_s(loops, rap_time) << "times/s" << endl;
+        rap_time = now() - rap_time;
+        cerr << "  gen_check(" << mlist - ss << "): " << to_msec(rap_time) << "(ms), " << conv_per_s(loops, rap_time) << "times/s" << endl;
         if (bDisplay) disp_moves(ss, mlist - ss);
+
+        // MovePickerで全部の手を取り出す(生成＋スコア付け＋選択).
+        // historyは固定の乱数で埋めて、並べ替えが必要になるようにする.
+        if (!pos.in_check()) {
+            History H;
+            SearchStack sstack;
+            RKISS rk;
+            H.clear();
+            mlist = generate<MV_NON_CAPTURE>(pos, ss);
+            for (MoveStack* cur = ss; cur != mlist; cur++) {
+                const Move m = cur->move;
+                const Piece piece = is_promotion(m) ? Piece(move_piece(m) | PROMOTED) : move_piece(m);
+                H.update(piece, move_to(m), Value(int(rk.rand<unsigned>() % 401) - 200));
+            }
+            memset(&sstack, 0, sizeof(sstack));
+            sstack.eval = VALUE_NONE;
+
+            const int pickLoops = loops / 100;
+            int n = 0;
+            rap_time = now();
+            for (j = 0; j < pickLoops; j++) {
+                MovePicker mp(pos, MOVE_NONE, 5 * ONE_PLY, H, &sstack, VALUE_INFINITE);
+                for (n = 0; mp.get_next_move() != MOVE_NONE; n++) {}
+            }
+            rap_time = now() - rap_time;
+            cerr << "  movepick(" << n << "): " << to_msec(rap_time) << "(ms), " << conv_per_s(pickLoops, rap_time) << "times/s" << endl;
+        }
     }
 
-    time = get_system_time() - time;
+    time = now() - time;
 
     cerr << "\n==============================="
-         << "\nTotal time (ms) : " << time << endl;
+         << "\nTotal time (ms) : " << to_msec(time) << endl;
 }
 
 void bench_eval(int argc, char* argv[]) {
 
     vector<string> sfenList;
-    int time;
+    TimePoint time;
 
     // デフォルト値を設定
     string fenFile = argc > 2 ? argv[2] : "default";
@@ -465,36 +491,9 @@ void bench_eval(int argc, char* argv[]) {
 
     cerr << "Benchmark type: evaluate." << endl;
 
-    if (fenFile != "default")
-    {
-        string fen;
-        ifstream f(fenFile.c_str());
+    sfenList = load_positions(fenFile, EvalPos);
 
-        if (!f.is_open())
-        {
-            cerr << "Unable to open file " << fenFile << endl;
-            exit(EXIT_FAILURE);
-        }
-
-        while (getline(f, fen)) {
-            if (!fen.empty()) {
-                if (fen.compare(0, 5, "sfen ") == 0) {
-                    fen.erase(0, 5);
-                }
-                sfenList.push_back(fen);
-            }
-        }
-
-        f.close();
-        cerr << "SFEN file is" << fenFile << "." << endl;
-    }
-    else {
-        for (int i = 0; !EvalPos[i].empty(); i++) {
-            sfenList.push_back(EvalPos[i]);
-        }
-    }
-
-    time = get_system_time();
+    time = now();
 
 #if defined(NDEBUG)
     int loops = 1000*1000;    // 1M回
@@ -502,6 +501,7 @@ void bench_eval(int argc, char* argv[]) {
     int loops =   50*1000;    // 50k回
 #endif
     int j;
+    int maxError = 0;
     volatile Value v = VALUE_ZERO;
 	SearchStack ss[PLY_MAX_PLUS_2];
     for (size_t i = 0; i < sfenList.size(); i++)
@@ -518,20 +518,493 @@ void bench_eval(int argc, char* argv[]) {
             cerr << "new value=" << value << ", correct=" << correct << endl;
             pos.print_csa();
         }
+        // KKP を量子化した誤差(評価関数の表の単位)
+        const int error = pos.evaluate_raw_correct() - pos.evaluate_raw_reference();
+        maxError = max(maxError, abs(error));
 
         cerr << "\nBench position: " << i + 1 << '/' << sfenList.size() << endl;
-        int rap_time = get_system_time();
+        TimePoint rap_time = now();
         for (j = 0; j < loops; j++) {
             v = pos.evaluate(pos.side_to_move(), ss);
         }
-        rap_time = get_system_time() - rap_time;
+        rap_time = now() - rap_time;
         if (bDisplay) pos.print_csa();
-        cerr << "  evaluate():m=" << pos.get_material() << ", v= " << int(v) << ", time= " << rap_time << "(ms), " << conv_per_s(loops, rap_time) << " evaluate/s" << endl;
+        cerr << "  evaluate():m=" << pos.get_material() << ", v= " << int(v) << ", time= " << to_msec(rap_time) << "(ms), " << conv_per_s(loops, rap_time) << " evaluate/s"
+             << ", kkp error= " << error << endl;
     }
 
-    time = get_system_time() - time;
+    time = now() - time;
 
     cerr << "\n==============================="
-         << "\nTotal time (ms) : " << time << endl;
+         << "\nTotal time (ms) : " << to_msec(time)
+         << "\nKKP shift       : " << KkpShift
+         << "\nMax KKP error   : " << maxError << " (" << double(maxError) / FV_SCALE << " cp)" << endl;
+}
+
+
+/// bench suite は名前付きのベンチマークを同じ手順で実行し、結果を機械で読める形で出す.
+///
+///   bench suite [suite = all] [fen positions file = default] [repeats = 5]
+///               [warmup = 1] [format = text, json or csv]
+///
+/// 各スイートを warmup 回空回ししてから repeats 回計測し、1操作あたりの時間の
+/// 平均・標準偏差・最小値を求める. 結果は標準出力に、経過は標準エラー出力に出す.
+/// -DCHK_PERFORM のときは json に計測中の性能カウンタの合計も出す.
+
+namespace {
+
+    volatile int64_t BenchSink;     // 計測する処理が最適化で消されないようにする
+
+    // 1局面で loops 回(search と perft では深さ)の処理を行い、操作の数を返す
+    typedef int64_t (*SuiteFunc)(Position& pos, int loops);
+    // 1局面ごとに計測の外で呼ぶ準備(NULL なら何もしない)
+    typedef void (*SetupFunc)();
+
+    struct BenchSuite {
+        const char* name;
+        const char* unit;           // 1操作の単位
+        const string* positions;    // 既定の局面集合
+        int loops;
+        SuiteFunc run;
+        SetupFunc setup;
+    };
+
+    void clear_tt() {
+        TT.clear();
+    }
+
+    int64_t suite_search(Position& pos, int depth) {
+        SearchLimits limits;
+        Move moves[] = { MOVE_NONE };
+        limits.maxDepth = depth;
+        think(pos, limits, moves);
+        return pos.nodes_searched();
+    }
+
+    int64_t suite_eval_full(Position& pos, int loops) {
+        int64_t sum = 0;
+        for (int i = 0; i < loops; i++)
+            sum += pos.evaluate_correct(pos.side_to_move());
+        BenchSink += sum;
+        return loops;
+    }
+
+    // 合法手で1手進めた局面を評価する(EVAL_DIFF のときは差分計算になる).
+    // do_move()/undo_move() の時間も含む.
+    int64_t suite_eval_diff(Position& pos, int loops) {
+        SearchStack ss[3];
+        MoveStack mlist[MAX_MOVES];
+        StateInfo st;
+        const MoveStack* last = generate<MV_LEGAL>(pos, mlist);
+        int64_t sum = 0;
+
+        memset(ss, 0, sizeof(ss));
+#if defined(EVAL_DIFF)
+        ss[0].staticEvalRaw = ss[1].staticEvalRaw = Value(INT_MAX);
+#endif
+        pos.evaluate(pos.side_to_move(), &ss[1]);
+        for (int i = 0; i < loops; i++) {
+            for (const MoveStack* cur = mlist; cur != last; cur++) {
+                pos.do_move(cur->move, st);
+#if defined(EVAL_DIFF)
+                ss[2].staticEvalRaw = Value(INT_MAX);
+#endif
+                sum += pos.evaluate(pos.side_to_move(), &ss[2]);
+                pos.undo_move(cur->move);
+            }
+        }
+        BenchSink += sum;
+        return int64_t(loops) * (last - mlist);
+    }
+
+    template<MoveType T>
+    int64_t suite_genmove(Position& pos, int loops) {
+        MoveStack mlist[MAX_MOVES];
+        int64_t n = 0;
+        for (int i = 0; i < loops; i++)
+            n += generate<T>(pos, mlist) - mlist;
+        BenchSink += n;
+        return loops;
+    }
+
+    int64_t suite_mate1(Position& pos, int loops) {
+        Move m = MOVE_NONE;
+        for (int i = 0; i < loops; i++)
+            m = pos.Mate1ply();
+        BenchSink += m;
+        return loops;
+    }
+
+    int64_t suite_mate3(Position& pos, int loops) {
+        Move m = MOVE_NONE;
+        int v = 0;
+        for (int i = 0; i < loops; i++)
+            v += pos.Mate3(pos.side_to_move(), m);
+        BenchSink += v;
+        return loops;
+    }
+
+    int64_t suite_domove(Position& pos, int loops) {
+        MoveStack mlist[MAX_MOVES];
+        StateInfo st;
+        const MoveStack* last = generate<MV_LEGAL>(pos, mlist);
+        for (int i = 0; i < loops; i++) {
+            for (const MoveStack* cur = mlist; cur != last; cur++) {
+                pos.do_move(cur->move, st);
+                pos.undo_move(cur->move);
+            }
+        }
+        return int64_t(loops) * (last - mlist);
+    }
+
+    int64_t suite_see(Position& pos, int loops) {
+        MoveStack mlist[MAX_MOVES];
+        const MoveStack* last = generate<MV_LEGAL>(pos, mlist);
+        int64_t sum = 0;
+        for (int i = 0; i < loops; i++)
+            for (const MoveStack* cur = mlist; cur != last; cur++)
+                sum += pos.see(cur->move);
+        BenchSink += sum;
+        return int64_t(loops) * (last - mlist);
+    }
+
+    // 局面のキーを乱数で散らして store と probe を繰り返す. 表の大きさは Hash.
+    int64_t suite_tt(Position& pos, int loops) {
+        RKISS rk;
+        const Key key = pos.get_key();
+        const uint32_t h = pos.hand_value_of_side();
+        int64_t hits = 0;
+        for (int i = 0; i < loops; i++) {
+            const Key k = key ^ rk.rand<Key>();
+            TT.store(k, h, Value(i & 1023), VALUE_TYPE_EXACT, Depth(i & 31), MOVE_NONE, VALUE_NONE, VALUE_NONE);
+            hits += (TT.probe(k, h) != NULL);
+            hits += (TT.probe(k ^ 1, h) != NULL);
+        }
+        BenchSink += hits;
+        return int64_t(loops) * 3;
+    }
+
+    int64_t suite_perft(Position& pos, int depth) {
+        return perft(pos, depth * ONE_PLY);
+    }
+
+    const BenchSuite Suites[] = {
+        { "search",             "node",  Defaults, 6,      suite_search,                  clear_tt },
+        { "eval-full",          "eval",  Defaults, 10000,  suite_eval_full,               NULL },
+        { "eval-diff",          "eval",  Defaults, 200,    suite_eval_diff,               NULL },
+        { "genmove-legal",      "gen",   GenMoves, 100000, suite_genmove<MV_LEGAL>,       NULL },
+        { "genmove-capture",    "gen",   GenMoves, 100000, suite_genmove<MV_CAPTURE>,     NULL },
+        { "genmove-noncapture", "gen",   GenMoves, 100000, suite_genmove<MV_NON_CAPTURE>, NULL },
+        { "genmove-check",      "gen",   GenMoves, 100000, suite_genmove<MV_CHECK>,       NULL },
+        { "mate1",              "call",  Defaults, 100000, suite_mate1,                   NULL },
+        { "mate3",              "call",  Defaults, 1000,   suite_mate3,                   NULL },
+        { "domove",             "move",  Defaults, 1000,   suite_domove,                  NULL },
+        { "tt",                 "probe", Defaults, 100000, suite_tt,                      NULL },
+        { "see",                "call",  Defaults, 1000,   suite_see,                     NULL },
+        { "perft",              "node",  Defaults, 2,      suite_perft,                   NULL },
+    };
+
+    struct SuiteResult {
+        const BenchSuite* suite;
+        size_t positions;
+        int64_t ops;                // 1回の計測での操作の数
+        double mean, stddev, minimum;   // 1操作あたりのナノ秒
+#if defined(CHK_PERFORM)
+        PerfCounters counters;      // 計測した repeats 回の性能カウンタの合計
+#endif
+    };
+
+    // 局面集合全体を1回実行し、操作の数と経過時間を返す(局面の生成は計測しない)
+    int64_t run_suite(const BenchSuite& s, const vector<string>& sfenList, TimePoint& elapsed) {
+        int64_t ops = 0;
+        elapsed = 0;
+        for (size_t i = 0; i < sfenList.size(); i++) {
+            Position pos(sfenList[i], 0);
+            if (s.setup)
+                s.setup();
+            const TimePoint t = now();
+            ops += s.run(pos, s.loops);
+            elapsed += now() - t;
+        }
+        return ops;
+    }
+
+    SuiteResult measure_suite(const BenchSuite& s, const vector<string>& sfenList, int repeats, int warmup) {
+        SuiteResult r;
+        vector<double> ns;
+        TimePoint elapsed;
+
+        r.suite = &s;
+        r.positions = sfenList.size();
+        r.ops = 0;
+        for (int i = 0; i < warmup; i++)
+            run_suite(s, sfenList, elapsed);
+#if defined(CHK_PERFORM)
+        const PerfCounters perfStart = perf_counters();
+#endif
+        for (int i = 0; i < repeats; i++) {
+            r.ops = run_suite(s, sfenList, elapsed);
+            ns.push_back(r.ops > 0 ? double(elapsed) * 1000 / r.ops : 0);
+        }
+#if defined(CHK_PERFORM)
+        r.counters = perf_counters_since(perfStart);
+#endif
+
+        double sum = 0, sq = 0;
+        r.minimum = ns.empty() ? 0 : ns[0];
+        for (size_t i = 0; i < ns.size(); i++) {
+            sum += ns[i];
+            r.minimum = std::min(r.minimum, ns[i]);
+        }
+        r.mean = ns.empty() ? 0 : sum / ns.size();
+        for (size_t i = 0; i < ns.size(); i++)
+            sq += (ns[i] - r.mean) * (ns[i] - r.mean);
+        r.stddev = ns.size() > 1 ? sqrt(sq / (ns.size() - 1)) : 0;
+        return r;
+    }
+
+    void print_results(const vector<SuiteResult>& results, const string& format, int repeats, int warmup) {
+        char buf[256];
+
+        if (format == "json")
+        {
+            cout << "{\n  \"engine\": \"" << json_escape(engine_name()) << "\",\n"
+                 << "  \"repeats\": " << repeats << ",\n"
+                 << "  \"warmup\": " << warmup << ",\n"
+                 << "  \"results\": [";
+            for (size_t i = 0; i < results.size(); i++) {
+                const SuiteResult& r = results[i];
+                snprintf(buf, sizeof(buf), "\"mean_ns\": %.3f, \"stddev_ns\": %.3f, \"min_ns\": %.3f, \"ops_per_sec\": %.0f",
+                         r.mean, r.stddev, r.minimum, r.mean > 0 ? 1e9 / r.mean : 0);
+                cout << (i ? "," : "") << "\n    {\"suite\": \"" << r.suite->name << "\", \"unit\": \"" << r.suite->unit
+                     << "\", \"positions\": " << r.positions << ", \"ops\": " << r.ops << ", " << buf;
+#if defined(CHK_PERFORM)
+                cout << ", \"counters\": " << perf_counters_to_json(r.counters);
+#endif
+                cout << "}";
+            }
+            cout << "\n  ]\n}" << endl;
+        }
+        else if (format == "csv")
+        {
+            cout << "suite,unit,positions,ops,mean_ns,stddev_ns,min_ns,ops_per_sec" << endl;
+            for (size_t i = 0; i < results.size(); i++) {
+                const SuiteResult& r = results[i];
+                snprintf(buf, sizeof(buf), "%.3f,%.3f,%.3f,%.0f", r.mean, r.stddev, r.minimum, r.mean > 0 ? 1e9 / r.mean : 0);
+                cout << r.suite->name << "," << r.suite->unit << "," << r.positions << "," << r.ops << "," << buf << endl;
+            }
+        }
+        else
+        {
+            snprintf(buf, sizeof(buf), "%-20s %-6s %9s %12s %12s %12s %12s %14s",
+                     "suite", "unit", "positions", "ops", "mean(ns)", "stddev(ns)", "min(ns)", "ops/s");
+            cout << buf << endl;
+            for (size_t i = 0; i < results.size(); i++) {
+                const SuiteResult& r = results[i];
+                snprintf(buf, sizeof(buf), "%-20s %-6s %9d %12" PRId64 " %12.3f %12.3f %12.3f %14.0f",
+                         r.suite->name, r.suite->unit, int(r.positions), r.ops,
+                         r.mean, r.stddev, r.minimum, r.mean > 0 ? 1e9 / r.mean : 0);
+                cout << buf << endl;
+            }
+        }
+    }
+}
+
+void bench_suite(int argc, char* argv[]) {
+
+    // デフォルト値を設定
+    string name    = argc > 2 ? argv[2] : "all";
+    string fenFile = argc > 3 ? argv[3] : "default";
+    int repeats    = argc > 4 ? std::max(1, atoi(argv[4])) : 5;
+    int warmup     = argc > 5 ? std::max(0, atoi(argv[5])) : 1;
+    string format  = argc > 6 ? argv[6] : "text";
+
+    const int n = int(sizeof(Suites) / sizeof(Suites[0]));
+    vector<SuiteResult> results;
+
+    Options["Threads"].set_value("1");
+    Options["OwnBook"].set_value("false");
+    TT.set_size(Options["Hash"].value<int>());
+
+    // 探索が出す info や bestmove で結果の出力が乱れないようにする
+    mute_output(true);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (name != "all" && name != Suites[i].name)
+            continue;
+
+        cerr << "Bench suite: " << Suites[i].name << endl;
+        results.push_back(measure_suite(Suites[i], load_positions(fenFile, Suites[i].positions), repeats, warmup));
+    }
+
+    mute_output(false);
+
+    if (results.empty())
+    {
+        cerr << "Unknown bench suite: " << name << "\nSuites:";
+        for (int i = 0; i < n; i++)
+            cerr << " " << Suites[i].name;
+        cerr << " all" << endl;
+        return;
+    }
+
+    print_results(results, format, repeats, warmup);
+}
+
+
+/// bench scaling は同じ局面集合を 1, 2, 4, ... , N スレッドで探索し、NPS、
+/// 指定の深さまでの時間、1スレッドに対する速度比、分岐の回数とスレッドごとの
+/// 待ち時間を表と JSON で出力する.
+///
+///   bench scaling [hash size = 256] [max threads = cpu count] [depth = 8]
+///                 [fen positions file = default] [format = text or json]
+
+namespace {
+
+    struct ThreadSnapshot {
+        TimePoint time[THREAD_STATE_NB];
+        int64_t splits, failedSplits;
+    };
+
+    void take_snapshot(ThreadSnapshot snap[], int n) {
+        for (int i = 0; i < n; i++) {
+            for (int s = 0; s < THREAD_STATE_NB; s++)
+                snap[i].time[s] = Threads[i].stateTime[s];
+            snap[i].splits = Threads[i].splits;
+            snap[i].failedSplits = Threads[i].failedSplits;
+        }
+    }
+
+    struct ScalingResult {
+        int threads;
+        TimePoint time;             // 全局面を指定の深さまで探索した時間
+        int64_t nodes;
+        int64_t splits, failedSplits;
+        // スレッドごとの探索・分岐点での待ち・仕事待ちの時間(マイクロ秒)
+        TimePoint search[MAX_THREADS], splitWait[MAX_THREADS], idle[MAX_THREADS];
+    };
+
+    ScalingResult run_scaling(int threads, int depth, const vector<string>& sfenList) {
+        ScalingResult r;
+        ThreadSnapshot before[MAX_THREADS], after[MAX_THREADS];
+        SearchLimits limits;
+        char buf[16];
+
+        memset(&r, 0, sizeof(r));
+        r.threads = threads;
+        snprintf(buf, sizeof(buf), "%d", threads);
+        Options["Threads"].set_value(buf);
+        limits.maxDepth = depth;
+
+        take_snapshot(before, threads);
+        for (size_t i = 0; i < sfenList.size(); i++) {
+            Move moves[] = { MOVE_NONE };
+            Position pos(sfenList[i], 0);
+            TT.clear();
+            const TimePoint t = now();
+            if (!think(pos, limits, moves))
+                break;
+            r.time += now() - t;
+            r.nodes += pos.nodes_searched();
+        }
+        take_snapshot(after, threads);
+
+        for (int i = 0; i < threads; i++) {
+            r.splits += after[i].splits - before[i].splits;
+            r.failedSplits += after[i].failedSplits - before[i].failedSplits;
+            r.search[i] = after[i].time[THREAD_SEARCHING] - before[i].time[THREAD_SEARCHING];
+            r.splitWait[i] = after[i].time[THREAD_SPLIT_WAIT] - before[i].time[THREAD_SPLIT_WAIT];
+            r.idle[i] = std::max(TimePoint(0), r.time - r.search[i] - r.splitWait[i]);
+        }
+        return r;
+    }
+
+    double percent(TimePoint part, TimePoint whole) {
+        return whole > 0 ? 100.0 * part / whole : 0;
+    }
+}
+
+void bench_scaling(int argc, char* argv[]) {
+
+    // デフォルト値を設定
+    string ttSize   = argc > 2 ? argv[2] : "256";
+    int maxThreads  = argc > 3 ? atoi(argv[3]) : cpu_count();
+    int depth       = argc > 4 ? atoi(argv[4]) : 8;
+    string fenFile  = argc > 5 ? argv[5] : "default";
+    string format   = argc > 6 ? argv[6] : "text";
+
+    maxThreads = std::max(1, std::min(maxThreads, MAX_THREADS));
+    const vector<string> sfenList = load_positions(fenFile, Defaults);
+    vector<ScalingResult> results;
+
+    Options["Hash"].set_value(ttSize);
+    Options["OwnBook"].set_value("false");
+
+    mute_output(true);
+    for (int n = 1; ; n = std::min(n * 2, maxThreads)) {
+        cerr << "Threads: " << n << endl;
+        results.push_back(run_scaling(n, depth, sfenList));
+        if (n == maxThreads)
+            break;
+    }
+    mute_output(false);
+
+    const ScalingResult& base = results[0];
+    char buf[256];
+
+    if (format == "json")
+    {
+        cout << "{\n  \"engine\": \"" << json_escape(engine_name()) << "\",\n"
+             << "  \"depth\": " << depth << ",\n"
+             << "  \"positions\": " << sfenList.size() << ",\n"
+             << "  \"results\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const ScalingResult& r = results[i];
+            snprintf(buf, sizeof(buf), "\"time_ms\": %.3f, \"nodes\": %" PRId64 ", \"nps\": %.0f, \"speedup\": %.3f, \"nps_scaling\": %.3f",
+                     to_msec(r.time), r.nodes, r.time > 0 ? r.nodes * 1e6 / r.time : 0,
+                     r.time > 0 ? double(base.time) / r.time : 0,
+                     r.time > 0 && base.nodes > 0 ? (double(r.nodes) / r.time) / (double(base.nodes) / base.time) : 0);
+            cout << (i ? "," : "") << "\n    {\"threads\": " << r.threads << ", " << buf
+                 << ", \"splits\": " << r.splits << ", \"failed_splits\": " << r.failedSplits << ",\n     \"per_thread\": [";
+            for (int t = 0; t < r.threads; t++) {
+                snprintf(buf, sizeof(buf), "{\"search_ms\": %.3f, \"split_wait_ms\": %.3f, \"idle_ms\": %.3f}",
+                         to_msec(r.search[t]), to_msec(r.splitWait[t]), to_msec(r.idle[t]));
+                cout << (t ? ", " : "") << buf;
+            }
+            cout << "]}";
+        }
+        cout << "\n  ]\n}" << endl;
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "%7s %12s %12s %10s %8s %8s %10s %10s %7s %7s %7s",
+             "threads", "time(ms)", "nodes", "nps", "speedup", "npsx", "splits", "failed", "busy%", "wait%", "idle%");
+    cout << buf << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const ScalingResult& r = results[i];
+        TimePoint search = 0, wait = 0, idle = 0;
+        for (int t = 0; t < r.threads; t++) {
+            search += r.search[t];
+            wait += r.splitWait[t];
+            idle += r.idle[t];
+        }
+        const TimePoint all = r.time * r.threads;
+        snprintf(buf, sizeof(buf), "%7d %12.1f %12" PRId64 " %10.0f %8.2f %8.2f %10" PRId64 " %10" PRId64 " %7.1f %7.1f %7.1f",
+                 r.threads, to_msec(r.time), r.nodes, r.time > 0 ? r.nodes * 1e6 / r.time : 0,
+                 r.time > 0 ? double(base.time) / r.time : 0,
+                 r.time > 0 && base.nodes > 0 ? (double(r.nodes) / r.time) / (double(base.nodes) / base.time) : 0,
+                 r.splits, r.failedSplits, percent(search, all), percent(wait, all), percent(idle, all));
+        cout << buf << endl;
+    }
+
+    // スレッドごとの内訳(最大のスレッド数のもの)
+    const ScalingResult& last = results.back();
+    cout << "\nPer thread (" << last.threads << " threads): search / split wait / idle (ms)" << endl;
+    for (int t = 0; t < last.threads; t++) {
+        snprintf(buf, sizeof(buf), "  %2d: %10.1f %10.1f %10.1f", t,
+                 to_msec(last.search[t]), to_msec(last.splitWait[t]), to_msec(last.idle[t]));
+        cout << buf << endl;
+    }
 }
 #endif
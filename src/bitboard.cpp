@@ -0,0 +1,197 @@
+/*
+  GodWhale, a  USI shogi(japanese-chess) playing engine derived from NanohaMini
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014 Kazuyuki Kawabata (NanohaMini author)
+  Copyright (C) 2015 ebifrier, espelade, kakiage
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  GodWhale is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include "bitboard.h"
+
+Bitboard SquareBB[81];
+Bitboard FileBB[10];
+Bitboard RankBB[10];
+Bitboard AllBB;
+Bitboard StepAttackBB[GRY+1][81];
+Bitboard LanceAttackBB[2][81][128];
+
+Bitboard RookMaskBB[81];
+Bitboard BishopMaskBB[81];
+int RookOffset[81];
+int BishopOffset[81];
+int RookMaskBits0[81];
+int BishopMaskBits0[81];
+Bitboard RookAttackBB[495616];
+Bitboard BishopAttackBB[20224];
+
+namespace {
+
+    inline bool on_board(int f, int r) {
+        return 1 <= f && f <= 9 && 1 <= r && r <= 9;
+    }
+
+    inline int bb_index(int f, int r) {
+        return (f - 1) * 9 + (r - 1);
+    }
+
+    // 筋・段の増分. 段は先手から見て前(1段目方向)が -1
+    struct Delta { int df, dr; };
+
+    const Delta DirFU[] = {{0,-1}};
+    const Delta DirKE[] = {{-1,-2}, {1,-2}};
+    const Delta DirGI[] = {{-1,-1}, {0,-1}, {1,-1}, {-1,1}, {1,1}};
+    const Delta DirKI[] = {{-1,-1}, {0,-1}, {1,-1}, {-1,0}, {1,0}, {0,1}};
+    const Delta DirOU[] = {{-1,-1}, {0,-1}, {1,-1}, {-1,0}, {1,0}, {-1,1}, {0,1}, {1,1}};
+    const Delta DirHI[] = {{0,-1}, {0,1}, {-1,0}, {1,0}};
+    const Delta DirKA[] = {{-1,-1}, {1,-1}, {-1,1}, {1,1}};
+
+    Bitboard step_attack(Color c, int f, int r, const Delta *d, int n) {
+        Bitboard b = make_bitboard(0, 0);
+        const int s = (c == BLACK) ? 1 : -1;
+        for (int i = 0; i < n; i++) {
+            const int tf = f + d[i].df;
+            const int tr = r + d[i].dr * s;
+            if (on_board(tf, tr)) b.set(bb_index(tf, tr));
+        }
+        return b;
+    }
+
+    // 盤の端まで走査して飛び利きを求める(占有マスで止まる)
+    Bitboard slide_attack(int f, int r, const Delta *d, int n, const Bitboard& occ) {
+        Bitboard b = make_bitboard(0, 0);
+        for (int i = 0; i < n; i++) {
+            int tf = f + d[i].df;
+            int tr = r + d[i].dr;
+            while (on_board(tf, tr)) {
+                b.set(bb_index(tf, tr));
+                if (occ.test(bb_index(tf, tr))) break;
+                tf += d[i].df;
+                tr += d[i].dr;
+            }
+        }
+        return b;
+    }
+
+    // 飛び利きの遮り得るマス(盤端を除く)
+    Bitboard slide_mask(int f, int r, const Delta *d, int n) {
+        Bitboard b = make_bitboard(0, 0);
+        for (int i = 0; i < n; i++) {
+            int tf = f + d[i].df;
+            int tr = r + d[i].dr;
+            while (on_board(tf + d[i].df, tr + d[i].dr)) {
+                b.set(bb_index(tf, tr));
+                tf += d[i].df;
+                tr += d[i].dr;
+            }
+        }
+        return b;
+    }
+
+    // index 番目の占有パターン(mask の各ビットに index の各ビットを割り当てる)
+    Bitboard index_to_occupied(int index, const Bitboard& mask) {
+        Bitboard b = make_bitboard(0, 0);
+        Bitboard m = mask;
+        for (int i = 0; m.any(); i++) {
+            const int sq = m.pop_first();
+            if (index & (1 << i)) b.set(sq);
+        }
+        return b;
+    }
+
+    void init_slider(Bitboard attack[], Bitboard maskBB[], int offset[], int maskBits0[], const Delta *d, int n) {
+        int base = 0;
+        for (int sq = 0; sq < 81; sq++) {
+            const int f = sq / 9 + 1;
+            const int r = sq % 9 + 1;
+            maskBB[sq] = slide_mask(f, r, d, n);
+            maskBits0[sq] = count_1s64(maskBB[sq].p[0]);
+            offset[sq] = base;
+
+            const int bits = maskBB[sq].count();
+            for (int index = 0; index < (1 << bits); index++) {
+                const Bitboard occ = index_to_occupied(index, maskBB[sq]);
+                const uint64_t idx = pext64(occ.p[0], maskBB[sq].p[0])
+                                   | (pext64(occ.p[1], maskBB[sq].p[1]) << maskBits0[sq]);
+                attack[base + idx] = slide_attack(f, r, d, n, occ);
+            }
+            base += 1 << bits;
+        }
+    }
+}
+
+
+/// init_bitboards() はビットボードで使う表を初期化する.
+/// 実行ファイル起動時に一度だけ呼ぶ.
+
+void init_bitboards() {
+
+    memset(FileBB, 0, sizeof(FileBB));
+    memset(RankBB, 0, sizeof(RankBB));
+    AllBB = make_bitboard(0, 0);
+    for (int sq = 0; sq < 81; sq++) {
+        SquareBB[sq] = (sq < 63) ? make_bitboard(uint64_t(1) << sq, 0)
+                                 : make_bitboard(0, uint64_t(1) << (sq - 63));
+        FileBB[sq / 9 + 1] |= SquareBB[sq];
+        RankBB[sq % 9 + 1] |= SquareBB[sq];
+        AllBB |= SquareBB[sq];
+    }
+
+    // 近接の利き
+    memset(StepAttackBB, 0, sizeof(StepAttackBB));
+    for (int c = BLACK; c <= WHITE; c++) {
+        for (int sq = 0; sq < 81; sq++) {
+            const int f = sq / 9 + 1;
+            const int r = sq % 9 + 1;
+            const Color us = Color(c);
+            const Bitboard ki = step_attack(us, f, r, DirKI, 6);
+            const Bitboard ou = step_attack(us, f, r, DirOU, 8);
+            StepAttackBB[make_piece(us, FU)][sq] = step_attack(us, f, r, DirFU, 1);
+            StepAttackBB[make_piece(us, KE)][sq] = step_attack(us, f, r, DirKE, 2);
+            StepAttackBB[make_piece(us, GI)][sq] = step_attack(us, f, r, DirGI, 5);
+            StepAttackBB[make_piece(us, KI)][sq] = ki;
+            StepAttackBB[make_piece(us, TO)][sq] = ki;
+            StepAttackBB[make_piece(us, NY)][sq] = ki;
+            StepAttackBB[make_piece(us, NK)][sq] = ki;
+            StepAttackBB[make_piece(us, NG)][sq] = ki;
+            StepAttackBB[make_piece(us, OU)][sq] = ou;
+            StepAttackBB[make_piece(us, UM)][sq] = ou;
+            StepAttackBB[make_piece(us, RY)][sq] = ou;
+        }
+    }
+
+    // 香の利き
+    for (int sq = 0; sq < 81; sq++) {
+        const int f = sq / 9 + 1;
+        const int r = sq % 9 + 1;
+        for (int idx = 0; idx < 128; idx++) {
+            // idx のビット i は (f, i+2) の占有を表す
+            Bitboard occ = make_bitboard(0, 0);
+            for (int i = 0; i < 7; i++) {
+                if (idx & (1 << i)) occ.set(bb_index(f, i + 2));
+            }
+            const Delta up[] = {{0,-1}};
+            const Delta down[] = {{0,1}};
+            LanceAttackBB[BLACK][sq][idx] = slide_attack(f, r, up, 1, occ);
+            LanceAttackBB[WHITE][sq][idx] = slide_attack(f, r, down, 1, occ);
+        }
+    }
+
+    // 飛・角の利き
+    init_slider(RookAttackBB, RookMaskBB, RookOffset, RookMaskBits0, DirHI, 4);
+    init_slider(BishopAttackBB, BishopMaskBB, BishopOffset, BishopMaskBits0, DirKA, 4);
+}
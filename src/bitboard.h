@@ -0,0 +1,214 @@
+/*
+  GodWhale, a  USI shogi(japanese-chess) playing engine derived from NanohaMini
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014 Kazuyuki Kawabata (NanohaMini author)
+  Copyright (C) 2015 ebifrier, espelade, kakiage
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  GodWhale is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(BITBOARD_H_INCLUDED)
+#define BITBOARD_H_INCLUDED
+
+#include "types.h"
+
+#if defined(USE_BMI2)
+#include <immintrin.h>
+#endif
+
+//
+// 81マスのビットボード
+//
+// 盤上の位置(0x11～0x99)とは別に、ビット番号 (筋-1)*9 + (段-1) を使う.
+// 1～7筋(63ビット)を p[0] に、8～9筋(18ビット)を p[1] に持つ.
+// 筋ごとの9ビットが一つの64ビット語の中で連続するため、香の利きや二歩の判定が
+// 語をまたがずにできる.
+// ビット番号の小さい順に取り出すと 1筋の1段目,2段目,... の順になり、
+// 従来の盤面走査(筋の外側ループ、段の内側ループ)と同じ順序になる.
+//
+
+struct Bitboard {
+    uint64_t p[2];
+
+    bool any() const { return (p[0] | p[1]) != 0; }
+    bool none() const { return (p[0] | p[1]) == 0; }
+
+    bool test(int i) const;
+    void set(int i);
+    void clr(int i);
+    void xor_bit(int i);
+
+    int count() const;
+    int pop_first();            // 最下位のビットを取り出して、そのビット番号を返す
+
+    Bitboard& operator&=(const Bitboard& b) { p[0] &= b.p[0]; p[1] &= b.p[1]; return *this; }
+    Bitboard& operator|=(const Bitboard& b) { p[0] |= b.p[0]; p[1] |= b.p[1]; return *this; }
+    Bitboard& operator^=(const Bitboard& b) { p[0] ^= b.p[0]; p[1] ^= b.p[1]; return *this; }
+};
+
+const uint64_t BB_MASK0 = (uint64_t(1) << 63) - 1;    // p[0] の有効ビット(1～7筋)
+const uint64_t BB_MASK1 = (uint64_t(1) << 18) - 1;    // p[1] の有効ビット(8～9筋)
+
+inline Bitboard make_bitboard(uint64_t p0, uint64_t p1) {
+    Bitboard b;
+    b.p[0] = p0;
+    b.p[1] = p1;
+    return b;
+}
+
+inline Bitboard operator&(const Bitboard& a, const Bitboard& b) { return make_bitboard(a.p[0] & b.p[0], a.p[1] & b.p[1]); }
+inline Bitboard operator|(const Bitboard& a, const Bitboard& b) { return make_bitboard(a.p[0] | b.p[0], a.p[1] | b.p[1]); }
+inline Bitboard operator^(const Bitboard& a, const Bitboard& b) { return make_bitboard(a.p[0] ^ b.p[0], a.p[1] ^ b.p[1]); }
+// 盤外のビットが立たないように有効ビットでマスクする
+inline Bitboard operator~(const Bitboard& a) { return make_bitboard(~a.p[0] & BB_MASK0, ~a.p[1] & BB_MASK1); }
+inline bool operator==(const Bitboard& a, const Bitboard& b) { return a.p[0] == b.p[0] && a.p[1] == b.p[1]; }
+inline bool operator!=(const Bitboard& a, const Bitboard& b) { return !(a == b); }
+// a & ~b
+inline Bitboard andnot(const Bitboard& a, const Bitboard& b) { return make_bitboard(a.p[0] & ~b.p[0], a.p[1] & ~b.p[1]); }
+
+// なのはの座標(0x11～0x99)⇔ビット番号(0～80)
+inline int conv_z2bb(int z) {
+    return ((z >> 4) - 1) * 9 + (z & 0x0F) - 1;
+}
+inline Square conv_bb2z(int i) {
+    return Square(((i / 9 + 1) << 4) | (i % 9 + 1));
+}
+
+// 64ビット語の下位ビットスキャンとビット数
+inline int first_one64(uint64_t b) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(b);
+#elif defined(_MSC_VER) && defined(IS_64BIT)
+    unsigned long idx;
+    _BitScanForward64(&idx, b);
+    return int(idx);
+#else
+    unsigned long idx;
+    if (_BitScanForward(&idx, static_cast<unsigned long>(b))) return int(idx);
+    _BitScanForward(&idx, static_cast<unsigned long>(b >> 32));
+    return int(idx) + 32;
+#endif
+}
+
+inline int count_1s64(uint64_t b) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(b);
+#elif defined(USE_POPCNT) && defined(_MSC_VER) && defined(IS_64BIT)
+    return int(__popcnt64(b));
+#else
+    return PopCnt32(static_cast<unsigned int>(b)) + PopCnt32(static_cast<unsigned int>(b >> 32));
+#endif
+}
+
+// pext(BMI2) : mask の立っているビットを下位に詰めて取り出す
+inline uint64_t pext64(uint64_t b, uint64_t mask) {
+#if defined(USE_BMI2)
+    return _pext_u64(b, mask);
+#else
+    uint64_t r = 0;
+    for (uint64_t bit = 1; mask; bit <<= 1) {
+        if (b & mask & (0 - mask)) r |= bit;
+        mask &= mask - 1;
+    }
+    return r;
+#endif
+}
+
+extern Bitboard SquareBB[81];
+extern Bitboard FileBB[10];                // [筋(1～9)]
+extern Bitboard RankBB[10];                // [段(1～9)]
+extern Bitboard AllBB;
+extern Bitboard StepAttackBB[GRY+1][81];   // 飛び利き以外の利き [駒][ビット番号] (馬・龍は玉の利きを持つ)
+extern Bitboard LanceAttackBB[2][81][128]; // 香の利き [手番][ビット番号][筋の中間7マスの占有状態]
+
+extern Bitboard RookMaskBB[81];
+extern Bitboard BishopMaskBB[81];
+extern int RookOffset[81];
+extern int BishopOffset[81];
+extern int RookMaskBits0[81];              // RookMaskBB[sq].p[0] のビット数
+extern int BishopMaskBits0[81];
+extern Bitboard RookAttackBB[495616];
+extern Bitboard BishopAttackBB[20224];
+
+extern void init_bitboards();
+
+inline bool Bitboard::test(int i) const {
+    return ((p[0] & SquareBB[i].p[0]) | (p[1] & SquareBB[i].p[1])) != 0;
+}
+
+inline void Bitboard::set(int i) {
+    p[0] |= SquareBB[i].p[0];
+    p[1] |= SquareBB[i].p[1];
+}
+
+inline void Bitboard::clr(int i) {
+    p[0] &= ~SquareBB[i].p[0];
+    p[1] &= ~SquareBB[i].p[1];
+}
+
+inline void Bitboard::xor_bit(int i) {
+    p[0] ^= SquareBB[i].p[0];
+    p[1] ^= SquareBB[i].p[1];
+}
+
+inline int Bitboard::count() const {
+    return count_1s64(p[0]) + count_1s64(p[1]);
+}
+
+inline int Bitboard::pop_first() {
+    int i;
+    if (p[0]) {
+        i = first_one64(p[0]);
+        p[0] &= p[0] - 1;
+    } else {
+        i = first_one64(p[1]) + 63;
+        p[1] &= p[1] - 1;
+    }
+    return i;
+}
+
+// 香の利き(筋の中間7マスの占有状態で表を引く)
+inline Bitboard lance_attack(Color c, int sq, const Bitboard& occ) {
+    const int f = sq / 9;
+    const int shift = (f < 7 ? f : f - 7) * 9 + 1;
+    const int idx = int((occ.p[f < 7 ? 0 : 1] >> shift) & 0x7F);
+    return LanceAttackBB[c][sq][idx];
+}
+
+inline Bitboard rook_attack(int sq, const Bitboard& occ) {
+    const Bitboard& mask = RookMaskBB[sq];
+    const uint64_t idx = pext64(occ.p[0], mask.p[0]) | (pext64(occ.p[1], mask.p[1]) << RookMaskBits0[sq]);
+    return RookAttackBB[RookOffset[sq] + idx];
+}
+
+inline Bitboard bishop_attack(int sq, const Bitboard& occ) {
+    const Bitboard& mask = BishopMaskBB[sq];
+    const uint64_t idx = pext64(occ.p[0], mask.p[0]) | (pext64(occ.p[1], mask.p[1]) << BishopMaskBits0[sq]);
+    return BishopAttackBB[BishopOffset[sq] + idx];
+}
+
+// 駒 pc が sq にいるときの利き
+inline Bitboard attacks_bb(Piece pc, int sq, const Bitboard& occ) {
+    switch (type_of(pc)) {
+    case KY: return lance_attack(color_of(pc), sq, occ);
+    case KA: return bishop_attack(sq, occ);
+    case HI: return rook_attack(sq, occ);
+    case UM: return bishop_attack(sq, occ) | StepAttackBB[pc][sq];
+    case RY: return rook_attack(sq, occ) | StepAttackBB[pc][sq];
+    default: return StepAttackBB[pc][sq];
+    }
+}
+
+#endif // !defined(BITBOARD_H_INCLUDED)
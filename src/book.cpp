@@ -35,6 +35,10 @@ Book::Book() : joseki(), RKiss()
         RKiss.rand<unsigned>();
 }
 Book::~Book() {}
+void Book::reseed(uint64_t seed)
+{
+    RKiss = RKISS(seed);
+}
 void Book::open(const std::string& fileName)
 {
     FILE *fp = fopen(fileName.c_str(), "rb");
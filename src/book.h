@@ -65,6 +65,8 @@ private:
 public:
     Book();
     ~Book();
+    // 手を選ぶ乱数を決まった値で初期化し直す(fork した子プロセスごとに変えるため)
+    void reseed(uint64_t seed);
     // 初期化
     void open(const std::string& fileName);
     void close();
@@ -0,0 +1,165 @@
+﻿/*
+  GodWhale, a  USI shogi(japanese-chess) playing engine derived from NanohaMini
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014 Kazuyuki Kawabata (NanohaMini author)
+  Copyright (C) 2015 ebifrier, espelade, kakiage
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  GodWhale is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(EVALFILE_H_INCLUDED)
+#define EVALFILE_H_INCLUDED
+
+#include <cstring>
+#include <stdint.h>
+
+//
+// 評価関数ファイルのヘッダ
+//
+// KPP_synthesized2.bin・KKP_synthesized.bin・KK_synthesized.bin の先頭に置く.
+// 表の大きさと要素の型、FV_SCALE、本体の FNV-1a チェックサムを持つ.
+// ヘッダのない従来のファイルもそのまま読める.
+// kpp2fv38 からも使うので、エンジンのほかのヘッダには依存しない.
+//
+
+const char EvalFileMagic[8] = { 'S', 'A', 'Y', 'A', 'E', 'V', 'A', 'L' };
+const uint32_t EvalFileVersion = 1;
+
+enum EvalTable {
+    EVAL_TABLE_KPP2 = 1,    // int16_t [nsquare][fe_end*(fe_end+1)/2] (i >= j の三角形)
+    EVAL_TABLE_KKP  = 2,    // int32_t [nsquare][nsquare][fe_end]
+    EVAL_TABLE_KK   = 3,    // int32_t [nsquare][nsquare]
+    EVAL_TABLE_KPP3 = 4     // int16_t [nsquare][fe_end][fe_end] (エンジンが使う形)
+};
+
+struct EvalFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t table;         // EvalTable
+    uint32_t nsquare;
+    uint32_t feEnd;
+    uint32_t elementSize;   // 要素のバイト数
+    uint32_t fvScale;
+    uint64_t payloadSize;   // 本体のバイト数
+    uint64_t checksum;      // 本体の FNV-1a(64ビット)
+};
+
+const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+
+// FNV-1a を hash に続けて計算する. 本体を分けて読むときは前回の値を渡す
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = FNV_OFFSET_BASIS) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+inline void init_eval_header(EvalFileHeader& h, EvalTable table, uint32_t nsquare, uint32_t feEnd,
+                             uint32_t elementSize, uint32_t fvScale, uint64_t payloadSize) {
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, EvalFileMagic, sizeof(h.magic));
+    h.version = EvalFileVersion;
+    h.table = table;
+    h.nsquare = nsquare;
+    h.feEnd = feEnd;
+    h.elementSize = elementSize;
+    h.fvScale = fvScale;
+    h.payloadSize = payloadSize;
+    h.checksum = FNV_OFFSET_BASIS;
+}
+
+//
+// 評価関数を1つにまとめたファイル(USI の EvalFile オプション)
+//
+// ヘッダの後に KPP・KKP・KK の区切りを EvalPackAlign ごとに並べる.
+// 表はエンジンがメモリに置くのと同じ形(KPP は EVAL_TABLE_KPP3、EVAL_KPP_TRI のときは三角形の
+// EVAL_TABLE_KPP2)なので、圧縮しないファイルはマップしてそのまま使える. もう一方の形の KPP は
+// 読むときに並べ替える. 圧縮するときは値を可変長で書く.
+// チェックサムは展開した後の本体で計算する.
+//
+
+const char EvalPackMagic[8] = { 'S', 'A', 'Y', 'A', 'P', 'A', 'C', 'K' };
+const uint32_t EvalPackVersion = 1;
+const uint64_t EvalPackAlign = 65536;   // Windows の MapViewOfFile の粒度
+
+enum EvalCodec {
+    EVAL_CODEC_NONE   = 0,  // そのまま
+    EVAL_CODEC_VARINT = 1   // 値をジグザグ符号化して 7ビットずつの可変長で書く
+};
+
+enum { EVAL_PACK_KPP, EVAL_PACK_KKP, EVAL_PACK_KK, EVAL_PACK_SECTIONS };
+
+struct EvalPackSection {
+    uint32_t table;         // EvalTable
+    uint32_t codec;         // EvalCodec
+    uint32_t elementSize;   // 要素のバイト数
+    uint32_t reserved;
+    uint64_t offset;        // ファイルの先頭からの位置. EvalPackAlign の倍数
+    uint64_t size;          // ファイル上のバイト数
+    uint64_t rawSize;       // 展開した後のバイト数
+    uint64_t checksum;      // 展開した後の FNV-1a(64ビット)
+};
+
+struct EvalPackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nsquare;
+    uint32_t feEnd;
+    uint32_t fvScale;
+    uint32_t sectionCount;
+    uint32_t reserved;
+    EvalPackSection section[EVAL_PACK_SECTIONS];
+};
+
+inline void init_eval_pack_header(EvalPackHeader& h, uint32_t nsquare, uint32_t feEnd, uint32_t fvScale) {
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, EvalPackMagic, sizeof(h.magic));
+    h.version = EvalPackVersion;
+    h.nsquare = nsquare;
+    h.feEnd = feEnd;
+    h.fvScale = fvScale;
+    h.sectionCount = EVAL_PACK_SECTIONS;
+}
+
+// v を可変長で out に書き、書いたバイト数(1～5)を返す
+inline size_t put_varint(unsigned char* out, int32_t v) {
+    uint32_t u = (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+    size_t n = 0;
+    while (u >= 0x80) {
+        out[n++] = (unsigned char)(u | 0x80);
+        u >>= 7;
+    }
+    out[n++] = (unsigned char)u;
+    return n;
+}
+
+// p から値を1つ読み、次の位置を返す. end を越えるときは NULL を返す
+inline const unsigned char* get_varint(const unsigned char* p, const unsigned char* end, int32_t& v) {
+    uint32_t u = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p == end) return NULL;
+        const uint32_t b = *p++;
+        u |= (b & 0x7f) << shift;
+        if (b < 0x80) {
+            v = int32_t(u >> 1) ^ -int32_t(u & 1);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+#endif // !defined(EVALFILE_H_INCLUDED)
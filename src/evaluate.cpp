@@ -20,21 +20,32 @@
 
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(_MSC_VER) || defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "position.h"
 #include "evaluate.h"
+#include "evalfile.h"
+#include "perform.h"
+#include "ucioption.h"
 
 // Aperyの評価値
 #include "param_new.h"
-#define FV_KPP  "KPP_synthesized.bin" 
 #define FV_KPP2 "KPP_synthesized2.bin" 
 #define FV_KKP  "KKP_synthesized.bin" 
 #define FV_KK   "KK_synthesized.bin" 
-#define USE_FVKPP2
-//#define TEST_FVKPP
 
 #define EHASH_MASK          0x3fffffU      //* occupies 32MB 
-#define FV_SCALE            32
 #define MATERIAL            (this->material)
 
 #define SQ_BKING            NanohaTbl::z2sq[kingS]
@@ -43,7 +54,6 @@
 #define HAND_W              (this->hand[WHITE].h)
 
 #define Inv(sq)             (nsquare-1-sq)
-#define PcPcOnSq(sq,i,j)    pc_on_sq[sq][(i)*((i)+1)/2+(j)]
 
 #define I2HandPawn(hand)    (((hand) & HAND_FU_MASK) >> HAND_FU_SHIFT)
 #define I2HandLance(hand)   (((hand) & HAND_KY_MASK) >> HAND_KY_SHIFT)
@@ -53,14 +63,38 @@
 #define I2HandBishop(hand)  (((hand) & HAND_KA_MASK) >> HAND_KA_SHIFT)
 #define I2HandRook(hand)    (((hand) & HAND_HI_MASK) >> HAND_HI_SHIFT)
 
-enum { pos_n = fe_end * (fe_end + 1) / 2 };
-typedef int16_t pc_on_pc_entry[pos_n];
 uint64_t ehash_tbl[EHASH_MASK + 1];
 
-typedef int16_t kkp_entry[fe_end];
-int16_t kpp3[nsquare][fe_end][fe_end];
-int32_t kkp[nsquare][nsquare][fe_end];
-int32_t kk[nsquare][nsquare];
+int16_t (*kpp)[kpp_n];
+int32_t (*kkp)[nsquare][fe_end];
+int32_t (*kk)[nsquare];
+int16_t (*kkp16)[nsquare][fe_end];
+int KkpShift;
+
+// 評価関数の表を置く領域. EvalFile をマップしたものか malloc() したもの
+struct EvalStorage {
+    char* base;
+    size_t size;
+    bool mapped;
+};
+
+static const size_t KppBytes = sizeof(int16_t) * nsquare * kpp_n;
+
+// エンジンが置く KPP の形と、読むときに並べ替えるもう一方の形
+#if defined(EVAL_KPP_TRI)
+static const EvalTable KppTable      = EVAL_TABLE_KPP2;
+static const EvalTable OtherKppTable = EVAL_TABLE_KPP3;
+static const size_t OtherKppCount    = size_t(nsquare) * fe_end * fe_end;
+#else
+static const EvalTable KppTable      = EVAL_TABLE_KPP3;
+static const EvalTable OtherKppTable = EVAL_TABLE_KPP2;
+static const size_t OtherKppCount    = size_t(nsquare) * pos_n;
+#endif
+static const size_t KkpBytes = sizeof(int32_t) * nsquare * nsquare * fe_end;
+static const size_t KkBytes  = sizeof(int32_t) * nsquare * nsquare;
+
+static EvalStorage CurrentEval = { NULL, 0, false };
+static std::string EvalFileName;
 
 namespace NanohaTbl {
     const short z2sq[] = {
@@ -172,88 +206,421 @@ void ehash_store(uint64_t key, unsigned int hand_b, int score)
     ehash_tbl[(unsigned int)key & EHASH_MASK] = hash_word;
 }
 
-void Position::init_evaluate()
+// 評価関数の表を1つ読む. ヘッダ(evalfile.h)があれば表の大きさとチェックサムを確かめる.
+// ヘッダのない従来のファイルは大きさだけを確かめる
+static bool read_eval_file(const char* fname, EvalTable table, size_t elementSize, void* buf, size_t count)
 {
-	FILE *fp = NULL;
-	size_t size;
-    int iret = 0;
+    FILE* fp = fopen(fname, "rb");
+    if (fp == NULL) return false;
+
+    bool ok = true;
+    EvalFileHeader h;
+    const bool hasHeader = (fread(&h, sizeof(h), 1, fp) == 1 && memcmp(h.magic, EvalFileMagic, sizeof(h.magic)) == 0);
+    if (hasHeader) {
+        ok = (h.version == EvalFileVersion && h.table == uint32_t(table)
+              && h.nsquare == uint32_t(nsquare) && h.feEnd == uint32_t(fe_end)
+              && h.elementSize == elementSize && h.fvScale == uint32_t(FV_SCALE)
+              && h.payloadSize == uint64_t(elementSize) * count);
+        if (!ok) std::cerr << "'" << fname << "' has a different table size." << std::endl;
+    } else {
+        rewind(fp);
+    }
+    ok = ok && fread(buf, elementSize, count, fp) == count && fgetc(fp) == EOF;
+    if (ok && hasHeader && fnv1a(buf, elementSize * count) != h.checksum) {
+        std::cerr << "'" << fname << "' is broken (checksum mismatch)." << std::endl;
+        ok = false;
+    }
+    fclose(fp);
+    return ok;
+}
 
-#if !defined(USE_FVKPP2) || defined(TEST_FVKPP)
-    //KPP
-    do {
-        fp = fopen(FV_KPP, "rb");
-        if (fp == NULL) { iret = -2; break; }
+static void release_storage(EvalStorage& st)
+{
+    if (st.base == NULL) return;
+    if (!st.mapped) {
+        free(st.base);
+    } else {
+#if defined(_MSC_VER) || defined(_WIN32)
+        UnmapViewOfFile(st.base);
+#else
+        munmap(st.base, st.size);
+#endif
+    }
+    st.base = NULL;
+}
 
-        size = nsquare * fe_end * fe_end;
-        if (fread(kpp3, sizeof(int16_t), size, fp) != size){ iret = -2; break; }
-        if (fgetc(fp) != EOF) { iret = -2; break; }
+// 表を st の中の位置に切り替え、前の領域を解放する
+static void use_storage(const EvalStorage& st, size_t kppOffset, size_t kkpOffset, size_t kkOffset)
+{
+    kpp = reinterpret_cast<int16_t (*)[kpp_n]>(st.base + kppOffset);
+    kkp = reinterpret_cast<int32_t (*)[nsquare][fe_end]>(st.base + kkpOffset);
+    kk  = reinterpret_cast<int32_t (*)[nsquare]>(st.base + kkOffset);
+    release_storage(CurrentEval);
+    CurrentEval = st;
+#if defined(EVAL_KKP16)
+    const int error = quantize_kkp();
+    std::cerr << "KKP quantized to int16_t: shift " << KkpShift << ", max error " << error << std::endl;
+#endif
+    ehash_clear();
+}
 
-    } while (0);
-    if (fp) fclose(fp);
+// kkp16 を作り直す. 値がすべて int16_t に収まる最小の KkpShift を選び、割った値を丸める.
+// 1要素あたりの丸めの誤差の最大値を返す. EVAL_KKP16 でなければ何もしない
+int quantize_kkp()
+{
+#if defined(EVAL_KKP16)
+    const int32_t* src = &kkp[0][0][0];
+    const size_t n = size_t(nsquare) * nsquare * fe_end;
+    if (kkp16 == NULL) {
+        kkp16 = reinterpret_cast<int16_t (*)[nsquare][fe_end]>(new int16_t[n]);
+    }
+    int32_t maxAbs = 0;
+    for (size_t i = 0; i < n; i++) {
+        maxAbs = Max(maxAbs, src[i] < 0 ? -src[i] : src[i]);
+    }
+    KkpShift = 0;
+    while ((maxAbs + (1 << KkpShift >> 1)) >> KkpShift > 32767) {
+        KkpShift++;
+    }
+    int16_t* dst = &kkp16[0][0][0];
+    const int32_t half = (1 << KkpShift) >> 1;
+    int32_t maxError = 0;
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = int16_t((src[i] + half) >> KkpShift);
+        const int32_t error = src[i] - dst[i] * (1 << KkpShift);
+        maxError = Max(maxError, error < 0 ? -error : error);
+    }
+    return maxError;
+#else
+    return 0;
 #endif
-#if defined(USE_FVKPP2)
-    pc_on_pc_entry *pc_on_sq = new pc_on_pc_entry[nsquare];
+}
 
-    do {
-        fp = fopen(FV_KPP2, "rb");
-        if (fp == NULL) { iret = -2; break; }
+// 表を3つ並べる領域を確保する
+static bool alloc_storage(EvalStorage& st)
+{
+    st.size = KppBytes + KkpBytes + KkBytes;
+    st.base = static_cast<char*>(malloc(st.size));
+    st.mapped = false;
+    return st.base != NULL;
+}
 
-        size = nsquare * pos_n;
-        if (fread(pc_on_sq, sizeof(short), size, fp) != size){ iret = -2; break; }
-        if (fgetc(fp) != EOF) { iret = -2; break; }
-    } while (0);
-    if (fp) fclose(fp);
+// ファイル全体をマップする. 学習で表を書き換えられるように書き込みはコピーオンライトにする
+static bool map_file(const std::string& path, EvalStorage& st)
+{
+#if defined(_MSC_VER) || defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    HANDLE mapping = GetFileSizeEx(file, &size) ? CreateFileMapping(file, NULL, PAGE_WRITECOPY, 0, 0, NULL) : NULL;
+    CloseHandle(file);
+    if (mapping == NULL) return false;
+    st.base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+    CloseHandle(mapping);
+    st.size = size_t(size.QuadPart);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat sb;
+    void* p = fstat(fd, &sb) == 0 ? mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    st.base = (p == MAP_FAILED) ? NULL : static_cast<char*>(p);
+    st.size = size_t(sb.st_size);
+#endif
+    st.mapped = true;
+    return st.base != NULL;
+}
+
+// 区切りの中身を raw(rawSize バイト)に展開する
+static bool decode_section(const EvalPackSection& sec, const unsigned char* data, void* raw)
+{
+    if (sec.codec == EVAL_CODEC_NONE) {
+        memcpy(raw, data, size_t(sec.size));
+        return sec.size == sec.rawSize;
+    }
+    const unsigned char* p = data;
+    const unsigned char* end = data + sec.size;
+    const size_t count = size_t(sec.rawSize / sec.elementSize);
+    for (size_t i = 0; i < count; i++) {
+        int32_t v;
+        if ((p = get_varint(p, end, v)) == NULL) return false;
+        if (sec.elementSize == sizeof(int16_t)) {
+            static_cast<int16_t*>(raw)[i] = int16_t(v);
+        } else {
+            static_cast<int32_t*>(raw)[i] = v;
+        }
+    }
+    return p == end;
+}
 
+// もう一方の形(OtherKppTable)の KPP をエンジンの形に並べ替える
+static void convert_kpp(const int16_t* src, int16_t (*dst)[kpp_n])
+{
     for (int sq = 0; sq < nsquare; ++sq) {
-        for (int k = 0; k < fe_end; k++){
-            for (int j = 0; j < fe_end; j++){
-                short value = (k <= j ? PcPcOnSq(sq, j, k) : PcPcOnSq(sq, k, j));
-#if defined(TEST_FVKPP)
-                if (kpp3[sq][k][j] != value) {
-                    std::cerr << "Failed to load '"FV_KPP2"' file." << std::endl;
-                    iret = -3;
-                    exit(-1);
-                }
+#if defined(EVAL_KPP_TRI)
+        // 正方形から三角形(i >= j)を取り出す
+        const int16_t* row = src + size_t(sq) * fe_end * fe_end;
+        for (int k = 0; k < fe_end; k++) {
+            memcpy(&dst[sq][k * (k + 1) / 2], row + k * fe_end, sizeof(int16_t) * (k + 1));
+        }
+#else
+        // 三角形を正方形に広げる
+        const int16_t* row = src + size_t(sq) * pos_n;
+        for (int k = 0; k < fe_end; k++) {
+            for (int j = 0; j <= k; j++) {
+                dst[sq][k * fe_end + j] = dst[sq][j * fe_end + k] = row[k * (k + 1) / 2 + j];
+            }
+        }
+#endif
+    }
+}
+
+bool load_eval_pack(const std::string& path)
+{
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        std::cerr << "Unable to open file " << path << std::endl;
+        return false;
+    }
+    EvalPackHeader h;
+    bool ok = fread(&h, sizeof(h), 1, fp) == 1 && memcmp(h.magic, EvalPackMagic, sizeof(h.magic)) == 0
+           && h.version == EvalPackVersion && h.nsquare == uint32_t(nsquare) && h.feEnd == uint32_t(fe_end)
+           && h.fvScale == uint32_t(FV_SCALE) && h.sectionCount == uint32_t(EVAL_PACK_SECTIONS);
+    fseek(fp, 0, SEEK_END);
+#if defined(_MSC_VER) || defined(_WIN32)
+    const uint64_t fileSize = _ftelli64(fp);
+#else
+    const uint64_t fileSize = ftello(fp);
 #endif
-                kpp3[sq][k][j] = value;
+
+    // 区切りの種類と大きさを確かめる. すべてそのまま置いてあればファイルをマップして使う
+    // KPP はもう一方の形(OtherKppTable)でもよい
+    static const EvalTable tables[EVAL_PACK_SECTIONS] = { KppTable, EVAL_TABLE_KKP, EVAL_TABLE_KK };
+    static const size_t rawSizes[EVAL_PACK_SECTIONS] = { KppBytes, KkpBytes, KkBytes };
+    bool mappable = true;
+    for (int i = 0; i < EVAL_PACK_SECTIONS && ok; i++) {
+        const EvalPackSection& sec = h.section[i];
+        const bool other = (i == EVAL_PACK_KPP && sec.table == OtherKppTable);
+        const size_t rawSize = other ? sizeof(int16_t) * OtherKppCount : rawSizes[i];
+        ok = (sec.table == uint32_t(tables[i]) || other)
+          && sec.elementSize == (i == EVAL_PACK_KPP ? sizeof(int16_t) : sizeof(int32_t))
+          && sec.codec <= EVAL_CODEC_VARINT && sec.rawSize == rawSize
+          && sec.offset % EvalPackAlign == 0 && sec.offset >= sizeof(h) && sec.offset + sec.size <= fileSize;
+        mappable = mappable && !other && sec.codec == EVAL_CODEC_NONE;
+    }
+    if (!ok) {
+        std::cerr << "'" << path << "' is not an evaluation file for this engine." << std::endl;
+        fclose(fp);
+        return false;
+    }
+
+    EvalStorage st;
+    size_t offsets[EVAL_PACK_SECTIONS];
+    if (mappable) {
+        fclose(fp);
+        ok = map_file(path, st);
+        for (int i = 0; i < EVAL_PACK_SECTIONS; i++) {
+            offsets[i] = size_t(h.section[i].offset);
+        }
+    } else {
+        ok = alloc_storage(st);
+        offsets[EVAL_PACK_KPP] = 0;
+        offsets[EVAL_PACK_KKP] = KppBytes;
+        offsets[EVAL_PACK_KK]  = KppBytes + KkpBytes;
+        std::vector<unsigned char> data;
+        for (int i = 0; i < EVAL_PACK_SECTIONS && ok; i++) {
+            const EvalPackSection& sec = h.section[i];
+            const bool other = (i == EVAL_PACK_KPP && sec.table == OtherKppTable);
+            data.resize(size_t(sec.size));
+#if defined(_MSC_VER) || defined(_WIN32)
+            ok = _fseeki64(fp, sec.offset, SEEK_SET) == 0;
+#else
+            ok = fseeko(fp, sec.offset, SEEK_SET) == 0;
+#endif
+            ok = ok && fread(&data[0], 1, data.size(), fp) == data.size();
+            if (!ok) break;
+            if (other) {
+                std::vector<int16_t> src(OtherKppCount);
+                ok = decode_section(sec, &data[0], &src[0]) && fnv1a(&src[0], size_t(sec.rawSize)) == sec.checksum;
+                if (ok) convert_kpp(&src[0], reinterpret_cast<int16_t (*)[kpp_n]>(st.base));
+            } else {
+                ok = decode_section(sec, &data[0], st.base + offsets[i]);
             }
         }
+        fclose(fp);
+    }
+    // 展開した表のチェックサムを確かめる. もう一方の形の KPP は並べ替える前に確かめた
+    for (int i = 0; i < EVAL_PACK_SECTIONS && ok; i++) {
+        if (i != EVAL_PACK_KPP || h.section[i].table != uint32_t(OtherKppTable)) {
+            ok = fnv1a(st.base + offsets[i], rawSizes[i]) == h.section[i].checksum;
+        }
     }
+    if (!ok) {
+        std::cerr << "'" << path << "' is broken." << std::endl;
+        release_storage(st);
+        return false;
+    }
+    use_storage(st, offsets[EVAL_PACK_KPP], offsets[EVAL_PACK_KKP], offsets[EVAL_PACK_KK]);
+    EvalFileName = path;
+    return true;
+}
 
-    delete[] pc_on_sq;
-    pc_on_sq = NULL;
+// 区切りにデータを書き足す. 圧縮するときは値を1つずつ可変長で書く
+static bool append_section(FILE* fp, EvalPackSection& sec, const void* data, size_t count)
+{
+    const size_t bytes = count * sec.elementSize;
+    sec.rawSize += bytes;
+    sec.checksum = fnv1a(data, bytes, sec.checksum);
+    if (sec.codec == EVAL_CODEC_NONE) {
+        sec.size += bytes;
+        return fwrite(data, 1, bytes, fp) == bytes;
+    }
+    std::vector<unsigned char> buf(count * 5);
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        n += put_varint(&buf[n], sec.elementSize == sizeof(int16_t) ? static_cast<const int16_t*>(data)[i]
+                                                                    : static_cast<const int32_t*>(data)[i]);
+    }
+    sec.size += n;
+    return fwrite(&buf[0], 1, n, fp) == n;
+}
+
+// 次の区切りを EvalPackAlign の位置から始める
+static bool begin_section(FILE* fp, EvalPackSection& sec, EvalTable table, size_t elementSize, bool compress)
+{
+    memset(&sec, 0, sizeof(sec));
+    sec.table = table;
+    sec.codec = compress ? EVAL_CODEC_VARINT : EVAL_CODEC_NONE;
+    sec.elementSize = uint32_t(elementSize);
+    sec.checksum = FNV_OFFSET_BASIS;
+#if defined(_MSC_VER) || defined(_WIN32)
+    const uint64_t pos = _ftelli64(fp);
+#else
+    const uint64_t pos = ftello(fp);
 #endif
+    sec.offset = (pos + EvalPackAlign - 1) / EvalPackAlign * EvalPackAlign;
+    static const char zero[4096] = { 0 };
+    for (uint64_t n = pos; n < sec.offset; n += sizeof(zero)) {
+        if (fwrite(zero, 1, size_t(Min(uint64_t(sizeof(zero)), sec.offset - n)), fp) == 0) return false;
+    }
+    return true;
+}
 
-	//KKP
-    do {
-        fp = fopen(FV_KKP, "rb");
-        if (fp == NULL) { iret = -2; break; }
+// 今の評価関数を1つのファイルに書き出す
+bool save_eval_pack(const std::string& path, bool compress)
+{
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (fp == NULL) {
+        std::cerr << "Unable to open file " << path << std::endl;
+        return false;
+    }
+    EvalPackHeader h;
+    init_eval_pack_header(h, nsquare, fe_end, FV_SCALE);
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
 
-        size = nsquare * nsquare * fe_end;
-        if (fread(kkp, sizeof(int32_t), size, fp) != size){ iret = -2; break; }
-        if (fgetc(fp) != EOF) { iret = -2; break; }
+    ok = ok && begin_section(fp, h.section[EVAL_PACK_KPP], KppTable, sizeof(int16_t), compress);
+    for (int sq = 0; sq < nsquare && ok; sq++) {
+        ok = append_section(fp, h.section[EVAL_PACK_KPP], kpp[sq], kpp_n);
+    }
+    ok = ok && begin_section(fp, h.section[EVAL_PACK_KKP], EVAL_TABLE_KKP, sizeof(int32_t), compress);
+    for (int sq = 0; sq < nsquare && ok; sq++) {
+        ok = append_section(fp, h.section[EVAL_PACK_KKP], kkp[sq], nsquare * fe_end);
+    }
+    ok = ok && begin_section(fp, h.section[EVAL_PACK_KK], EVAL_TABLE_KK, sizeof(int32_t), compress)
+            && append_section(fp, h.section[EVAL_PACK_KK], kk, nsquare * nsquare);
 
-    } while (0);
-    if (fp) fclose(fp);
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        std::cerr << "write error in " << path << std::endl;
+    }
+    return ok;
+}
 
-	//KK
-	do {
-        fp = fopen(FV_KK, "rb");
-        if (fp == NULL) { iret = -2; break; }
+const std::string& eval_file_name()
+{
+    return EvalFileName;
+}
 
-        size = nsquare * nsquare;
-        if (fread(kk, sizeof(int32_t), size, fp) != size){ iret = -2; break; }
-        if (fgetc(fp) != EOF) { iret = -2; break; }
+/// eval_pack() は起動時に読んだ評価関数(引数があればそのファイル)を EvalFile の形式で書き出す.
+///
+///   evalpack [-compress] [-o file = saya_chan.eval] [input file]
+///
+/// 従来の *_synthesized.bin(kpp2fv38 の出力)を1つのファイルにまとめるときや、
+/// 配布のために圧縮するとき、圧縮したものをマップできる形に戻すときに使う.
 
-    } while (0);
-    if (fp) fclose(fp);
+void eval_pack(int argc, char* argv[])
+{
+    std::string output = "saya_chan.eval";
+    std::string input;
+    bool compress = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-compress") == 0) {
+            compress = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] != '-') {
+            input = argv[i];
+        } else {
+            std::cerr << "Error!:argv = " << argv[i] << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    // マップしているファイルには書けない
+    if (output == input || (CurrentEval.mapped && output == eval_file_name())) {
+        std::cerr << "Error!:output file " << output << " is being read" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (!input.empty() && !load_eval_pack(input)) {
+        exit(EXIT_FAILURE);
+    }
+    if (!save_eval_pack(output, compress)) {
+        exit(EXIT_FAILURE);
+    }
+    std::cout << "wrote " << output << (compress ? " (compressed)" : "") << std::endl;
+}
+
+// EvalFile があればそれを、なければ従来の *_synthesized.bin を読む
+void Position::init_evaluate()
+{
+    const std::string evalFile = Options["EvalFile"].value<std::string>();
+    FILE* fp = fopen(evalFile.c_str(), "rb");
+    if (fp != NULL) {
+        fclose(fp);
+        if (!load_eval_pack(evalFile)) exit(-1);
+        return;
+    }
+    EvalFileName = evalFile;
+
+    int iret = 0;
+    EvalStorage st;
+    if (!alloc_storage(st)) {
+        std::cerr << "Can't allocate memory for evaluation tables." << std::endl;
+        exit(-1);
+    }
+
+	//KPP
+#if defined(EVAL_KPP_TRI)
+    if (!read_eval_file(FV_KPP2, EVAL_TABLE_KPP2, sizeof(short), st.base, nsquare * pos_n)) iret = -2;
+#else
+    std::vector<int16_t> tri(size_t(nsquare) * pos_n);
+    if (!read_eval_file(FV_KPP2, EVAL_TABLE_KPP2, sizeof(short), &tri[0], nsquare * pos_n)) iret = -2;
+    convert_kpp(&tri[0], reinterpret_cast<int16_t (*)[kpp_n]>(st.base));
+#endif
+
+	//KKP
+    if (!read_eval_file(FV_KKP, EVAL_TABLE_KKP, sizeof(int32_t), st.base + KppBytes, nsquare * nsquare * fe_end)) iret = -2;
+
+	//KK
+    if (!read_eval_file(FV_KK, EVAL_TABLE_KK, sizeof(int32_t), st.base + KppBytes + KkpBytes, nsquare * nsquare)) iret = -2;
 
     if (iret < 0) {
         std::cerr << "Can't load '*_synthesized' file." << std::endl;
         exit(-1);
     }
 
-    ehash_clear();
+    use_storage(st, 0, KppBytes, KppBytes + KkpBytes);
 }
 
 int Position::compute_material() const
@@ -464,30 +831,85 @@ int Position::make_list_correct(int list0[PIECENUMBER_MAX + 1],
     return nlist;
 }
 
+// 評価に使う KKP の値
+static inline int kkp_value(int sq_bk, int sq_wk, int k)
+{
+#if defined(EVAL_KKP16)
+    return kkp16[sq_bk][sq_wk][k] * (1 << KkpShift);
+#else
+    return kkp[sq_bk][sq_wk][k];
+#endif
+}
+
+#if defined(EVAL_KPP_TRI)
+// list を昇順に並べる. 特徴の番号のビットを立ててから小さい順に取り出す
+static inline void sort_list(int list[], int n)
+{
+    uint64_t bits[(fe_end + 63) / 64] = { 0 };
+    for (int i = 0; i < n; i++) {
+        bits[list[i] >> 6] |= uint64_t(1) << (list[i] & 63);
+    }
+    n = 0;
+    for (int w = 0; w < (fe_end + 63) / 64; w++) {
+        for (uint64_t b = bits[w]; b; b &= b - 1) {
+            list[n++] = w * 64 + first_one64(b);
+        }
+    }
+}
+#endif
+
 // 評価値のスケール前の値を計算します。
+// EVAL_KPP_TRI のときは、KPP は和の順番によらないので list0・list1 をそれぞれ昇順に並べ、
+// 三角形の行 list[kn] の先頭側 list[j] (j < kn) を前から順に足す.
 int Position::evaluate_raw_correct() const
 {
     int list0[PIECENUMBER_MAX + 1]; //駒番号numのlist0
     int list1[PIECENUMBER_MAX + 1]; //駒番号numのlist1
     int nlist = make_list_correct(list0, list1);
+#if defined(EVAL_KPP_TRI)
+    sort_list(list0, nlist);
+    sort_list(list1, nlist);
+#endif
 
     const int sq_bk = SQ_BKING;
     const int sq_wk = SQ_WKING;
 
-    const kkp_entry* ppkppb = kpp3[sq_bk];
-    const kkp_entry* ppkppw = kpp3[Inv(sq_wk)];
+    const int16_t* kppb = kpp[sq_bk];
+    const int16_t* kppw = kpp[Inv(sq_wk)];
 
     int score = kk[sq_bk][sq_wk];
     for (int kn = 0; kn < nlist; kn++){
         const int k0 = list0[kn];
         const int k1 = list1[kn];
-        const int16_t* pkppb = ppkppb[k0];
-        const int16_t* pkppw = ppkppw[k1];
+        const int16_t* pkppb = kppb + kpp_offset(k0, 0);
+        const int16_t* pkppw = kppw + kpp_offset(k1, 0);
         for (int j = 0; j < kn; j++){
             score += pkppb[list0[j]];
             score -= pkppw[list1[j]];
         }
-        score += kkp[sq_bk][sq_wk][k0];
+        score += kkp_value(sq_bk, sq_wk, k0);
+    }
+
+    return score;
+}
+
+// 量子化していない kkp で評価値を計算します。EVAL_KKP16 の誤差を調べるのに使います。
+int Position::evaluate_raw_reference() const
+{
+    int list0[PIECENUMBER_MAX + 1];
+    int list1[PIECENUMBER_MAX + 1];
+    int nlist = make_list_correct(list0, list1);
+
+    const int sq_bk = SQ_BKING;
+    const int sq_wk = SQ_WKING;
+
+    int score = kk[sq_bk][sq_wk];
+    for (int kn = 0; kn < nlist; kn++){
+        for (int j = 0; j < kn; j++){
+            score += kpp_value(kpp[sq_bk], list0[kn], list0[j]);
+            score -= kpp_value(kpp[Inv(sq_wk)], list1[kn], list1[j]);
+        }
+        score += kkp[sq_bk][sq_wk][list0[kn]];
     }
 
     return score;
@@ -548,16 +970,16 @@ void Position::make_list_move(PieceNumber kn, Piece piece, Square to)
 		return;
 	}
 
-    st->oldlist[0] = list0[kn];
-    st->oldlist[1] = list1[kn];
+    st->oldlist[0] = static_cast<ListIndex>(list0[kn]);
+    st->oldlist[1] = static_cast<ListIndex>(list1[kn]);
 
     const int sq = conv_z2sq(to);
     list0[kn] = NanohaTbl::KppIndex0[piece] + sq;
     list1[kn] = NanohaTbl::KppIndex1[piece] + Inv(sq);
 
 #if defined(EVAL_DIFF)
-    st->newlist[0] = list0[kn];
-    st->newlist[1] = list1[kn];
+    st->newlist[0] = static_cast<ListIndex>(list0[kn]);
+    st->newlist[1] = static_cast<ListIndex>(list1[kn]);
 #endif
 }
 
@@ -574,11 +996,11 @@ void Position::make_list_capture(PieceNumber kn, Piece captureType)
     assert(PIECENUMBER_MIN <= kn && kn <= PIECENUMBER_MAX);
 
     // 捕られる駒の情報
-    st->oldcap[0] = list0[kn];
-    st->oldcap[1] = list1[kn];
+    st->oldcap[0] = static_cast<ListIndex>(list0[kn]);
+    st->oldcap[1] = static_cast<ListIndex>(list1[kn]);
 
     // 捕った持駒の情報
-    st->capHand = captureType;
+    st->capHand = static_cast<uint8_t>(captureType);
 
     // 1枚増やす
     const int count = ++handcount[captureType];
@@ -587,8 +1009,8 @@ void Position::make_list_capture(PieceNumber kn, Piece captureType)
     listkn[list0[kn]] = kn;
 
 #if defined(EVAL_DIFF)
-    st->newcap[0] = list0[kn];
-    st->newcap[1] = list1[kn];
+    st->newcap[0] = static_cast<ListIndex>(list0[kn]);
+    st->newcap[1] = static_cast<ListIndex>(list1[kn]);
     st->changeType = 2;
 #endif
 
@@ -616,8 +1038,8 @@ PieceNumber Position::make_list_drop(Piece piece, Square to)
     assert(handIndex0 < fe_hand_end);
 
     // knをセーブ
-    st->oldlist[0] = list0[kn];
-    st->oldlist[1] = list1[kn];
+    st->oldlist[0] = static_cast<ListIndex>(list0[kn]);
+    st->oldlist[1] = static_cast<ListIndex>(list1[kn]);
 
     listkn[handIndex0] = PIECENUMBER_NONE; // 駒番号の一番大きい持ち駒を消去
     handcount[piece]--;                    // 打つので１枚減らす
@@ -628,8 +1050,8 @@ PieceNumber Position::make_list_drop(Piece piece, Square to)
     list1[kn] = NanohaTbl::KppIndex1[piece] + Inv(sq);
 
 #if defined(EVAL_DIFF)
-    st->newlist[0] = list0[kn];
-    st->newlist[1] = list1[kn];
+    st->newlist[0] = static_cast<ListIndex>(list0[kn]);
+    st->newlist[1] = static_cast<ListIndex>(list1[kn]);
 #endif
     return kn;
 }
@@ -649,22 +1071,18 @@ int Position::evaluate_raw_make_list_diff()
     const int sq_bk = SQ_BKING;
     const int sq_wk = SQ_WKING;
 
-    const kkp_entry* ppkppb = kpp3[sq_bk];
-    const kkp_entry* ppkppw = kpp3[Inv(sq_wk)];
+    const int16_t* kppb = kpp[sq_bk];
+    const int16_t* kppw = kpp[Inv(sq_wk)];
 
     int score = kk[sq_bk][sq_wk];
     for (int kn = PIECENUMBER_MIN; kn <= PIECENUMBER_MAX; kn++){
         const int k0 = list0[kn];
         const int k1 = list1[kn];
-        const short* pkppb = ppkppb[k0];
-        const short* pkppw = ppkppw[k1];
         for (int j = PIECENUMBER_MIN; j < kn; j++){
-            const int l0 = list0[j];
-            const int l1 = list1[j];
-            score += pkppb[l0];
-            score -= pkppw[l1];
+            score += kpp_value(kppb, k0, list0[j]);
+            score -= kpp_value(kppw, k1, list1[j]);
         }
-        score += kkp[sq_bk][sq_wk][k0];
+        score += kkp_value(sq_bk, sq_wk, k0);
     }
 
     return score;
@@ -675,17 +1093,17 @@ int Position::evaluate_raw_make_list_diff()
 #if defined(EVAL_DIFF)
 // 差分計算
 // index[2]は動かした駒のlist
-int Position::doapc(const int index[2]) const
+int Position::doapc(const ListIndex index[2]) const
 {
     const int sq_bk = SQ_BKING;
     const int sq_wk = SQ_WKING;
 
-    int sum = kkp[sq_bk][sq_wk][index[0]];
-    const auto* pkppb = kpp3[sq_bk][index[0]];
-    const auto* pkppw = kpp3[Inv(sq_wk)][index[1]];
+    int sum = kkp_value(sq_bk, sq_wk, index[0]);
+    const int16_t* kppb = kpp[sq_bk];
+    const int16_t* kppw = kpp[Inv(sq_wk)];
     for (int kn = PIECENUMBER_MIN; kn <= PIECENUMBER_MAX; kn++) {
-        sum += pkppb[list0[kn]];
-        sum -= pkppw[list1[kn]];
+        sum += kpp_value(kppb, index[0], list0[kn]);
+        sum -= kpp_value(kppw, index[1], list1[kn]);
     }
 
     return sum;
@@ -698,8 +1116,8 @@ bool Position::calc_difference(SearchStack* ss) const
     if ((ss - 1)->staticEvalRaw == INT_MAX) { return false; }
     int diff = 0;
 
-    const auto* ppkppb = kpp3[SQ_BKING];
-    const auto* ppkppw = kpp3[Inv(SQ_WKING)];
+    const int16_t* ppkppb = kpp[SQ_BKING];
+    const int16_t* ppkppw = kpp[Inv(SQ_WKING)];
 
     /* oldは引く。newは足す。
      * 参照されてない＆２重に参照してるとこに注意
@@ -707,7 +1125,10 @@ bool Position::calc_difference(SearchStack* ss) const
 
     // king-move
     // TODO: 差分計算できるらしい
-    if (st->changeType == 0) { return false; }
+    if (st->changeType == 0) {
+        PERF_COUNT(threadID, PERF_EVAL_KING);
+        return false;
+    }
 
     // newlist
     diff += doapc(st->newlist);
@@ -715,33 +1136,33 @@ bool Position::calc_difference(SearchStack* ss) const
     diff -= doapc(st->oldlist);
 
     // newlist oldlist 引きすぎたので足す
-    diff += ppkppb[st->newlist[0]][st->oldlist[0]];
-    diff -= ppkppw[st->newlist[1]][st->oldlist[1]];
+    diff += kpp_value(ppkppb, st->newlist[0], st->oldlist[0]);
+    diff -= kpp_value(ppkppw, st->newlist[1], st->oldlist[1]);
 
     // cap
     if (st->changeType == 2) { // newが２つ
 
         // newcap oldlist 引きすぎたので足す
-        diff += ppkppb[st->newcap[0]][st->oldlist[0]];
-        diff -= ppkppw[st->newcap[1]][st->oldlist[1]];
+        diff += kpp_value(ppkppb, st->newcap[0], st->oldlist[0]);
+        diff -= kpp_value(ppkppw, st->newcap[1], st->oldlist[1]);
 
         // newcap
         diff += doapc(st->newcap);
         // newlist newcap (２回足されてるので引く)
-        diff -= ppkppb[st->newlist[0]][st->newcap[0]];
-        diff += ppkppw[st->newlist[1]][st->newcap[1]];
+        diff -= kpp_value(ppkppb, st->newlist[0], st->newcap[0]);
+        diff += kpp_value(ppkppw, st->newlist[1], st->newcap[1]);
 
         // oldcap
         diff -= doapc(st->oldcap);
         // new oldcap 引きすぎたので足す
-        diff += ppkppb[st->newlist[0]][st->oldcap[0]];
-        diff -= ppkppw[st->newlist[1]][st->oldcap[1]];
-        diff += ppkppb[st->newcap[0]][st->oldcap[0]];
-        diff -= ppkppw[st->newcap[1]][st->oldcap[1]];
+        diff += kpp_value(ppkppb, st->newlist[0], st->oldcap[0]);
+        diff -= kpp_value(ppkppw, st->newlist[1], st->oldcap[1]);
+        diff += kpp_value(ppkppb, st->newcap[0], st->oldcap[0]);
+        diff -= kpp_value(ppkppw, st->newcap[1], st->oldcap[1]);
 
         // oldcap oldlist 参照されてない 
-        diff -= ppkppb[st->oldcap[0]][st->oldlist[0]];
-        diff += ppkppw[st->oldcap[1]][st->oldlist[1]];
+        diff -= kpp_value(ppkppb, st->oldcap[0], st->oldlist[0]);
+        diff += kpp_value(ppkppw, st->oldcap[1], st->oldlist[1]);
     }
     //else if (st->ct !=1 ){ MYABORT(); }
 
@@ -767,12 +1188,14 @@ int Position::evaluate_raw_body()
 
 Value Position::evaluate(const Color us, SearchStack* ss)
 {
+    PROFILE_SCOPE(threadID, PROF_EVALUATE);
 	int score = 0;
 
 #if defined(EVAL_DIFF)
     // null move
     if (ss->staticEvalRaw != INT_MAX) {
         score = int(ss->staticEvalRaw);
+        PERF_COUNT(threadID, PERF_EVAL_DIFF);
     }
     else
 #endif
@@ -787,6 +1210,7 @@ Value Position::evaluate(const Color us, SearchStack* ss)
 #if defined(EVAL_DIFF)
 	if (calc_difference(ss)) {
         score = int(ss->staticEvalRaw);
+        PERF_COUNT(threadID, PERF_EVAL_DIFF);
         //ehash_store(st->key, HAND_B, score);
     } else
 #endif
@@ -794,6 +1218,7 @@ Value Position::evaluate(const Color us, SearchStack* ss)
     {
         // 普通に評価値を計算
         score = evaluate_raw_body();
+        PERF_COUNT(threadID, PERF_EVAL_FULL);
         //ehash_store(st->key, HAND_B, score);
 #if defined(EVAL_DIFF)
         ss->staticEvalRaw = Value(score);
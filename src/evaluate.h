@@ -22,6 +22,8 @@
 #if !defined(EVALUATE_H_INCLUDED)
 #define EVALUATE_H_INCLUDED
 
+#include <string>
+
 #include "types.h"
 #include "search.h"
 
@@ -31,4 +33,45 @@ extern int ehash_probe(uint64_t current_key, unsigned int hand_b, int * __restri
 extern void ehash_store(uint64_t key, unsigned int hand_b, int score);
 extern void ehash_clear();
 
+// 評価関数の表の値をこれで割ると評価値になる
+#define FV_SCALE            32
+
+// 評価関数の表(evaluate.cpp). 玉のマスは conv_z2sq() の番号.
+// EvalFile を圧縮せずに書いたときはファイルをマップした領域を指す.
+// KPP は玉のマスごとの行 kpp[sq] の kpp_offset(i, j) に置く. ふつうは正方形 [fe_end][fe_end].
+// EVAL_KPP_TRI のときは kpp[i][j] == kpp[j][i] なので i >= j の三角形だけを持ち(半分の大きさ)、
+// 行 i は i * (i + 1) / 2 から始まる. 引くたびに比較とかけ算が要るので、既定では使わない
+enum { pos_n = fe_end * (fe_end + 1) / 2 };
+#if defined(EVAL_KPP_TRI)
+enum { kpp_n = pos_n };
+inline int kpp_offset(int i, int j) {
+    return i >= j ? i * (i + 1) / 2 + j : j * (j + 1) / 2 + i;
+}
+#else
+enum { kpp_n = fe_end * fe_end };
+inline int kpp_offset(int i, int j) {
+    return i * fe_end + j;
+}
+#endif
+extern int16_t (*kpp)[kpp_n];
+extern int32_t (*kkp)[nsquare][fe_end];
+extern int32_t (*kk)[nsquare];
+
+// 評価に使う KKP. kkp を 2^KkpShift で割って int16_t にしたもの(EVAL_KKP16 のとき)
+extern int16_t (*kkp16)[nsquare][fe_end];
+extern int KkpShift;
+
+inline int kpp_value(const int16_t* row, int i, int j) {
+    return row[kpp_offset(i, j)];
+}
+
+// kkp を書き換えたら呼ぶ
+extern int quantize_kkp();
+
+// 評価関数を1つにまとめたファイル(evalfile.h)を読む. 失敗したときは今の評価関数のまま
+extern bool load_eval_pack(const std::string& path);
+extern bool save_eval_pack(const std::string& path, bool compress);
+// 今の評価関数を読んだときの EvalFile オプションの値
+extern const std::string& eval_file_name();
+
 #endif // !defined(EVALUATE_H_INCLUDED)
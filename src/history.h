@@ -25,6 +25,7 @@
 #include <iostream>
 #include <cstring>
 #include <cassert>
+#include "move.h"
 #include "types.h"
 
 /// The History class stores statistics about how often different moves
@@ -39,6 +40,9 @@ class History {
 public:
     void clear();
     Value value(Piece p, Square to) const;
+#if defined(NANOHA)
+    Value value(Move m) const;    // 動かす駒(成る手は成った後の駒)と移動先で引く
+#endif
     void update(Piece p, Square to, Value bonus);
     Value gain(Piece p, Square to) const;
     void update_gain(Piece p, Square to, Value g);
@@ -80,6 +84,13 @@ inline Value History::value(Piece p, Square to) const {
 #endif
 }
 
+#if defined(NANOHA)
+inline Value History::value(Move m) const {
+    assert(m != MOVE_NULL);
+    return history[NanohaTbl::MovePiece2Index[(static_cast<unsigned int>(m) >> 16) & 0x3F]][move_to(m)];
+}
+#endif
+
 inline void History::update(Piece p, Square to, Value bonus) {
 #if defined(NANOHA)
     const int idx = NanohaTbl::Piece2Index[p];
@@ -1,5 +1,6 @@
 ﻿
 #include <vector>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 
@@ -25,6 +26,21 @@ namespace {
         "五", "六", "七", "八", "九"
     };
 
+    // 棋譜の指し手で使う駒の名前(成香などは2文字)
+    static const std::vector<std::string> MovePieceStrTable = {
+        "〇", "歩", "香", "桂", "銀", "金", "角", "飛",
+        "玉", "と", "成香", "成桂", "成銀", "×", "馬", "龍"
+    };
+
+    static const std::vector<std::string> ZenkakuNumberTable = {
+        "０", "１", "２", "３", "４", "５", "６", "７", "８", "９"
+    };
+
+    static const std::vector<std::string> CsaPieceStrTable = {
+        "..", "FU", "KY", "KE", "GI", "KI", "KA", "HI",
+        "OU", "TO", "NY", "NK", "NG", "--", "UM", "RY"
+    };
+
     static void print_piece(std::ostream &os, Piece piece, Square to, bool useGaiji);
     static void print_hand(std::ostream &os, Hand const & hand);
     static void print_hand0(std::ostream &os, int n, const std::string &str);
@@ -148,3 +164,164 @@ std::string position_to_kif_ex(Position const & pos, Move last/*= MOVE_NONE*/)
 {
     return position_to_kif_internal(pos, last, true);
 }
+
+namespace {
+
+    /**
+     * @brief 平手の初期局面かどうかを調べます。
+     */
+    static bool is_hirate(Position const & pos)
+    {
+        const Position hirate("lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1", pos.thread());
+        return pos.to_fen() == hirate.to_fen();
+    }
+
+    /**
+     * @brief 消費時間(ミリ秒)をKIF形式の「( 0:01/00:00:01)」にします。
+     */
+    static std::string kif_time(int msec, int64_t totalMsec)
+    {
+        const int sec = msec / 1000;
+        const int total = int(totalMsec / 1000);
+        char buf[64];
+
+        sprintf(buf, "(%2d:%02d/%02d:%02d:%02d)",
+                sec / 60, sec % 60, total / 3600, total / 60 % 60, total % 60);
+        return buf;
+    }
+
+    /**
+     * @brief 持ち駒をCSA形式の「P+00KI00FU」にします。
+     */
+    static std::string csa_hand(Color c, Hand const & hand)
+    {
+        const int num[] = {
+            0, (int)hand.getFU(), (int)hand.getKY(), (int)hand.getKE(),
+            (int)hand.getGI(), (int)hand.getKI(), (int)hand.getKA(), (int)hand.getHI()
+        };
+        std::string str;
+
+        for (int pt = HI; pt >= FU; pt--) {
+            for (int i = 0; i < num[pt]; i++) {
+                str += "00" + CsaPieceStrTable[pt];
+            }
+        }
+        return str.empty() ? str : std::string(c == BLACK ? "P+" : "P-") + str + "\n";
+    }
+}
+
+/**
+ * @brief 指し手をKIF形式の棋譜の指し手(「７六歩(77)」など)にします。
+ *
+ * prevは直前の指し手で、同じ升に動くときは「同　歩(77)」とします。
+ */
+std::string move_to_kif_record(Move m, Move prev/*= MOVE_NONE*/)
+{
+    const Square to = move_to(m);
+    const Square from = move_from(m);
+    std::ostringstream os;
+
+    if (prev != MOVE_NONE && move_to(prev) == to) {
+        os << "同　";
+    }
+    else {
+        os << ZenkakuNumberTable[file_of(to)] << KanjiNumberTable[rank_of(to)];
+    }
+    os << MovePieceStrTable[move_ptype(m)];
+
+    if (move_is_drop(m)) {
+        os << "打";
+    }
+    else {
+        if (is_promotion(m)) os << "成";
+        os << "(" << int(file_of(from)) << int(rank_of(from)) << ")";
+    }
+    return os.str();
+}
+
+/**
+ * @brief 対局をKIF形式の棋譜にします。
+ *
+ * msecは指し手ごとの消費時間、endWordは「投了」「千日手」などの終局の表記、
+ * winnerは勝った側(引き分けはCOLOR_NONEなど先手・後手以外)です。
+ */
+std::string game_to_kif(Position const & start, std::vector<Move> const & moves,
+                        std::vector<int> const & msec, std::string const names[2],
+                        std::string const & endWord, int winner)
+{
+    std::ostringstream os;
+    int64_t total[2] = { 0, 0 };
+
+    os << "# ---- " << names[0] << " vs " << names[1] << " ----" << std::endl;
+    if (is_hirate(start)) {
+        os << "手合割：平手" << std::endl;
+    }
+    else {
+        os << position_to_kif(start) << std::endl;
+    }
+    os << "先手：" << names[0] << std::endl;
+    os << "後手：" << names[1] << std::endl;
+    os << "手数----指手---------消費時間--" << std::endl;
+
+    const int first = (start.side_to_move() == BLACK ? 0 : 1);
+    Move prev = MOVE_NONE;
+    for (size_t i = 0; i < moves.size(); i++) {
+        const int t = (i < msec.size() ? msec[i] : 0);
+        total[(first + i) & 1] += t;
+        os << std::setw(4) << i + 1 << " " << move_to_kif_record(moves[i], prev)
+           << "   " << kif_time(t, total[(first + i) & 1]) << std::endl;
+        prev = moves[i];
+    }
+    os << std::setw(4) << moves.size() + 1 << " " << endWord << std::endl;
+
+    if (winner == BLACK || winner == WHITE) {
+        os << "まで" << moves.size() << "手で" << (winner == BLACK ? "先手" : "後手") << "の勝ち" << std::endl;
+    }
+    else {
+        os << "まで" << moves.size() << "手で" << endWord << std::endl;
+    }
+    return os.str();
+}
+
+/**
+ * @brief 対局をCSA形式の棋譜にします。
+ *
+ * endCmdは「%TORYO」「%SENNICHITE」などの終局の表記です。
+ */
+std::string game_to_csa(Position const & start, std::vector<Move> const & moves,
+                        std::vector<int> const & msec, std::string const names[2],
+                        std::string const & endCmd)
+{
+    std::ostringstream os;
+
+    os << "V2.2" << std::endl;
+    os << "N+" << names[0] << std::endl;
+    os << "N-" << names[1] << std::endl;
+    if (is_hirate(start)) {
+        os << "PI" << std::endl;
+    }
+    else {
+        for (Rank rank = RANK_1; rank <= RANK_9; rank++) {
+            os << "P" << int(rank);
+            for (File file = FILE_9; file >= FILE_1; file--) {
+                const Piece piece = start.piece_on(make_square(file, rank));
+                if (piece == EMP) {
+                    os << " * ";
+                }
+                else {
+                    os << (color_of(piece) == BLACK ? "+" : "-") << CsaPieceStrTable[type_of(piece)];
+                }
+            }
+            os << std::endl;
+        }
+        os << csa_hand(BLACK, start.hand_of(BLACK)) << csa_hand(WHITE, start.hand_of(WHITE));
+    }
+    os << (start.side_to_move() == BLACK ? "+" : "-") << std::endl;
+
+    for (size_t i = 0; i < moves.size(); i++) {
+        os << move_to_csa(moves[i]) << std::endl;
+        os << "T" << (i < msec.size() ? msec[i] / 1000 : 0) << std::endl;
+    }
+    os << endCmd << std::endl;
+    return os.str();
+}
@@ -1,393 +1,437 @@
-﻿
-#include <cassert>
+﻿//
+// kpp2fv38 : Apery の評価関数をこのエンジンの形式に変換する.
+//
+//   kpp2fv38 [-threads N] [-samples N] [-o output dir] [input dir]
+//
+// 入力は input dir(既定 .)の KPP_synthesized.bin・KKP_synthesized.bin・KK_synthesized.bin.
+// 出力は output dir(既定 fv38)の KPP_synthesized2.bin・KKP_synthesized.bin・KK_synthesized.bin で、
+// それぞれ evalfile.h のヘッダ(表の大きさ、FV_SCALE、チェックサム)を付ける.
+// 特徴の番号と玉のマスは Apery と同じなので、KPP は対称な表の i >= j の三角形だけを残し、
+// KKP と KK はそのまま写す.
+//
+// 入力は玉のマスごとに読み、スレッド数分の玉のマスをまとめて並列に変換するので、
+// メモリはスレッドあたり約 7MB で済む. 変換の後で、評価関数の計算
+// (Position::evaluate_raw_correct と同じ kk + Σkkp + Σkpp(先手玉) - Σkpp(後手玉))を
+// ランダムな玉の位置と駒の並びで入力と出力から求めて比べる.
+//
+
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#else
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#endif
 
+#include "../evalfile.h"
 
-#define WCSC25
+using namespace std;
 
-// 評価関数関連定義
-#ifdef WCSC25
-#define FV_KPP "KPP_synthesized.bin"
-#define FV_KKP "KKP_synthesized.bin"
-#define FV_KK  "KK_synthesized.bin"
-#else
-#define FV_KPP "KPP.bin"
-#define FV_KKP "KKP.bin"
-#define FV_KK  "KK.bin"
-#endif
+#define FV_KPP  "KPP_synthesized.bin"
+#define FV_KKP  "KKP_synthesized.bin"
+#define FV_KK   "KK_synthesized.bin"
 #define MAKE_FV "KPP_synthesized2.bin"
 
-#define FV_SCALE            32 
+#define FV_SCALE            32
+
+#define Inv(sq)             (nsquare - 1 - (sq))
 
-#define Inv(sq)             inverseSq(sq)
-#define Asq(Bsq)            convertSq(Bsq)
-#define PcPcOnSq(k,i,j)     pc_on_sq[k][(i)*((i)+1)/2+(j)]
+// 特徴の数は Apery と同じ(持駒 90 + 盤上の駒 18種 × 81マス). エンジンの types.h の fe_end と一致する
+enum { nsquare = 81, fe_hand_end = 90, fe_end = fe_hand_end + 18 * 81 };
+enum { pos_n = fe_end * (fe_end + 1) / 2 };
+enum { MAX_THREADS = 64, NLIST = 38 };
 
-enum {
-	promote = 8, EMPTY = 0,	/* VC++でemptyがぶつかるので変更 */
-	pawn, lance, knight, silver, gold, bishop, rook, king, pro_pawn,
-	pro_lance, pro_knight, pro_silver, piece_null, horse, dragon
+namespace {
+
+// 入力と出力で評価関数を計算して比べる玉の位置と駒の並び
+struct Sample {
+    int bk, wk;
+    int list0[NLIST];
+    int list1[NLIST];
+    int64_t src[2];     // 入力の KPP の和 [先手玉/後手玉]. 別々のスレッドが書く
+    int64_t srcKK;      // 入力の KK と KKP の和
+    int64_t dst;        // 出力から求めた評価関数
 };
 
-enum { nhand = 7, nfile = 9, nrank = 9, nsquare = 81 };
-
-enum {
-	f_hand_pawn = 0, // 0
-	e_hand_pawn = f_hand_pawn + 19,
-	f_hand_lance = e_hand_pawn + 19,
-	e_hand_lance = f_hand_lance + 5,
-	f_hand_knight = e_hand_lance + 5,
-	e_hand_knight = f_hand_knight + 5,
-	f_hand_silver = e_hand_knight + 5,
-	e_hand_silver = f_hand_silver + 5,
-	f_hand_gold = e_hand_silver + 5,
-	e_hand_gold = f_hand_gold + 5,
-	f_hand_bishop = e_hand_gold + 5,
-	e_hand_bishop = f_hand_bishop + 3,
-	f_hand_rook = e_hand_bishop + 3,
-	e_hand_rook = f_hand_rook + 3,
-	fe_hand_end = e_hand_rook + 3,
-
-	a_f_pawn = fe_hand_end,
-	a_e_pawn = a_f_pawn + 81,
-	a_f_lance = a_e_pawn + 81,
-	a_e_lance = a_f_lance + 81,
-	a_f_knight = a_e_lance + 81,
-	a_e_knight = a_f_knight + 81,
-	a_f_silver = a_e_knight + 81,
-	a_e_silver = a_f_silver + 81,
-	a_f_gold = a_e_silver + 81,
-	a_e_gold = a_f_gold + 81,
-	a_f_bishop = a_e_gold + 81,
-	a_e_bishop = a_f_bishop + 81,
-	a_f_horse = a_e_bishop + 81,
-	a_e_horse = a_f_horse + 81,
-	a_f_rook = a_e_horse + 81,
-	a_e_rook = a_f_rook + 81,
-	a_f_dragon = a_e_rook + 81,
-	a_e_dragon = a_f_dragon + 81,
-	a_fe_end = a_e_dragon + 81,
-
-	f_pawn = 81,
-	e_pawn = 162,
-	f_lance = 225,
-	e_lance = 306,
-	f_knight = 360,
-	e_knight = 441,
-	f_silver = 504,
-	e_silver = 585,
-	f_gold = 666,
-	e_gold = 747,
-	f_bishop = 828,
-	e_bishop = 909,
-	f_horse = 990,
-	e_horse = 1071,
-	f_rook = 1152,
-	e_rook = 1233,
-	f_dragon = 1314,
-	e_dragon = 1395,
-	fe_end = 1476
+// 玉のマス1つ分の KPP の変換
+struct KppWork {
+    int king;
+    vector<short> in;   // [fe_end][fe_end]
+    vector<short> out;  // 三角形 [pos_n]
+    int64_t asymmetric; // kpp[i][j] != kpp[j][i] の数
 };
 
-enum { pos_n = a_fe_end * (a_fe_end + 1) / 2 };
+int Threads = 1;
+vector<Sample> Samples;
+KppWork Work[MAX_THREADS];
 
-namespace {
-	short apery_kpp[nsquare][a_fe_end][a_fe_end];
-	int apery_kkp[nsquare][nsquare][a_fe_end];
-	int apery_kk[nsquare][nsquare];
-
-	short kpp[nsquare][fe_end][fe_end];
-	short pc_on_sq[nsquare][pos_n];
-	int kkp[nsquare][nsquare][fe_end];
-	int kk[nsquare][nsquare];
-
-	const int sqbegin[18] = {
-		9,0,9,0,18,0,0,0,0,0,0,0,0,0,0,0,0,0
-	};
-
-	const int sqend[18] = {
-		81,72,81,72,81,63,81,81,81,81,81,81,81,81,81,81,81,81
-	};
-
-	const int aikppb[18] = {
-		f_pawn,    e_pawn,    f_lance,  e_lance,  f_knight,  e_knight, 
-		f_silver,  e_silver,  f_gold,   e_gold,   f_bishop,  e_bishop, 
-		f_horse,   e_horse,   f_rook,   e_rook,   f_dragon,  e_dragon
-	};
-
-	const int aikppw[18] = {
-		e_pawn,    f_pawn,    e_lance,  f_lance,  e_knight,  f_knight,
-		e_silver,  f_silver,  e_gold,   f_gold,   e_bishop,  f_bishop,
-		e_horse,   f_horse,   e_rook,   f_rook,   e_dragon,  f_dragon 
-	};
-
-	const int a_aikppb[18] = {
-		a_f_pawn,    a_e_pawn,    a_f_lance,  a_e_lance,  a_f_knight,  a_e_knight,
-		a_f_silver,  a_e_silver,  a_f_gold,   a_e_gold,   a_f_bishop,  a_e_bishop,
-		a_f_horse,   a_e_horse,   a_f_rook,   a_e_rook,   a_f_dragon,  a_e_dragon 
-	};
-
-	const int a_aikppw[18] = {
-		a_e_pawn,    a_f_pawn,    a_e_lance,  a_f_lance,  a_e_knight,  a_f_knight,
-		a_e_silver,  a_f_silver,  a_e_gold,   a_f_gold,   a_e_bishop,  a_f_bishop,
-		a_e_horse,   a_f_horse,   a_e_rook,   a_f_rook,   a_e_dragon,  a_f_dragon 
-	};
+uint64_t rand_state = 0x9e3779b97f4a7c15ULL;
 
+uint64_t rand64() {
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 2685821657736338717ULL;
 }
 
-inline int convertSq(const int Bsq) {
-	return ((8 - (Bsq % 9)) * 9 + (Bsq / 9));
+double now_msec() {
+#if defined(_WIN32)
+    return double(GetTickCount64());
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+#endif
 }
 
-inline int inverseSq(const int Bsq) {
-	return (nsquare - 1 - Bsq);
+inline int tri(int i, int j) {
+    return i >= j ? i * (i + 1) / 2 + j : j * (j + 1) / 2 + i;
 }
 
-void main()
-{
-    const char *fname = "評価ベクトル";
-	FILE *fp;
-	size_t size;
-	int iret = 0;
-
-    // Aperyの評価を読み込む
-	do {
-		fname = FV_KPP;
-		fp = fopen(fname, "rb");
-		if (fp == NULL) { iret = -2; break; }
-
-		size = nsquare * a_fe_end * a_fe_end;
-		if (fread(apery_kpp, sizeof(short), size, fp) != size){
-			iret = -2;
-			break;
-		}
-		if (fgetc(fp) != EOF) {
-			iret = -2;
-			break;
-		}
-	} while (0);
-	if (fp) fclose(fp);
-
-    for (int sq = 0; sq < nfile * nrank; ++sq) {
-        for (int i = 0; i < a_fe_end; i++) {
-            for (int j = 0; j <= i; j++) {
-                PcPcOnSq(sq, i, j) = apery_kpp[sq][i][j];
+// 重複しない特徴の並びを作る
+void random_list(int list[NLIST]) {
+    for (int n = 0; n < NLIST; n++) {
+        bool dup;
+        do {
+            list[n] = int(rand64() % fe_end);
+            dup = false;
+            for (int m = 0; m < n; m++) {
+                dup = dup || list[m] == list[n];
             }
+        } while (dup);
+    }
+}
+
+// 玉のマス king の KPP の行から、その玉を使う見本の KPP の和を求める
+int64_t kpp_sum(const int list[NLIST], const short* kpp, bool triangle) {
+    int64_t sum = 0;
+    for (int i = 0; i < NLIST; i++) {
+        for (int j = 0; j < i; j++) {
+            sum += triangle ? kpp[tri(list[i], list[j])] : kpp[list[i] * fe_end + list[j]];
         }
     }
+    return sum;
+}
 
-    // MAKE_FVに書き出す
-    do {
-        fname = MAKE_FV;
-        fp = fopen(fname, "wb");
-        if (fp == NULL) { iret = -2; break; }
-
-        //kpp
-        size = nsquare * pos_n;
-        if (fwrite(pc_on_sq, sizeof(short), size, fp) != size){
-            iret = -2;
-            break;
+void convert_kpp(int id) {
+    KppWork& w = Work[id];
+    const short* in = &w.in[0];
+    short* out = &w.out[0];
+
+    w.asymmetric = 0;
+    for (int i = 0; i < fe_end; i++) {
+        for (int j = 0; j <= i; j++) {
+            out[i * (i + 1) / 2 + j] = in[i * fe_end + j];
+            if (in[i * fe_end + j] != in[j * fe_end + i]) {
+                w.asymmetric++;
+            }
+        }
+    }
+    for (size_t n = 0; n < Samples.size(); n++) {
+        Sample& s = Samples[n];
+        if (s.bk == w.king) {
+            s.src[0] = kpp_sum(s.list0, in, false);
         }
-    } while (0);
-    if (fp) fclose(fp);
-
-#if 0
-	do {
-		//KKP
-		fname = FV_KKP;
-		fp = fopen(fname, "rb");
-		if (fp == NULL) { iret = -2; break; }
-
-		size = nsquare * nsquare * a_fe_end;
-		if (fread(apery_kkp, sizeof(int), size, fp) != size){
-			iret = -2;
-			break;
-		}
-		if (fgetc(fp) != EOF) {
-			iret = -2;
-			break;
-		}
-	} while (0);
-	if (fp) fclose(fp);
-
-	do {
-		//kk
-		fname = FV_KK;
-		fp = fopen(fname, "rb");
-		if (fp == NULL) { iret = -2; break; }
-
-		size = nsquare * nsquare;
-		if (fread(apery_kk, sizeof(int), size, fp) != size){
-			iret = -2;
-			break;
-		}
-		if (fgetc(fp) != EOF) {
-			iret = -2;
-			break;
-		}
-	} while (0);
-	if (fp) fclose(fp);
-	printf("読み込み成功\n");
-
-//変換
-	// KK
-	for (int ksq = 0; ksq < 81; ksq++) {
-		const int ksqA = Asq(ksq);
-
-		for (int ksq2 = 0; ksq2 < 81; ksq2++) {
-			const int ksq2A = Asq(ksq2);
-
-			kk[ksq][ksq2] = apery_kk[ksqA][ksq2A];
-		}
-	}
-	printf("　KK変換成功\n");
-
-	// KKH
-	for (int ksq = 0; ksq < 81; ksq++){
-		const int ksqA = Asq(ksq);
-
-		for (int ksq2 = 0; ksq2 < 81; ksq2++){
-			const int ksq2A = Asq(ksq2);
-
-			for (int i = 0; i < fe_hand_end; i++){ //p1駒種
-
-				kkp[ksq][ksq2][i] = apery_kkp[ksqA][ksq2A][i];
-			}
-		}
-	}
-
-	// KKB
-	for (int ksq = 0; ksq < 81; ksq++){
-		const int ksqA = Asq(ksq); 
-
-		for (int ksq2 = 0; ksq2 < 81; ksq2++){
-			const int ksq2A = Asq(ksq2);
-
-			for (int i = 0; i < 18; i++){ //p駒種
-				const int begin = sqbegin[i];
-				const int end = sqend[i];
-				for (int isq = begin; isq < end; isq++){
-					const int isqA = Asq(isq);
-					const int k0  = aikppb[i] + isq;
-					const int k0A = a_aikppb[i] + isqA;
-
-					kkp[ksq][ksq2][k0] = apery_kkp[ksqA][ksq2A][k0A];
-				}
-			}
-		}
-	}
-	printf("　KKP変換成功\n");
-
-	//KHH
-	for (int ksq = 0; ksq < 81; ksq++){
-		const int ksqA = Asq(ksq);
-
-		for (int i = 0; i < fe_hand_end; i++){ //p1駒種手駒
-
-			for (int j = 0; j < fe_hand_end; j++){//p2駒種手駒
-
-				kpp[ksq][i][j] = apery_kpp[ksqA][i][j];
-			}
-		}
-	}
-
-
-	//KBH
-	for (int ksq = 0; ksq < 81; ksq++){
-		const int ksqA = Asq(ksq);
-
-		for (int i = 0; i < 18; i++){ //p1駒種
-			const int ibeg = sqbegin[i];
-			const int iend = sqend[i];
-			for (int isq = ibeg; isq < iend; isq++){ //p1位置
-				const int isqA = Asq(isq);
-				const int k0 = aikppb[i] + isq;
-				const int k0A = a_aikppb[i] + isqA;
-
-				for (int j = 0; j < fe_hand_end; j++){//p2駒種手駒
-
-					kpp[ksq][k0][j] = apery_kpp[ksqA][k0A][j];
-					kpp[ksq][j][k0] = apery_kpp[ksqA][j][k0A];
-				}
-			}
-		}
-	}
-
-
-	// KBB
-	for (int ksq = 0; ksq < 81; ksq++){
-		const int ksqA = Asq(ksq);
-
-		for (int i = 0; i < 18; i++){ //p1駒種
-			const int ibeg = sqbegin[i];
-			const int iend = sqend[i];
-			for (int isq = ibeg; isq < iend; isq++){ //p1位置
-				const int isqA = Asq(isq);
-				const int k0 = aikppb[i] + isq;
-				const int k0A = a_aikppb[i] + isqA;
-
-				for (int j = 0; j < 18; j++){ //p2駒種
-					const int jbeg = sqbegin[j];
-					const int jend = sqend[j];
-					for (int jsq = jbeg; jsq < iend; jsq++){ //p2位置
-						const int jsqA = Asq(jsq);
-						const int l0 = aikppb[j] + jsq;
-						const int l0A = a_aikppb[j] + jsqA;
-
-						kpp[ksq][k0][l0] = apery_kpp[ksqA][k0A][l0A];
-					}
-				}
-			}
-		}
-	}
-	
-
-	// KPPを三角テーブルに変換
-	for (int k = 0; k < 81; k++) {
-		for (int i = 0; i < fe_end; i++) {
-			for (int j = 0; j < i; j++) {
-				PcPcOnSq(k, i, j) = kpp[k][i][j];
-			};
-		};
-	};
-	printf("変換成功\n");
-
-
-
-//MAKE_FVに書き出す
-	do {
-		fname = MAKE_FV;
-		fp = fopen(fname, "wb");
-		if (fp == NULL) { iret = -2; break; }
-		
-		//kpp
-		size = nsquare * pos_n;
-		if (fwrite(pc_on_sq, sizeof(short), size, fp) != size){
-			iret = -2;
-			break;
-		}
-		
-		//kkp
-		size = nsquare * nsquare * fe_end;
-		if (fwrite(kkp, sizeof(int), size, fp) != size){
-			iret = -2;
-			break;
-		}
-		
-		//kk
-		size = nsquare * nsquare;
-		if (fwrite(kk, sizeof(int), size, fp) != size){
-			iret = -2;
-			break;
-		}
-		if (fgetc(fp) != EOF) {
-			iret = -2;
-			break;
-		}
-
-	} while (0);
-	if (fp) fclose(fp);
+        if (Inv(s.wk) == w.king) {
+            s.src[1] = kpp_sum(s.list1, in, false);
+        }
+    }
+}
+
+// f(id) を id = 0..n-1 のスレッドで並列に実行し、すべて終わるまで待つ
+void (*ThreadFunc)(int);
+
+#if defined(_WIN32)
+DWORD WINAPI thread_routine(LPVOID arg) {
+    ThreadFunc(int(intptr_t(arg)));
+    return 0;
+}
+#else
+void* thread_routine(void* arg) {
+    ThreadFunc(int(intptr_t(arg)));
+    return NULL;
+}
+#endif
+
+void run_threads(int n, void (*f)(int)) {
+    ThreadFunc = f;
+#if defined(_WIN32)
+    HANDLE handles[MAX_THREADS];
+    for (int i = 1; i < n; i++) {
+        handles[i] = CreateThread(NULL, 0, thread_routine, (LPVOID)intptr_t(i), 0, NULL);
+    }
+    f(0);
+    for (int i = 1; i < n; i++) {
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+    }
+#else
+    pthread_t handles[MAX_THREADS];
+    for (int i = 1; i < n; i++) {
+        pthread_create(&handles[i], NULL, thread_routine, (void*)intptr_t(i));
+    }
+    f(0);
+    for (int i = 1; i < n; i++) {
+        pthread_join(handles[i], NULL);
+    }
+#endif
+}
+
+// 入力ファイルを開き、大きさが size バイトか確かめる
+FILE* open_input(const string& fname, int64_t size) {
+    FILE* fp = fopen(fname.c_str(), "rb");
+    if (fp == NULL) {
+        cerr << "Unable to open file " << fname << endl;
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+#if defined(_WIN32)
+    const int64_t actual = _ftelli64(fp);
+#else
+    const int64_t actual = ftello(fp);
 #endif
+    fseek(fp, 0, SEEK_SET);
+    if (actual != size) {
+        cerr << fname << ": size " << actual << " != " << size << endl;
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+// ヘッダの場所を空けて出力ファイルを開く. ヘッダは finish_output() で書く
+FILE* open_output(const string& fname, EvalFileHeader& h) {
+    FILE* fp = fopen(fname.c_str(), "wb");
+    if (fp == NULL) {
+        cerr << "Unable to open file " << fname << endl;
+        return NULL;
+    }
+    fwrite(&h, sizeof(h), 1, fp);
+    return fp;
+}
+
+bool finish_output(FILE* fp, const EvalFileHeader& h) {
+    const bool ok = fseek(fp, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, fp) == 1;
+    return (fclose(fp) == 0) && ok;
+}
 
-    printf("コンプリート\n");
+// 出力ファイルを読み直し、ヘッダとチェックサムを確かめる. 本体は玉のマスごとに f(king, row) に渡す
+bool verify_output(const string& fname, EvalTable table, size_t rowSize, void (*f)(int, const void*)) {
+    FILE* fp = fopen(fname.c_str(), "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    EvalFileHeader h;
+    bool ok = fread(&h, sizeof(h), 1, fp) == 1 && memcmp(h.magic, EvalFileMagic, sizeof(h.magic)) == 0
+           && h.table == uint32_t(table) && h.payloadSize == uint64_t(rowSize) * nsquare;
+    vector<char> row(rowSize);
+    uint64_t checksum = FNV_OFFSET_BASIS;
+    for (int k = 0; k < nsquare && ok; k++) {
+        ok = fread(&row[0], 1, rowSize, fp) == rowSize;
+        checksum = fnv1a(&row[0], rowSize, checksum);
+        f(k, &row[0]);
+    }
+    ok = ok && fgetc(fp) == EOF && checksum == h.checksum;
+    fclose(fp);
+    if (!ok) {
+        cerr << fname << ": verification failed" << endl;
+    }
+    return ok;
+}
+
+void verify_kpp_row(int king, const void* row) {
+    const short* kpp = static_cast<const short*>(row);
+    for (size_t n = 0; n < Samples.size(); n++) {
+        Sample& s = Samples[n];
+        if (s.bk == king) {
+            s.dst += kpp_sum(s.list0, kpp, true);
+        }
+        if (Inv(s.wk) == king) {
+            s.dst -= kpp_sum(s.list1, kpp, true);
+        }
+    }
+}
+
+void verify_kkp_row(int king, const void* row) {
+    const int* kkp = static_cast<const int*>(row);
+    for (size_t n = 0; n < Samples.size(); n++) {
+        Sample& s = Samples[n];
+        if (s.bk == king) {
+            for (int i = 0; i < NLIST; i++) {
+                s.dst += kkp[s.wk * fe_end + s.list0[i]];
+            }
+        }
+    }
+}
+
+void verify_kk_row(int king, const void* row) {
+    const int* kk = static_cast<const int*>(row);
+    for (size_t n = 0; n < Samples.size(); n++) {
+        if (Samples[n].bk == king) {
+            Samples[n].dst += kk[Samples[n].wk];
+        }
+    }
+}
+
+// KKP・KK を玉のマスごとに写す. 同じ表の見本の和も求める
+bool copy_table(const string& src, const string& dst, EvalTable table, int rowInts) {
+    const size_t rowSize = rowInts * sizeof(int);
+    FILE* in = open_input(src, int64_t(rowSize) * nsquare);
+    if (in == NULL) {
+        return false;
+    }
+    EvalFileHeader h;
+    init_eval_header(h, table, nsquare, fe_end, sizeof(int), FV_SCALE, uint64_t(rowSize) * nsquare);
+    FILE* out = open_output(dst, h);
+    if (out == NULL) {
+        fclose(in);
+        return false;
+    }
+    vector<int> row(rowInts);
+    bool ok = true;
+    for (int k = 0; k < nsquare && ok; k++) {
+        ok = fread(&row[0], 1, rowSize, in) == rowSize && fwrite(&row[0], 1, rowSize, out) == rowSize;
+        h.checksum = fnv1a(&row[0], rowSize, h.checksum);
+        for (size_t n = 0; n < Samples.size(); n++) {
+            Sample& s = Samples[n];
+            if (s.bk != k) continue;
+            if (table == EVAL_TABLE_KK) {
+                s.srcKK += row[s.wk];
+            } else {
+                for (int i = 0; i < NLIST; i++) {
+                    s.srcKK += row[s.wk * fe_end + s.list0[i]];
+                }
+            }
+        }
+    }
+    fclose(in);
+    return finish_output(out, h) && ok;
+}
+
+bool convert_kpp_table(const string& src, const string& dst) {
+    const size_t inRow = size_t(fe_end) * fe_end;
+    FILE* in = open_input(src, int64_t(inRow) * sizeof(short) * nsquare);
+    if (in == NULL) {
+        return false;
+    }
+    EvalFileHeader h;
+    init_eval_header(h, EVAL_TABLE_KPP2, nsquare, fe_end, sizeof(short), FV_SCALE,
+                     uint64_t(pos_n) * sizeof(short) * nsquare);
+    FILE* out = open_output(dst, h);
+    if (out == NULL) {
+        fclose(in);
+        return false;
+    }
+    for (int i = 0; i < Threads; i++) {
+        Work[i].in.resize(inRow);
+        Work[i].out.resize(pos_n);
+    }
+
+    bool ok = true;
+    int64_t asymmetric = 0;
+    for (int k0 = 0; k0 < nsquare && ok; k0 += Threads) {
+        const int n = min(Threads, nsquare - k0);
+        for (int i = 0; i < n && ok; i++) {
+            Work[i].king = k0 + i;
+            ok = fread(&Work[i].in[0], sizeof(short), inRow, in) == inRow;
+        }
+        if (!ok) break;
+        run_threads(n, convert_kpp);
+        for (int i = 0; i < n && ok; i++) {
+            ok = fwrite(&Work[i].out[0], sizeof(short), pos_n, out) == size_t(pos_n);
+            h.checksum = fnv1a(&Work[i].out[0], pos_n * sizeof(short), h.checksum);
+            asymmetric += Work[i].asymmetric;
+        }
+    }
+    fclose(in);
+    for (int i = 0; i < Threads; i++) {
+        vector<short>().swap(Work[i].in);
+        vector<short>().swap(Work[i].out);
+    }
+    if (asymmetric > 0) {
+        cerr << "warning: " << asymmetric << " KPP entries are not symmetric (kpp[i][j] != kpp[j][i])" << endl;
+    }
+    return finish_output(out, h) && ok;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    string inDir = ".";
+    string outDir = "fv38";
+    int samples = 1000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            Threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-samples") == 0 && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outDir = argv[++i];
+        } else if (argv[i][0] != '-') {
+            inDir = argv[i];
+        } else {
+            cerr << "Usage: kpp2fv38 [-threads N] [-samples N] [-o output dir] [input dir]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (Threads < 1 || Threads > MAX_THREADS || samples < 0 || inDir == outDir) {
+        cerr << "Error!:threads = " << Threads << ", samples = " << samples
+             << ", input dir = " << inDir << ", output dir = " << outDir << endl;
+        return EXIT_FAILURE;
+    }
+#if defined(_WIN32)
+    _mkdir(outDir.c_str());
+#else
+    mkdir(outDir.c_str(), 0777);
+#endif
+
+    Samples.resize(samples);
+    for (int n = 0; n < samples; n++) {
+        Sample& s = Samples[n];
+        memset(&s, 0, sizeof(s));
+        s.bk = int(rand64() % nsquare);
+        do {
+            s.wk = int(rand64() % nsquare);
+        } while (s.wk == s.bk);
+        random_list(s.list0);
+        random_list(s.list1);
+    }
+
+    const double start = now_msec();
+    bool ok = convert_kpp_table(inDir + "/" + FV_KPP, outDir + "/" + MAKE_FV);
+    ok = ok && copy_table(inDir + "/" + FV_KKP, outDir + "/" + FV_KKP, EVAL_TABLE_KKP, nsquare * fe_end);
+    ok = ok && copy_table(inDir + "/" + FV_KK, outDir + "/" + FV_KK, EVAL_TABLE_KK, nsquare);
+    const double time = now_msec() - start;
+    if (!ok) {
+        cerr << "conversion failed" << endl;
+        return EXIT_FAILURE;
+    }
+    const double mbytes = (double(nsquare) * fe_end * fe_end * sizeof(short)
+                           + double(nsquare) * nsquare * (fe_end + 1) * sizeof(int)) / (1024 * 1024);
+    printf("converted %.0f MB in %.0f ms (%.0f MB/s, %d threads)\n", mbytes, time, mbytes * 1000 / time, Threads);
+
+    // 書き出したファイルを読み直し、入力から求めた評価関数と比べる
+    ok = verify_output(outDir + "/" + MAKE_FV, EVAL_TABLE_KPP2, pos_n * sizeof(short), verify_kpp_row)
+      && verify_output(outDir + "/" + FV_KKP, EVAL_TABLE_KKP, nsquare * fe_end * sizeof(int), verify_kkp_row)
+      && verify_output(outDir + "/" + FV_KK, EVAL_TABLE_KK, nsquare * sizeof(int), verify_kk_row);
+    int mismatch = 0;
+    for (size_t n = 0; n < Samples.size(); n++) {
+        const Sample& s = Samples[n];
+        if (s.srcKK + s.src[0] - s.src[1] != s.dst) {
+            mismatch++;
+        }
+    }
+    printf("verified %d samples: %d mismatches\n", samples, mismatch);
+    return (ok && mismatch == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,64 @@
+﻿/*
+  GodWhale, a  USI shogi(japanese-chess) playing engine derived from NanohaMini
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014 Kazuyuki Kawabata (NanohaMini author)
+  Copyright (C) 2015 ebifrier, espelade, kakiage
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  GodWhale is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(LEARN_H_INCLUDED)
+#define LEARN_H_INCLUDED
+
+#include "bitboard.h"
+#include "movegen.h"
+#include "position.h"
+
+//
+// 教師局面
+//
+// gensfen が書き出し、評価関数の学習で読む. ファイルはこの構造体を並べただけの
+// バイナリで、ヘッダは持たない(ファイルを連結・分割・シャッフルできるように).
+// 局面は Position::EncodeHuffman() の256ビットで、DecodeHuffman() で戻す.
+//
+
+struct PackedSfenValue {
+    unsigned char sfen[32];     // Position::EncodeHuffman()
+    int16_t score;              // 手番側から見た探索の評価値
+    uint16_t move;              // 最善手(pack_move16)
+    uint16_t gamePly;           // 対局開始からの手数
+    int8_t result;              // 手番側から見た対局の結果. 1:勝ち 0:引き分け -1:負け
+    uint8_t padding;
+};
+
+// 指し手の16ビット表現. 移動先(ビット番号 0～80)を下位7ビットに、
+// 移動元(ビット番号 0～80)か打つ駒(81 + 駒の種類 - 1)を次の7ビットに、成りを14ビット目に置く.
+// 取った駒を含まないので、局面の合法手と照合して戻す
+inline uint16_t pack_move16(Move m) {
+    const int to = conv_z2bb(move_to(m));
+    const int from = move_is_drop(m) ? 81 + type_of(move_piece(m)) - FU : conv_z2bb(move_from(m));
+    return uint16_t(to | (from << 7) | (is_promotion(m) ? (1 << 14) : 0));
+}
+
+inline Move unpack_move16(const Position& pos, uint16_t m16) {
+    for (MoveList<MV_LEGAL> ml(pos); !ml.end(); ++ml) {
+        if (pack_move16(ml.move()) == m16) {
+            return ml.move();
+        }
+    }
+    return MOVE_NONE;
+}
+
+#endif // !defined(LEARN_H_INCLUDED)
@@ -0,0 +1,425 @@
+﻿/*
+  GodWhale, a  USI shogi(japanese-chess) playing engine derived from NanohaMini
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014 Kazuyuki Kawabata (NanohaMini author)
+  Copyright (C) 2015 ebifrier, espelade, kakiage
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  GodWhale is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "evaluate.h"
+#include "learn.h"
+#include "lock.h"
+#include "misc.h"
+#include "position.h"
+#include "rkiss.h"
+#include "thread.h"
+
+using namespace std;
+
+#if defined(NANOHA)
+
+namespace {
+
+//
+// 学習するパラメータ
+//
+// KPP は kpp[k][i][j] == kpp[k][j][i] なので、KPP_synthesized2.bin と同じ三角形(i >= j)の
+// 要素だけを持つ. i と j を入れ替えた要素は同じパラメータとして更新する(対称な更新).
+// KPP、KKP、KK を1本の添字に並べ、float の重み・勾配・AdaGrad の勾配の2乗和を持つ.
+//
+const int64_t KppSize    = int64_t(nsquare) * pos_n;
+const int64_t KkpOffset  = KppSize;
+const int64_t KkpSize    = int64_t(nsquare) * nsquare * fe_end;
+const int64_t KkOffset   = KkpOffset + KkpSize;
+const int64_t ParamSize  = KkOffset + nsquare * nsquare;
+
+inline int64_t kpp_index(int k, int i, int j) {
+    return int64_t(k) * pos_n + (i >= j ? i * (i + 1) / 2 + j : j * (j + 1) / 2 + i);
+}
+
+struct LearnConfig {
+    int threads;
+    int64_t batchSize;      // この局面数ごとに重みを更新する
+    int64_t bufferSize;     // この局面数ずつ読み込んでシャッフルする
+    int epochs;
+    int saveInterval;       // この回数の更新ごとに評価関数を書き出す
+    double eta;             // AdaGrad の学習率(評価関数の表の単位)
+    double lambda;          // 探索の評価値から求めた勝率と対局の結果を混ぜる割合
+    double scale;           // 評価値を勝率にするシグモイドの幅
+    string outFile;
+};
+
+// 1局面分の勾配の1要素
+struct Gradient {
+    uint32_t index;
+    float value;
+};
+
+struct LearnStat {
+    double loss;
+    int64_t count;
+    int64_t skipped;
+};
+
+LearnConfig Cfg;
+float* Weight;
+float* Grad;
+float* Sum2;                // AdaGrad の勾配の2乗和
+
+// 各スレッドは勾配を受け持ちのスレッドごとに分けてためる. [ためたスレッド][受け持つスレッド]
+// 受け持つスレッドだけが Grad の自分の範囲に足すので、排他は要らない
+vector<Gradient> Buckets[MAX_THREADS][MAX_THREADS];
+LearnStat Stats[MAX_THREADS];
+int64_t RangeSize;          // 1スレッドが受け持つ添字の数
+
+const PackedSfenValue* Chunk;
+size_t ChunkSize;
+
+inline double sigmoid(double x) {
+    return 1.0 / (1.0 + exp(-x));
+}
+
+inline void add_gradient(int id, int64_t index, float g) {
+    Gradient e;
+    e.index = uint32_t(index);
+    e.value = g;
+    Buckets[id][index / RangeSize].push_back(e);
+}
+
+// Chunk の局面の勾配を求める. 局面はスレッド数おきに受け持つ
+void compute_gradients(int id) {
+    LearnStat& stat = Stats[id];
+    int list0[PIECENUMBER_MAX + 1];
+    int list1[PIECENUMBER_MAX + 1];
+
+    for (size_t n = id; n < ChunkSize; n += Cfg.threads) {
+        const PackedSfenValue& psv = Chunk[n];
+        string sfen;
+        // 詰みを読み切った評価値は勝率にならないので使わない
+        if (abs(psv.score) >= VALUE_KNOWN_WIN || !Position::DecodeHuffman(psv.sfen, sfen)) {
+            stat.skipped++;
+            continue;
+        }
+        const Position pos(sfen, id);    // スレッドごとのカウンタを使うので自分の番号を渡す
+        const Color us = pos.side_to_move();
+
+        // 勝率の予測 p と教師 t の交差エントロピーを、評価値で微分する
+        const double p = sigmoid(double(pos.evaluate_correct(us)) / Cfg.scale);
+        const double t = Cfg.lambda * sigmoid(psv.score / Cfg.scale)
+                       + (1.0 - Cfg.lambda) * (psv.result + 1) / 2.0;
+        const double eps = 1e-12;
+        stat.loss -= t * log(p + eps) + (1.0 - t) * log(1.0 - p + eps);
+        stat.count++;
+
+        // 評価関数の表は先手から見た値で、FV_SCALE で割って評価値になる
+        const float g = float((p - t) / Cfg.scale / FV_SCALE * (us == BLACK ? 1 : -1));
+        const int nlist = pos.make_list_correct(list0, list1);
+        const int bk = conv_z2sq(pos.king_square(BLACK));
+        const int wk = conv_z2sq(pos.king_square(WHITE));
+        const int iwk = nsquare - 1 - wk;
+
+        add_gradient(id, KkOffset + bk * nsquare + wk, g);
+        for (int i = 0; i < nlist; i++) {
+            add_gradient(id, KkpOffset + (int64_t(bk) * nsquare + wk) * fe_end + list0[i], g);
+            for (int j = 0; j < i; j++) {
+                add_gradient(id, kpp_index(bk, list0[i], list0[j]), g);
+                add_gradient(id, kpp_index(iwk, list1[i], list1[j]), -g);
+            }
+        }
+    }
+}
+
+// 各スレッドがためた勾配のうち、受け持ちの範囲のものを Grad に足す
+void accumulate_gradients(int id) {
+    for (int from = 0; from < Cfg.threads; from++) {
+        vector<Gradient>& bucket = Buckets[from][id];
+        for (size_t i = 0; i < bucket.size(); i++) {
+            Grad[bucket[i].index] += bucket[i].value;
+        }
+        bucket.clear();
+    }
+}
+
+// 重みを評価関数の表に書き戻す
+void write_back(int64_t index) {
+    const double w = floor(Weight[index] + 0.5);
+    if (index < KkpOffset) {
+        const int k = int(index / pos_n);
+        const int t = int(index % pos_n);
+        int i = int((sqrt(8.0 * t + 1) - 1) / 2);
+        while (i * (i + 1) / 2 > t) i--;
+        while ((i + 1) * (i + 2) / 2 <= t) i++;
+        const int j = t - i * (i + 1) / 2;
+        const int16_t v = int16_t(Max(-32767.0, Min(32767.0, w)));
+        kpp[k][kpp_offset(i, j)] = kpp[k][kpp_offset(j, i)] = v;
+    } else if (index < KkOffset) {
+        (&kkp[0][0][0])[index - KkpOffset] = int32_t(w);
+    } else {
+        (&kk[0][0])[index - KkOffset] = int32_t(w);
+    }
+}
+
+// 受け持ちの範囲の重みを AdaGrad で更新する
+void update_weights(int id) {
+    const int64_t begin = id * RangeSize;
+    const int64_t end = Min(begin + RangeSize, ParamSize);
+    for (int64_t i = begin; i < end; i++) {
+        const float g = Grad[i];
+        if (g == 0.0f) {
+            continue;
+        }
+        Sum2[i] += g * g;
+        Weight[i] -= float(Cfg.eta * g / sqrt(Sum2[i]));
+        Grad[i] = 0.0f;
+        write_back(i);
+    }
+}
+
+// f(id) を id = 0..Cfg.threads-1 のスレッドで並列に実行し、すべて終わるまで待つ
+void (*ThreadFunc)(int);
+
+#if defined(_MSC_VER) || defined(_WIN32)
+DWORD WINAPI thread_routine(LPVOID arg) {
+    ThreadFunc(int(intptr_t(arg)));
+    return 0;
+}
+#else
+void* thread_routine(void* arg) {
+    ThreadFunc(int(intptr_t(arg)));
+    return NULL;
+}
+#endif
+
+void run_threads(void (*f)(int)) {
+    ThreadFunc = f;
+#if defined(_MSC_VER) || defined(_WIN32)
+    HANDLE handles[MAX_THREADS];
+    for (int i = 1; i < Cfg.threads; i++) {
+        handles[i] = CreateThread(NULL, 0, thread_routine, (LPVOID)intptr_t(i), 0, NULL);
+        if (handles[i] == NULL) {
+            cerr << "Failed to create thread" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    f(0);
+    for (int i = 1; i < Cfg.threads; i++) {
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+    }
+#else
+    pthread_t handles[MAX_THREADS];
+    for (int i = 1; i < Cfg.threads; i++) {
+        if (pthread_create(&handles[i], NULL, thread_routine, (void*)intptr_t(i)) != 0) {
+            cerr << "Failed to create thread" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    f(0);
+    for (int i = 1; i < Cfg.threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+#endif
+}
+
+// 1回分(batchSize 局面)の勾配を求めて重みを更新する.
+// 勾配をためるメモリを抑えるため、スレッドあたり1024局面ずつに分けて求める
+void learn_batch(const PackedSfenValue* batch, size_t size) {
+    const size_t chunk = size_t(Cfg.threads) * 1024;
+    for (size_t i = 0; i < size; i += chunk) {
+        Chunk = batch + i;
+        ChunkSize = Min(chunk, size - i);
+        run_threads(compute_gradients);
+        run_threads(accumulate_gradients);
+    }
+    run_threads(update_weights);
+    quantize_kkp();
+}
+
+// 前回の表示からの平均の損失と、開始からの速さを表示する
+void report(int64_t positions, TimePoint start) {
+    LearnStat total = { 0.0, 0, 0 };
+    for (int i = 0; i < Cfg.threads; i++) {
+        total.loss += Stats[i].loss;
+        total.count += Stats[i].count;
+        total.skipped += Stats[i].skipped;
+    }
+    memset(Stats, 0, sizeof(Stats));
+
+    const TimePoint t = now() - start;
+    cerr << "learn: " << positions << " positions, loss "
+         << (total.count > 0 ? total.loss / total.count : 0.0)
+         << ", skipped " << total.skipped << ", "
+         << (t > 0 ? int64_t(positions * 1000000.0 / t) : 0) << " positions/sec" << endl;
+}
+
+}
+
+/// learn は gensfen で作った教師局面から評価関数(KPP・KKP・KK)を学習する.
+///
+///   learn [-threads N] [-batch N] [-buffer N] [-epochs N] [-eta F] [-lambda F] [-scale F]
+///         [-save N] [-seed N] [-o file] files...
+///
+/// 局面の静的評価値 v から勝率 sigmoid(v / scale) を予測し、教師の勝率
+/// lambda * sigmoid(探索の評価値 / scale) + (1 - lambda) * 対局の結果 との交差エントロピーを
+/// 小さくするように、-batch 局面(既定 100000)ごとに AdaGrad で重みを更新する.
+/// 特徴は make_list_correct() の list0/list1 で、評価関数の計算と同じものを使う.
+/// 勾配は -threads のスレッドがそれぞれ float のバッファにためてから足し合わせる.
+///
+/// 教師局面は -buffer 局面(既定 1000000)ずつ読んでシャッフルし、ファイル全体を -epochs 回
+/// (既定 1)読む. -save 回の更新ごと(既定 10)と終了時に、-o のファイル(既定 learned.eval)へ
+/// EvalFile オプションで読める形式で書き出す.
+/// 作業領域として、起動時に読み込んだ評価関数の表のほかに約 1.3GB を使う.
+
+void learn(int argc, char* argv[]) {
+    vector<string> files;
+    uint64_t seed = uint64_t(now());
+
+    Cfg.threads = 1;
+    Cfg.batchSize = 100000;
+    Cfg.bufferSize = 1000000;
+    Cfg.epochs = 1;
+    Cfg.saveInterval = 10;
+    Cfg.eta = 8.0;
+    Cfg.lambda = 0.5;
+    Cfg.scale = 600.0;
+    Cfg.outFile = "learned.eval";
+
+    while (--argc) {
+        argv++;
+        if (argv[0][0] != '-') {
+            files.push_back(argv[0]);
+            continue;
+        }
+        if (argc < 2) {
+            cerr << "Error!:argv = " << *argv << endl;
+            exit(EXIT_FAILURE);
+        }
+        argc--;
+        if (strcmp(*argv, "-threads") == 0) {
+            Cfg.threads = atoi(argv[1]);
+        } else if (strcmp(*argv, "-batch") == 0) {
+            Cfg.batchSize = atoll(argv[1]);
+        } else if (strcmp(*argv, "-buffer") == 0) {
+            Cfg.bufferSize = atoll(argv[1]);
+        } else if (strcmp(*argv, "-epochs") == 0) {
+            Cfg.epochs = atoi(argv[1]);
+        } else if (strcmp(*argv, "-save") == 0) {
+            Cfg.saveInterval = atoi(argv[1]);
+        } else if (strcmp(*argv, "-eta") == 0) {
+            Cfg.eta = atof(argv[1]);
+        } else if (strcmp(*argv, "-lambda") == 0) {
+            Cfg.lambda = atof(argv[1]);
+        } else if (strcmp(*argv, "-scale") == 0) {
+            Cfg.scale = atof(argv[1]);
+        } else if (strcmp(*argv, "-seed") == 0) {
+            seed = strtoull(argv[1], NULL, 10);
+        } else if (strcmp(*argv, "-o") == 0) {
+            Cfg.outFile = argv[1];
+        } else {
+            cerr << "Error!:argv = " << *argv << endl;
+            exit(EXIT_FAILURE);
+        }
+        argv++;
+    }
+    if (files.empty() || Cfg.threads < 1 || Cfg.threads > MAX_THREADS || Cfg.batchSize < 1
+        || Cfg.bufferSize < 1 || Cfg.epochs < 1 || Cfg.saveInterval < 1 || Cfg.scale <= 0.0) {
+        cerr << "Error!:files = " << files.size() << ", threads = " << Cfg.threads
+             << ", batch = " << Cfg.batchSize << ", buffer = " << Cfg.bufferSize
+             << ", epochs = " << Cfg.epochs << ", save = " << Cfg.saveInterval
+             << ", scale = " << Cfg.scale << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // 重みは読み込んだ評価関数から始める
+    Weight = new float[ParamSize];
+    Grad = new float[ParamSize];
+    Sum2 = new float[ParamSize];
+    for (int k = 0; k < nsquare; k++) {
+        for (int i = 0; i < fe_end; i++) {
+            for (int j = 0; j <= i; j++) {
+                Weight[kpp_index(k, i, j)] = kpp[k][kpp_offset(i, j)];
+            }
+        }
+    }
+    for (int64_t i = 0; i < KkpSize; i++) {
+        Weight[KkpOffset + i] = float((&kkp[0][0][0])[i]);
+    }
+    for (int i = 0; i < nsquare * nsquare; i++) {
+        Weight[KkOffset + i] = float((&kk[0][0])[i]);
+    }
+    memset(Grad, 0, ParamSize * sizeof(float));
+    memset(Sum2, 0, ParamSize * sizeof(float));
+    memset(Stats, 0, sizeof(Stats));
+    RangeSize = (ParamSize + Cfg.threads - 1) / Cfg.threads;
+
+    cerr << "learn: seed " << seed << endl;
+    RKISS rk(seed);
+    vector<PackedSfenValue> buffer;
+    int64_t positions = 0;
+    int updates = 0;
+    const TimePoint start = now();
+
+    for (int epoch = 0; epoch < Cfg.epochs; epoch++) {
+        for (size_t f = 0; f < files.size(); f++) {
+            FILE* fp = fopen(files[f].c_str(), "rb");
+            if (fp == NULL) {
+                cerr << "Unable to open file " << files[f] << endl;
+                continue;
+            }
+            while (true) {
+                buffer.resize(size_t(Cfg.bufferSize));
+                buffer.resize(fread(&buffer[0], sizeof(PackedSfenValue), buffer.size(), fp));
+                if (buffer.empty()) {
+                    break;
+                }
+                // gensfen のファイルは1局ずつ並んでいるので、同じ対局の局面が続かないように混ぜる
+                for (size_t i = buffer.size() - 1; i > 0; i--) {
+                    swap(buffer[i], buffer[rk.rand<uint64_t>() % (i + 1)]);
+                }
+                for (size_t i = 0; i < buffer.size(); i += size_t(Cfg.batchSize)) {
+                    const size_t n = Min(size_t(Cfg.batchSize), buffer.size() - i);
+                    learn_batch(&buffer[i], n);
+                    positions += n;
+                    if (++updates % Cfg.saveInterval == 0) {
+                        report(positions, start);
+                        save_eval_pack(Cfg.outFile, false);
+                    }
+                }
+            }
+            fclose(fp);
+        }
+    }
+    if (updates % Cfg.saveInterval != 0) {
+        report(positions, start);
+        save_eval_pack(Cfg.outFile, false);
+    }
+
+    delete[] Weight;
+    delete[] Grad;
+    delete[] Sum2;
+    Weight = Grad = Sum2 = NULL;
+}
+
+#endif
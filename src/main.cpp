@@ -28,6 +28,7 @@
 #include "bitboard.h"
 #include "evaluate.h"
 #endif
+#include "misc.h"
 #include "position.h"
 #include "thread.h"
 #include "search.h"
@@ -56,7 +57,14 @@ extern void benchmark(int argc, char* argv[]);
 extern void bench_mate(int argc, char* argv[]);
 extern void bench_genmove(int argc, char* argv[]);
 extern void bench_eval(int argc, char* argv[]);
+extern void bench_suite(int argc, char* argv[]);
+extern void bench_scaling(int argc, char* argv[]);
 extern void solve_problem(int argc, char* argv[]);
+extern void analyze(int argc, char* argv[]);
+extern void selfplay(int argc, char* argv[]);
+extern void gensfen(int argc, char* argv[]);
+extern void learn(int argc, char* argv[]);
+extern void eval_pack(int argc, char* argv[]);
 extern void test_qsearch(int argc, char* argv[]);
 extern void test_see(int argc, char* argv[]);
 #else
@@ -71,6 +79,7 @@ int main(int argc, char* argv[]) {
     setvbuf(stdout, NULL, _IONBF, 0);
     cout.rdbuf()->pubsetbuf(NULL, 0);
     cin.rdbuf()->pubsetbuf(NULL, 0);
+    init_output();
 #if defined(NANOHA)
     init_application_once();
 #endif
@@ -120,6 +129,12 @@ int main(int argc, char* argv[]) {
     else if (string(argv[1]) == "bench" && argc > 2 && string(argv[2]) == "eval") {
         bench_eval(--argc, ++argv);
     }
+    else if (string(argv[1]) == "bench" && argc > 2 && string(argv[2]) == "suite") {
+        bench_suite(--argc, ++argv);
+    }
+    else if (string(argv[1]) == "bench" && argc > 2 && string(argv[2]) == "scaling") {
+        bench_scaling(--argc, ++argv);
+    }
     else if (string(argv[1]) == "qsearch") {
         test_qsearch(--argc, ++argv);
     }
@@ -129,6 +144,21 @@ int main(int argc, char* argv[]) {
     else if (string(argv[1]) == "problem") {
         solve_problem(--argc, ++argv);
     }
+    else if (string(argv[1]) == "analyze") {
+        analyze(--argc, ++argv);
+    }
+    else if (string(argv[1]) == "selfplay") {
+        selfplay(--argc, ++argv);
+    }
+    else if (string(argv[1]) == "gensfen") {
+        gensfen(--argc, ++argv);
+    }
+    else if (string(argv[1]) == "learn") {
+        learn(--argc, ++argv);
+    }
+    else if (string(argv[1]) == "evalpack") {
+        eval_pack(--argc, ++argv);
+    }
 #endif
     else if (string(argv[1]) == "bench" && argc < 8)
         benchmark(argc, argv);
@@ -148,7 +178,31 @@ int main(int argc, char* argv[]) {
                          "[loop = yes] [display = no]\n";
         cout << "   bench mate3 "
                          "[fen positions file = default] "
-                         "[loop = yes] [display moves = no]" << endl;
+                         "[loop = yes] [display moves = no]\n";
+        cout << "   bench suite "
+                         "[suite = all] [fen positions file = default] "
+                         "[repeats = 5] [warmup = 1] [format = text, json or csv]\n";
+        cout << "   bench scaling "
+                         "[hash size = 256] [max threads = cpu count] [depth = 8] "
+                         "[fen positions file = default] [format = text or json]\n";
+        cout << "   analyze "
+                         "[-hash N(128)] [-threads N(1)] [-jobs N(1)] "
+                         "[-depth N(10) | -nodes N | -sec N] [sfen positions file = - (stdin)]\n";
+        cout << "   selfplay "
+                         "[-hash N(16)] [-threads N(1)] [-jobs N(1)] [-games N(2)] "
+                         "[-depth N(6) | -nodes N | -sec N] [-maxply N(256)] [-nomate] [-book] [-seed N] "
+                         "[-o record prefix] [-csa] [openings file = startpos]\n";
+        cout << "   gensfen "
+                         "[-hash N(16)] [-threads N(1)] [-jobs N(1)] "
+                         "[-depth N(6) | -nodes N | -sec N] [-positions N(100000)] [-random N(8)] "
+                         "[-evallimit N(3000)] [-maxply N(256)] [-shard N(1000000)] [-seed N] "
+                         "[-o prefix = gensfen] [openings file = startpos]\n";
+        cout << "   learn "
+                         "[-threads N(1)] [-batch N(100000)] [-buffer N(1000000)] [-epochs N(1)] "
+                         "[-eta F(8)] [-lambda F(0.5)] [-scale F(600)] [-save N(10)] [-seed N] "
+                         "[-o file = learned.eval] files...\n";
+        cout << "   evalpack "
+                         "[-compress] [-o file = saya_chan.eval] [input file = current evaluation]" << endl;
     }
 #else
     cout << "Usage: stockfish bench [hash size = 128] [threads = 1] "
@@ -21,6 +21,7 @@
 
 #include <cassert>
 #include "movegen.h"
+#include "perform.h"
 #include "position.h"
 
 //
@@ -1747,10 +1748,15 @@ MYABORT();
 int Position::Mate3(const Color us, Move &m)
 {
     assert(us == side_to_move());
+    PERF_COUNT(threadID, PERF_MATE3_CALL);
+    PROFILE_SCOPE(threadID, PROF_MATE3);
     // 1手詰めを確認
     {
         m = (us == BLACK) ? Mate1ply<BLACK>() :  Mate1ply<WHITE>();
-        if (m != MOVE_NONE) return VALUE_MATE;
+        if (m != MOVE_NONE) {
+            PERF_COUNT(threadID, PERF_MATE3_HIT);
+            return VALUE_MATE;
+        }
     }
 
     MoveStack moves[256];     // 深さ3程度なら十分な大きさ
@@ -1777,6 +1783,7 @@ int Position::Mate3(const Color us, Move &m)
         if (val > valmax) valmax = val;
         if (valmax == VALUE_MATE) {
             m = move;
+            PERF_COUNT(threadID, PERF_MATE3_HIT);
             return VALUE_MATE; //詰んだ
         }
     }
@@ -25,6 +25,7 @@
 #include <cstring>
 #include "position.h"
 #include "movegen.h"
+#include "perform.h"
 
 // 新規節点で固定深さの探索を併用するdf-pnアルゴリズム gpw05.pdf
 //  金子知適 田中哲朗 山口和紀 川合慧
@@ -2178,6 +2179,8 @@ template<Color us>
 Move Position::Mate1ply()
 {
     tnodes++;
+    PERF_COUNT(threadID, PERF_MATE1_CALL);
+    PROFILE_SCOPE(threadID, PROF_MATE1);
     Move m = MOVE_NONE;
     uint32_t ret;
 
@@ -2210,7 +2213,7 @@ Move Position::Mate1ply()
         ret = CheckMate1plyMove<us>(info, m);
         if (ret != 0) {
             assert(::is_ok(m));
-            COUNT_PERFORM(count_Mate1plyMove);
+            PERF_COUNT(threadID, PERF_MATE1_HIT);
             CHK_MATE1PLY(m);
             return m;
         }
@@ -2219,7 +2222,7 @@ Move Position::Mate1ply()
         ret = CheckMate1plyDrop<us>(info, m);
         if (ret != 0) {
             assert(::is_ok(m));
-            COUNT_PERFORM(count_Mate1plyDrop);
+            PERF_COUNT(threadID, PERF_MATE1_HIT);
             CHK_MATE1PLY(m);
             return m;
         }
@@ -2238,7 +2241,7 @@ Move Position::Mate1ply()
         ret = CheckMate1plyMove<us>(info, m, check);
         if (ret != 0) {
             assert(::is_ok(m));
-            COUNT_PERFORM(count_Mate1plyMove);
+            PERF_COUNT(threadID, PERF_MATE1_HIT);
             CHK_MATE1PLY(m);
             return m;
         }
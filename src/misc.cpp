@@ -41,7 +41,9 @@
 #endif
 
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <deque>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -122,6 +124,33 @@ const string engine_authors() {
 }
 
 
+/// json_escape() は JSON の文字列に置けない '"'、'\\' と制御文字をエスケープする.
+
+string json_escape(const string& str) {
+
+    string s;
+    char buf[8];
+
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        const unsigned char c = (unsigned char)str[i];
+        if (c == '"' || c == '\\')
+        {
+            s += '\\';
+            s += char(c);
+        }
+        else if (c < 0x20)
+        {
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            s += buf;
+        }
+        else
+            s += char(c);
+    }
+    return s;
+}
+
+
 /// Debug stuff. Helper functions used mainly for debugging purposes
 
 static uint64_t dbg_hit_cnt0;
@@ -161,7 +190,8 @@ void dbg_before() { dbg_hit_on(false); }
 void dbg_after()  { dbg_hit_on(true); dbg_hit_cnt0--; }
 
 
-/// get_system_time() returns the current system time, measured in milliseconds
+/// get_system_time() returns the current system time, measured in milliseconds.
+/// It follows the wall clock, so use it only for seeding, not for measuring.
 
 int get_system_time() {
 
@@ -177,6 +207,15 @@ int get_system_time() {
 }
 
 
+/// now() returns a monotonic time stamp in microseconds
+
+TimePoint now() {
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
 /// cpu_count() tries to detect the number of CPU cores
 
 int cpu_count() {
@@ -203,11 +242,23 @@ int cpu_count() {
 
 
 /// Check for console input. Original code from Beowulf, Olithink and Greko
+/// ignore_input(true) のあとは入力がないものとして扱う. 標準入力を局面の
+/// 入力に使うバッチ処理で、探索が入力を読んで止まらないようにする.
+
+namespace { bool InputIgnored = false; }
+
+void ignore_input(bool ignore) {
+
+    InputIgnored = ignore;
+}
 
 #ifndef _WIN32
 
 int input_available() {
 
+    if (InputIgnored)
+        return 0;
+
     fd_set readfds;
     struct timeval  timeout;
 
@@ -224,6 +275,9 @@ int input_available() {
 
 int input_available() {
 
+    if (InputIgnored)
+        return 0;
+
     static HANDLE inh = NULL;
     static bool usePipe = false;
     INPUT_RECORD rec[256];
@@ -275,6 +329,206 @@ int input_available() {
 #endif
 
 
+/// 標準入力を読む専用スレッド.
+/// start_input_thread() で起動すると、以後の標準入力はこのスレッドだけが読む.
+/// 1行読むたびに handler を呼び、handler が false を返した行を get_input_line()
+/// に渡す. 探索中の stop や ponderhit は handler が直ちに処理するので、
+/// 探索スレッドが標準入力を調べる必要がなくなる.
+
+namespace {
+
+    Lock InputLock;
+    WaitCondition InputCond;
+    std::deque<string> InputQueue;
+    bool InputEOF;
+    volatile bool InputThreadActive = false;
+    bool (*InputHandler)(const string&);
+
+    void input_loop() {
+
+        string cmd;
+
+        while (true)
+        {
+            const bool ok = !!getline(cin, cmd);
+
+            // 入力が閉じられたら quit として扱う
+            if (!ok)
+                cmd = "quit";
+            else if (!cmd.empty() && cmd[cmd.size() - 1] == '\r')
+                cmd.erase(cmd.size() - 1);
+
+            const bool consumed = InputHandler(cmd);
+
+            lock_grab(&InputLock);
+            if (!consumed)
+                InputQueue.push_back(cmd);
+            InputEOF = !ok;
+            cond_signal(&InputCond);
+            lock_release(&InputLock);
+
+            if (!ok)
+                break;
+        }
+    }
+
+extern "C" {
+#if defined(_MSC_VER) || defined(_WIN32)
+    DWORD WINAPI input_routine(LPVOID) {
+
+        input_loop();
+        return 0;
+    }
+#else
+    void* input_routine(void*) {
+
+        input_loop();
+        return NULL;
+    }
+#endif
+}
+}
+
+void start_input_thread(bool (*handler)(const string& cmd)) {
+
+    assert(!InputThreadActive);
+
+    lock_init(&InputLock);
+    cond_init(&InputCond);
+    InputEOF = false;
+    InputHandler = handler;
+
+#if defined(_MSC_VER) || defined(_WIN32)
+    HANDLE handle = CreateThread(NULL, 0, input_routine, NULL, 0, NULL);
+    bool ok = (handle != NULL);
+    if (ok)
+        CloseHandle(handle);
+#else
+    pthread_t handle;
+    bool ok = (pthread_create(&handle, NULL, input_routine, NULL) == 0);
+    if (ok)
+        pthread_detach(handle);
+#endif
+    if (!ok)
+    {
+        cerr << "Failed to create input thread" << endl;
+        exit(EXIT_FAILURE);
+    }
+    InputThreadActive = true;
+}
+
+bool input_thread_active() {
+
+    return InputThreadActive;
+}
+
+/// get_input_line() は入力スレッドが読んだ行を1行取り出す. 行が届くまで待ち、
+/// 入力が閉じられて残りの行もなければ false を返す.
+
+bool get_input_line(string& cmd) {
+
+    assert(InputThreadActive);
+
+    lock_grab(&InputLock);
+    while (InputQueue.empty() && !InputEOF)
+        cond_wait(&InputCond, &InputLock);
+
+    const bool ok = !InputQueue.empty();
+    if (ok)
+    {
+        cmd = InputQueue.front();
+        InputQueue.pop_front();
+    }
+    lock_release(&InputLock);
+    return ok;
+}
+
+
+/// USI への出力.
+/// メッセージは文字列に組み立ててから一度の書き込みで出力する. 探索中の info は
+/// 前回の出力から InfoInterval 経たないうちに届いたものを保留し、次の info が
+/// 来たら古いものは捨てる(新しい読み筋で置き換わるため). 保留中の info は
+/// 間隔が空いたとき、または bestmove などを出力する前に必ず書き出す.
+
+namespace {
+
+    Lock OutputLock;
+    string PendingInfo;
+    TimePoint LastInfoTime;
+    TimePoint InfoInterval;
+    bool OutputMuted;
+
+    void write_output(const string& s) {
+
+        if (OutputMuted)
+            return;
+
+        fwrite(s.data(), 1, s.size(), stdout);
+        fflush(stdout);
+    }
+
+    void write_pending_info() {
+
+        if (!PendingInfo.empty())
+        {
+            write_output(PendingInfo);
+            PendingInfo.clear();
+            LastInfoTime = now();
+        }
+    }
+}
+
+void init_output() {
+
+    lock_init(&OutputLock);
+    InfoInterval = 0;
+}
+
+void mute_output(bool mute) {
+
+    lock_grab(&OutputLock);
+    OutputMuted = mute;
+    lock_release(&OutputLock);
+}
+
+void set_info_interval(int msec) {
+
+    lock_grab(&OutputLock);
+    InfoInterval = TimePoint(msec) * USEC_PER_MSEC;
+    lock_release(&OutputLock);
+}
+
+void sync_output(const string& msg) {
+
+    lock_grab(&OutputLock);
+    write_pending_info();
+    write_output(msg);
+    lock_release(&OutputLock);
+}
+
+void info_output(const string& msg) {
+
+    lock_grab(&OutputLock);
+    if (now() - LastInfoTime >= InfoInterval)
+    {
+        PendingInfo.clear();
+        write_output(msg);
+        LastInfoTime = now();
+    }
+    else
+        PendingInfo = msg;
+    lock_release(&OutputLock);
+}
+
+void flush_info_output() {
+
+    lock_grab(&OutputLock);
+    if (now() - LastInfoTime >= InfoInterval)
+        write_pending_info();
+    lock_release(&OutputLock);
+}
+
+
 /// prefetch() preloads the given address in L1/L2 cache. This is a non
 /// blocking function and do not stalls the CPU waiting for data to be
 /// loaded from memory, that can be quite slow.
@@ -27,9 +27,27 @@
 
 extern const std::string engine_name();
 extern const std::string engine_authors();
+extern std::string json_escape(const std::string& str);   // JSON の文字列の中に書ける形にする
 extern int get_system_time();
+
+/// 探索や計測の時間は steady_clock のマイクロ秒で扱う. 時計の調整で戻ったり
+/// 跳んだりせず、64ビットなので桁あふれもしない. USI とのやり取りはミリ秒.
+typedef int64_t TimePoint;
+const TimePoint USEC_PER_MSEC = 1000;
+extern TimePoint now();
+inline double to_msec(TimePoint t) { return double(t) / USEC_PER_MSEC; }
 extern int cpu_count();
 extern int input_available();
+extern void ignore_input(bool ignore);            // バッチ処理で探索が標準入力を読まないようにする
+extern void start_input_thread(bool (*handler)(const std::string& cmd));
+extern bool input_thread_active();
+extern bool get_input_line(std::string& cmd);
+extern void init_output();
+extern void mute_output(bool mute);                // ベンチマークなどで USI への出力を止める
+extern void set_info_interval(int msec);
+extern void sync_output(const std::string& msg);   // 直ちに出力する. 保留中の info を先に出す
+extern void info_output(const std::string& msg);   // 間隔が短いときは保留し、新しいもので置き換える
+extern void flush_info_output();                   // 間隔が空いていれば保留中の info を出力する
 extern void prefetch(char* addr);
 
 extern void dbg_hit_on(bool b);
@@ -163,7 +163,7 @@ namespace {
 
 #if defined(NANOHA)
 //
-// 汎用バージョン(MV_CAPTURE, MV_NON_EVASION, MV_NON_CAPTURE を想定)
+// 汎用バージョン(MV_CAPTURE, MV_NON_EVASION, MV_NON_CAPTURE, MV_BOARD_NON_CAPTURE, MV_DROP を想定)
 //
 template<MoveType Type>
 MoveStack* generate(const Position& pos, MoveStack* mlist)
@@ -173,7 +173,8 @@ MoveStack* generate(const Position& pos, MoveStack* mlist)
 
     Color us = pos.side_to_move();
 
-    assert(Type == MV_CAPTURE || Type == MV_NON_CAPTURE || Type == MV_NON_EVASION);
+    assert(Type == MV_CAPTURE || Type == MV_NON_CAPTURE || Type == MV_NON_EVASION
+        || Type == MV_BOARD_NON_CAPTURE || Type == MV_DROP);
 
     if (Type == MV_NON_EVASION) {
         mlist = (us == BLACK)
@@ -187,6 +188,14 @@ MoveStack* generate(const Position& pos, MoveStack* mlist)
         mlist = (us == BLACK)
             ? pos.generate_non_capture<BLACK>(mlist)
             : pos.generate_non_capture<WHITE>(mlist);
+    } else if (Type == MV_BOARD_NON_CAPTURE) {
+        mlist = (us == BLACK)
+            ? pos.generate_board_non_capture<BLACK>(mlist)
+            : pos.generate_board_non_capture<WHITE>(mlist);
+    } else if (Type == MV_DROP) {
+        mlist = (us == BLACK)
+            ? pos.gen_drop<BLACK>(mlist)
+            : pos.gen_drop<WHITE>(mlist);
     } else {
         assert(false);
     }
@@ -244,6 +253,8 @@ MoveStack* generate(const Position& pos, MoveStack* mlist) {
 #if defined(NANOHA)
 template MoveStack* generate<MV_CAPTURE>(const Position& pos, MoveStack* mlist);
 template MoveStack* generate<MV_NON_CAPTURE>(const Position& pos, MoveStack* mlist);
+template MoveStack* generate<MV_BOARD_NON_CAPTURE>(const Position& pos, MoveStack* mlist);
+template MoveStack* generate<MV_DROP>(const Position& pos, MoveStack* mlist);
 template MoveStack* generate<MV_NON_EVASION>(const Position& pos, MoveStack* mlist);
 #endif
 
@@ -1074,84 +1085,51 @@ MoveStack* Position::gen_drop_to(const Color us, MoveStack* mlist, int to) const
 }
 
 // 駒を打つ手の生成
+// 空きマスのビットボードをビット番号の小さい順(1筋の1段目から)に走査する
 template <Color us>
 MoveStack* Position::gen_drop(MoveStack* mlist) const
 {
-    int z;
-    int suji;
+    const Hand &h = (us == BLACK) ? handS : handG;
+    const Bitboard empty = empty_squares();
+    // 行きどころのない段(先手なら1段目と2段目、後手なら9段目と8段目)
+    const Bitboard rank1 = (us == BLACK) ? RankBB[1] : RankBB[9];
+    const Bitboard rank2 = (us == BLACK) ? RankBB[2] : RankBB[8];
+    Bitboard target;
     unsigned int tmp;
-    int StartDan;
-    ///    int teNum = teNumM;    // アドレスを取らない
+
     // 歩を打つ
-    uint32_t exists;
-    exists = (us == BLACK) ? handS.existFU() : handG.existFU();
-    if (exists > 0) {
-        tmp = (us == BLACK) ? Piece2Move(SFU) : Piece2Move(GFU);    // From = 0;
-        //(先手なら２段目より下に、後手なら８段目より上に打つ）
-        StartDan = (us == BLACK) ? 2 : 1;
-        for (suji = 0x10; suji <= 0x90; suji += 0x10) {
-            // 二歩チェック
-            if (is_double_pawn(us, suji)) continue;
-            z = suji + StartDan;
+    if (h.existFU() > 0) {
+        tmp = Piece2Move(make_piece(us, FU));    // From = 0;
+        target = andnot(empty, rank1);
+        // 二歩チェック(自分の歩のある筋を除く)
+        Bitboard pawns = pieces(FU, us);
+        while (pawns.any()) {
+            target = andnot(target, FileBB[pawns.pop_first() / 9 + 1]);
+        }
+        while (target.any()) {
+            const int z = conv_bb2z(target.pop_first());
             // 打ち歩詰めもチェック
-#define FU_FUNC(z)    \
-    if (ban[z] == EMP && !is_pawn_drop_mate(us, z)) {    \
-        (mlist++)->move = Move(tmp | To2Move(z));    \
-        }
-            FU_FUNC(z)
-                FU_FUNC(z + 1)
-                FU_FUNC(z + 2)
-                FU_FUNC(z + 3)
-                FU_FUNC(z + 4)
-                FU_FUNC(z + 5)
-                FU_FUNC(z + 6)
-                FU_FUNC(z + 7)
-#undef FU_FUNC
+            if (!is_pawn_drop_mate(us, z)) {
+                (mlist++)->move = Move(tmp | To2Move(z));
+            }
         }
     }
 
     // 香を打つ
-    exists = (us == BLACK) ? handS.existKY() : handG.existKY();
-    if (exists > 0) {
-        tmp = (us == BLACK) ? Piece2Move(SKY) : Piece2Move(GKY); // From = 0
-        //(先手なら２段目より下に、後手なら８段目より上に打つ）
-        z = (us == BLACK) ? 0x12 : 0x11;
-        for (; z <= 0x99; z += 0x10) {
-#define KY_FUNC(z)    \
-            if (ban[z] == EMP) {    \
-                (mlist++)->move = Move(tmp | To2Move(z));    \
-                        }
-            KY_FUNC(z)
-                KY_FUNC(z + 1)
-                KY_FUNC(z + 2)
-                KY_FUNC(z + 3)
-                KY_FUNC(z + 4)
-                KY_FUNC(z + 5)
-                KY_FUNC(z + 6)
-                KY_FUNC(z + 7)
-#undef KY_FUNC
+    if (h.existKY() > 0) {
+        tmp = Piece2Move(make_piece(us, KY));    // From = 0
+        target = andnot(empty, rank1);
+        while (target.any()) {
+            (mlist++)->move = Move(tmp | To2Move(conv_bb2z(target.pop_first())));
         }
     }
 
     //桂を打つ
-    exists = (us == BLACK) ? handS.existKE() : handG.existKE();
-    if (exists > 0) {
-        //(先手なら３段目より下に、後手なら７段目より上に打つ）
-        tmp = (us == BLACK) ? Piece2Move(SKE) : Piece2Move(GKE); // From = 0
-        z = (us == BLACK) ? 0x13 : 0x11;
-        for (; z <= 0x99; z += 0x10) {
-#define KE_FUNC(z)    \
-            if (ban[z] == EMP) {    \
-                (mlist++)->move = Move(tmp | To2Move(z));    \
-                        }
-            KE_FUNC(z)
-                KE_FUNC(z + 1)
-                KE_FUNC(z + 2)
-                KE_FUNC(z + 3)
-                KE_FUNC(z + 4)
-                KE_FUNC(z + 5)
-                KE_FUNC(z + 6)
-#undef KE_FUNC
+    if (h.existKE() > 0) {
+        tmp = Piece2Move(make_piece(us, KE));    // From = 0
+        target = andnot(empty, rank1 | rank2);
+        while (target.any()) {
+            (mlist++)->move = Move(tmp | To2Move(conv_bb2z(target.pop_first())));
         }
     }
 
@@ -1159,28 +1137,16 @@ MoveStack* Position::gen_drop(MoveStack* mlist) const
     const uint32_t koma_start = (us == BLACK) ? SGI : GGI;
     const uint32_t koma_end = (us == BLACK) ? SHI : GHI;
     uint32_t a[4];
-    a[0] = (us == BLACK) ? handS.existGI() : handG.existGI();
-    a[1] = (us == BLACK) ? handS.existKI() : handG.existKI();
-    a[2] = (us == BLACK) ? handS.existKA() : handG.existKA();
-    a[3] = (us == BLACK) ? handS.existHI() : handG.existHI();
+    a[0] = h.existGI();
+    a[1] = h.existKI();
+    a[2] = h.existKA();
+    a[3] = h.existHI();
     for (uint32_t koma = koma_start, i = 0; koma <= koma_end; koma++, i++) {
         if (a[i] > 0) {
             tmp = Piece2Move(koma); // From = 0
-            for (z = 0x11; z <= 0x99; z += 0x10) {
-#define GI_FUNC(z)    \
-                if (ban[z] == EMP) {    \
-                    (mlist++)->move = Move(tmp | To2Move(z));    \
-                                }
-                GI_FUNC(z)
-                    GI_FUNC(z + 1)
-                    GI_FUNC(z + 2)
-                    GI_FUNC(z + 3)
-                    GI_FUNC(z + 4)
-                    GI_FUNC(z + 5)
-                    GI_FUNC(z + 6)
-                    GI_FUNC(z + 7)
-                    GI_FUNC(z + 8)
-#undef GI_FUNC
+            target = empty;
+            while (target.any()) {
+                (mlist++)->move = Move(tmp | To2Move(conv_bb2z(target.pop_first())));
             }
         }
     }
@@ -2010,8 +1976,9 @@ MoveStack* Position::gen_king_noncapture(const Color us, MoveStack* mlist, const
 }
 
 // 盤上の駒を動かす手のうち generate_capture() で生成する手を除いて生成する(動かす手で取らない手(－歩を成る手)を生成)
+// 駒を打つ手は含まない
 template <Color us>
-MoveStack* Position::generate_non_capture(MoveStack* mlist) const
+MoveStack* Position::generate_board_non_capture(MoveStack* mlist) const
 {
     //    int teNum = 0;
     int kn;
@@ -2110,7 +2077,14 @@ MoveStack* Position::generate_non_capture(MoveStack* mlist) const
     }
 #endif
 
-    return gen_drop<us>(p);
+    return p;
+}
+
+// 取らない手(盤上の駒を動かす手＋駒を打つ手)を生成する
+template <Color us>
+MoveStack* Position::generate_non_capture(MoveStack* mlist) const
+{
+    return gen_drop<us>(generate_board_non_capture<us>(mlist));
 }
 
 // 王手回避手の生成
@@ -2218,6 +2192,8 @@ template MoveStack* Position::generate_capture<BLACK>(MoveStack* mlist) const;
 template MoveStack* Position::generate_capture<WHITE>(MoveStack* mlist) const;
 template MoveStack* Position::generate_non_capture<BLACK>(MoveStack* mlist) const;
 template MoveStack* Position::generate_non_capture<WHITE>(MoveStack* mlist) const;
+template MoveStack* Position::generate_board_non_capture<BLACK>(MoveStack* mlist) const;
+template MoveStack* Position::generate_board_non_capture<WHITE>(MoveStack* mlist) const;
 template MoveStack* Position::generate_evasion<BLACK>(MoveStack* mlist) const;
 template MoveStack* Position::generate_evasion<WHITE>(MoveStack* mlist) const;
 template MoveStack* Position::generate_non_evasion<BLACK>(MoveStack* mlist) const;
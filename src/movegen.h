@@ -27,6 +27,8 @@
 enum MoveType {
     MV_CAPTURE,             // 駒を取る手
     MV_NON_CAPTURE,         // 駒を取らない手
+    MV_BOARD_NON_CAPTURE,   // 駒を取らない手のうち盤上の駒を動かす手
+    MV_DROP,                // 駒を打つ手
     MV_CHECK,               // 王手
     MV_NON_CAPTURE_CHECK,   // 駒を取らない王手
     MV_EVASION,             // 王手回避手
@@ -21,9 +21,15 @@
 
 #include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstring>
+#if defined(HAVE_SSE4)
+#include <smmintrin.h>
+#endif
 
 #include "movegen.h"
 #include "movepick.h"
+#include "perform.h"
 #include "search.h"
 #include "types.h"
 
@@ -61,12 +67,67 @@ namespace {
     // ones so to sort separately the two sets, and with the second sort delayed.
     inline bool has_positive_score(const MoveStack& move) { return move.score > 0; }
 
+    // Returns the first move with the highest score in range [firstMove, lastMove),
+    // same as std::max_element() but the loop is written so that it compiles to
+    // conditional moves instead of a hard to predict branch per move.
+    inline MoveStack* max_score(MoveStack* firstMove, MoveStack* lastMove)
+    {
+        const int n = int(lastMove - firstMove);
+#if defined(HAVE_SSE4)
+        // 4手ずつスコアだけを取り出して最大値を求め、その最初の位置を探す
+        if (n >= 8)
+        {
+            __m128i vmax = _mm_set1_epi32(INT_MIN);
+            int i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                const __m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(firstMove + i));
+                const __m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(firstMove + i + 2));
+                vmax = _mm_max_epi32(vmax, _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+            }
+            vmax = _mm_max_epi32(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+            vmax = _mm_max_epi32(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+            int bestScore = _mm_cvtsi128_si32(vmax);
+            for (; i < n; i++)
+                bestScore = std::max(bestScore, firstMove[i].score);
+
+            MoveStack* best = firstMove;
+            while (best->score != bestScore)
+                best++;
+            return best;
+        }
+#endif
+        int bestIdx = 0, bestScore = firstMove->score;
+        for (int i = 1; i < n; i++)
+        {
+            const int s = firstMove[i].score;
+            const bool better = s > bestScore;
+            bestIdx   = better ? i : bestIdx;
+            bestScore = better ? s : bestScore;
+        }
+        return firstMove + bestIdx;
+    }
+
     // Picks and pushes to the front the best move in range [firstMove, lastMove),
     // it is faster than sorting all the moves in advance when moves are few, as
     // normally are the possible captures.
     inline MoveStack* pick_best(MoveStack* firstMove, MoveStack* lastMove)
     {
-        std::swap(*firstMove, *std::max_element(firstMove, lastMove));
+        std::swap(*firstMove, *max_score(firstMove, lastMove));
+        return firstMove;
+    }
+
+    // Same as pick_best() but keeps the relative order of the remaining moves,
+    // so that picking moves one by one gives the same order as sort<MoveStack>().
+    inline MoveStack* pick_best_stable(MoveStack* firstMove, MoveStack* lastMove)
+    {
+        MoveStack* best = max_score(firstMove, lastMove);
+        if (best != firstMove)
+        {
+            const MoveStack tmp = *best;
+            memmove(firstMove + 1, firstMove, (best - firstMove) * sizeof(MoveStack));
+            *firstMove = tmp;
+        }
         return firstMove;
     }
 }
@@ -100,6 +161,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const History& h,
             captureThreshold = -PawnValueMidgame;
 
         phasePtr = MainSearchTable;
+        PERF_COUNT(pos.thread(), PERF_PICK_PICKERS);
     }
 
     ttMove = (ttm && pos.is_pseudo_legal(ttm) ? ttm : MOVE_NONE);
@@ -162,6 +224,7 @@ MovePicker::MovePicker(const Position& p, Move ttm, const History& h, PieceType
 
 void MovePicker::go_next_phase() {
 
+    PROFILE_SCOPE(pos.thread(), PROF_MOVE_PICK);
     curMove = moves;
     phase = *(++phasePtr);
     switch (phase) {
@@ -171,6 +234,11 @@ void MovePicker::go_next_phase() {
         return;
 
     case PH_GOOD_CAPTURES:
+        lastMove = generate<MV_CAPTURE>(pos, moves);
+        PERF_ADD(pos.thread(), PERF_PICK_GEN_CAPTURE, lastMove - curMove);
+        score_captures();
+        return;
+
     case PH_GOOD_PROBCUT:
         lastMove = generate<MV_CAPTURE>(pos, moves);
         score_captures();
@@ -181,14 +249,41 @@ void MovePicker::go_next_phase() {
         lastMove = curMove + 2;
         return;
 
+#if defined(NANOHA)
     case PH_NONCAPTURES_1:
-        lastNonCapture = lastMove = generate<MV_NON_CAPTURE>(pos, moves);
+        // 置換表の手・駒を取る手・killerでカットされなかったときだけ、盤上の駒を動かす手、
+        // 駒を打つ手の順に生成する. 駒を打つ手のほうがずっと多い.
+        // ※　駒を打つ手をさらに後回し(盤上の駒を動かす手をすべて試した後)にすると、
+        //   historyがプラスの駒打ちが後ろに回るため探索ノード数が大きく増える.
+        lastMove = generate<MV_BOARD_NON_CAPTURE>(pos, moves);
+        PERF_ADD(pos.thread(), PERF_PICK_GEN_NONCAPTURE, lastMove - curMove);
+        lastNonCapture = generate<MV_DROP>(pos, lastMove);
+        PERF_ADD(pos.thread(), PERF_PICK_GEN_DROP, lastNonCapture - lastMove);
+        PERF_COUNT(pos.thread(), PERF_PICK_QUIET_PHASES);
+        lastMove = lastNonCapture;
         score_noncaptures();
         lastMove = std::partition(curMove, lastMove, has_positive_score);
 		// ※　将棋だと駒打ちがあるので指し手の数があまりにも大きいので、
 		// プラスの手であっても残り探索深さがある程度ないときや、指し手の数が多いときは
 		// insertion_sort()もやめたほうがいいのではなかろうか。ということで3手以上残り探索深さが無い時はソートしないのも一案。byやねうらおさん
+		// 全体はソートせず、get_next_move()で残りの中から1手ずつ選ぶ(選ぶ順はソートと同じ).
+		// カットされれば残りの手の並べ替えは不要になる.
 		//if (depth >= 3 * ONE_PLY)
+		pickBest = (depth >= 3);
+        return;
+
+    case PH_NONCAPTURES_2:
+        curMove = lastMove;
+        lastMove = lastNonCapture;
+		// 3手以上残り探索深さがあるなら、順に選ぶ
+		//if (depth >= 3 * ONE_PLY)
+		pickBest = (depth >= 5);
+		return;
+#else
+    case PH_NONCAPTURES_1:
+        lastNonCapture = lastMove = generate<MV_NON_CAPTURE>(pos, moves);
+        score_noncaptures();
+        lastMove = std::partition(curMove, lastMove, has_positive_score);
 		if (depth >= 3)
 			sort<MoveStack>(curMove, lastMove);
         return;
@@ -196,11 +291,10 @@ void MovePicker::go_next_phase() {
     case PH_NONCAPTURES_2:
         curMove = lastMove;
         lastMove = lastNonCapture;
-		// 3手以上残り探索深さがあるなら、ソートしてしまう
-		//if (depth >= 3 * ONE_PLY)
 		if (depth >= 5)
 			sort<MoveStack>(curMove, lastMove);
 		return;
+#endif
 
 	case PH_BAD_CAPTURES:
 			// Bad captures SEE value is already calculated so just pick
@@ -212,11 +306,13 @@ void MovePicker::go_next_phase() {
     case PH_EVASIONS:
         assert(pos.in_check());
         lastMove = generate<MV_EVASION>(pos, moves);
+        PERF_ADD(pos.thread(), PERF_PICK_GEN_EVASION, lastMove - curMove);
         score_evasions();
         return;
 
     case PH_QCAPTURES:
         lastMove = generate<MV_CAPTURE>(pos, moves);
+        PERF_ADD(pos.thread(), PERF_PICK_GEN_QCAPTURE, lastMove - curMove);
         score_captures();
         return;
 
@@ -278,20 +374,20 @@ void MovePicker::score_captures() {
 
 void MovePicker::score_noncaptures() {
 
+#if defined(NANOHA)
+    // 駒打ちを含めると数百手になるので、分岐なしの表引きだけにする
+    for (MoveStack* cur = curMove; cur != lastMove; cur++)
+        cur->score = H.value(cur->move);
+#else
     Move m;
 
-    for (MoveStack* cur = moves; cur != lastMove; cur++)
+    for (MoveStack* cur = curMove; cur != lastMove; cur++)
     {
         m = cur->move;
-#if defined(NANOHA)
-        assert(m != MOVE_NULL);
-        Piece piece = is_promotion(m) ? Piece(move_piece(m) | PROMOTED) : move_piece(m);
-        cur->score = H.value(piece, move_to(m));
-#else
         Square from = move_from(m);
         cur->score = H.value(pos.piece_on(from), move_to(m));
-#endif
     }
+#endif
 }
 
 void MovePicker::score_evasions() {
@@ -325,10 +421,7 @@ void MovePicker::score_evasions() {
 #endif
         else
 #if defined(NANOHA)
-        {
-            Piece piece = is_promotion(m) ? Piece(move_piece(m) | PROMOTED) : move_piece(m);
-            cur->score = H.value(piece, move_to(m));
-        }
+            cur->score = H.value(m);
 #else
         cur->score = H.value(pos.piece_on(move_from(m)), move_to(m));
 #endif
@@ -360,14 +453,19 @@ Move MovePicker::get_next_move() {
 
         case PH_GOOD_CAPTURES:
             move = pick_best(curMove++, lastMove)->move;
-            if (   move != ttMove)
+            if (move == ttMove)
+                PERF_COUNT(pos.thread(), PERF_PICK_TRIED_CAPTURE);
+            else
             {
                 assert(captureThreshold <= 0); // Otherwise we must use see instead of see_sign
 
                 // Check for a non negative SEE now
                 int seeValue = pos.see_sign(move);
                 if (seeValue >= captureThreshold)
+                {
+                    PERF_COUNT(pos.thread(), PERF_PICK_TRIED_CAPTURE);
                     return move;
+                }
 
                 // Losing capture, move it to the tail of the array
 				// 駒損する捕獲であるので、これを配列の末尾に移動させる。
@@ -404,7 +502,12 @@ Move MovePicker::get_next_move() {
 			// QUIETS_2_S1は、historyのスコアがマイナスの指し手である。
 			// ※　将棋では、QUIETS_1_S1のあとにBAD_CAPTURES_S1をもってくるぐらいのほうがいいのかもな？byやねうらおさん
 			// しかしあまりうまくないようだ？
+#if defined(NANOHA)
+			move = (pickBest ? pick_best_stable(curMove++, lastMove) : curMove++)->move;
+			PERF_COUNT(pos.thread(), move_is_drop(move) ? PERF_PICK_TRIED_DROP : PERF_PICK_TRIED_NONCAPTURE);
+#else
 			move = (curMove++)->move;
+#endif
 			if (   move != ttMove
 				&& move != killers[0].move
 				&& move != killers[1].move)
@@ -413,11 +516,19 @@ Move MovePicker::get_next_move() {
 
 		case PH_BAD_CAPTURES:
 			move = pick_best(curMove++, lastMove)->move;
+			PERF_COUNT(pos.thread(), PERF_PICK_TRIED_CAPTURE);
 			return move;
 			
         case PH_EVASIONS:
+            move = pick_best(curMove++, lastMove)->move;
+            PERF_COUNT(pos.thread(), PERF_PICK_TRIED_EVASION);
+            if (move != ttMove)
+                return move;
+            break;
+
         case PH_QCAPTURES:
             move = pick_best(curMove++, lastMove)->move;
+            PERF_COUNT(pos.thread(), PERF_PICK_TRIED_QCAPTURE);
             if (move != ttMove)
                 return move;
             break;
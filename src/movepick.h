@@ -60,6 +60,7 @@ private:
     MoveStack killers[2];
     Square recaptureSquare;
     int captureThreshold, phase;
+    bool pickBest;
     const uint8_t* phasePtr;
     MoveStack *curMove, *lastMove, *lastNonCapture, *badCaptures;
     MoveStack moves[MAX_MOVES];
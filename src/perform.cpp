@@ -0,0 +1,366 @@
+﻿/*
+  GodWhale, a  USI shogi(japanese-chess) playing engine derived from NanohaMini
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014 Kazuyuki Kawabata (NanohaMini author)
+  Copyright (C) 2015 ebifrier, espelade, kakiage
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  GodWhale is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "perform.h"
+
+#if defined(CHK_PERFORM) || defined(SEARCH_STATS)
+namespace {
+
+    double percent(int64_t n, int64_t total) {
+        return total ? 100.0 * double(n) / double(total) : 0.0;
+    }
+}
+#endif
+
+#if defined(CHK_PERFORM)
+
+ThreadPerfCounters PerfCount[MAX_THREADS];
+
+namespace {
+
+    const char* const JsonNames[PERF_COUNTER_NB] = {
+        "tt_probe", "tt_hit", "tt_store", "tt_hand_miss", "tt_overwrite", "tt_collision", "tt_hand_cut",
+        "eval_full", "eval_diff", "eval_king",
+        "mate1_call", "mate1_hit", "mate3_call", "mate3_hit",
+        "qsearch_nodes", "null_prune", "futility_prune", "splits",
+        "pick_gen_capture", "pick_gen_noncapture", "pick_gen_drop", "pick_gen_evasion", "pick_gen_qcapture",
+        "pick_tried_capture", "pick_tried_noncapture", "pick_tried_drop", "pick_tried_evasion", "pick_tried_qcapture",
+        "pick_pickers", "pick_quiet_phases"
+    };
+}
+
+
+/// perf_counters() は全スレッドのカウンタの合計を返す. 探索中に呼んでもよいが、
+/// そのときの値はおおよそのものになる.
+
+PerfCounters perf_counters() {
+
+    PerfCounters pc;
+
+    for (int k = 0; k < PERF_COUNTER_NB; k++)
+    {
+        pc.c[k] = 0;
+        for (int i = 0; i < MAX_THREADS; i++)
+            pc.c[k] += PerfCount[i].c[k];
+    }
+    return pc;
+}
+
+PerfCounters perf_counters_since(const PerfCounters& start) {
+
+    PerfCounters pc = perf_counters();
+
+    for (int k = 0; k < PERF_COUNTER_NB; k++)
+        pc.c[k] -= start.c[k];
+    return pc;
+}
+
+
+/// perf_counters_to_string() は "info string" に続けて出す1行の文字列を作る.
+
+std::string perf_counters_to_string(const PerfCounters& pc) {
+
+    const int64_t* c = pc.c;
+    char buf[64];
+    std::stringstream s;
+
+    snprintf(buf, sizeof(buf), "%.1f%%", percent(c[PERF_TT_HIT], c[PERF_TT_PROBE]));
+    s << "perf tt probe " << c[PERF_TT_PROBE] << " hit " << c[PERF_TT_HIT] << " (" << buf << ")"
+#if defined(TT_STATS)
+      << " handmiss " << c[PERF_TT_HAND_MISS]
+#endif
+      << " store " << c[PERF_TT_STORE]
+      << " overwrite " << c[PERF_TT_OVERWRITE]
+      << " collision " << c[PERF_TT_COLLISION]
+      << " handcut " << c[PERF_TT_HAND_CUT];
+    s << " eval full " << c[PERF_EVAL_FULL] << " diff " << c[PERF_EVAL_DIFF] << " king " << c[PERF_EVAL_KING];
+    s << " mate1 " << c[PERF_MATE1_HIT] << "/" << c[PERF_MATE1_CALL]
+      << " mate3 " << c[PERF_MATE3_HIT] << "/" << c[PERF_MATE3_CALL];
+    s << " qnodes " << c[PERF_QSEARCH_NODE]
+      << " nullprune " << c[PERF_NULL_PRUNE]
+      << " futility " << c[PERF_FUTILITY_PRUNE]
+      << " splits " << c[PERF_SPLIT];
+    return s.str();
+}
+
+std::string perf_counters_to_json(const PerfCounters& pc) {
+
+    std::stringstream s;
+
+    s << "{";
+    for (int k = 0; k < PERF_COUNTER_NB; k++)
+        s << (k ? ", " : "") << "\"" << JsonNames[k] << "\": " << pc.c[k];
+    s << "}";
+    return s.str();
+}
+
+
+/// print_move_pick_stats() は MovePicker の統計(生成した手のうち一度も返さなかった
+/// 手の数)を表示する.
+
+void print_move_pick_stats(const PerfCounters& pc) {
+
+    static const char* Names[] = { "Captures", "Non-captures", "Drops", "Evasions", "QCaptures" };
+    const int64_t* c = pc.c;
+
+    std::cerr << "\nMove picker (generated / tried / never tried)" << std::endl;
+    for (int k = 0; k < 5; k++)
+    {
+        const int64_t g = c[PERF_PICK_GEN_CAPTURE + k];
+        const int64_t t = c[PERF_PICK_TRIED_CAPTURE + k];
+        std::cerr << std::setw(14) << std::left << Names[k] << std::right
+                  << ": " << std::setw(12) << g
+                  << " / " << std::setw(12) << t
+                  << " / " << std::setw(12) << (g - t)
+                  << " (" << std::fixed << std::setprecision(1) << percent(g - t, g) << "%)" << std::endl;
+    }
+    std::cerr << "Quiet generation: " << c[PERF_PICK_QUIET_PHASES] << " of " << c[PERF_PICK_PICKERS] << " pickers";
+    if (c[PERF_PICK_PICKERS])
+        std::cerr << " (" << std::fixed << std::setprecision(1)
+                  << percent(c[PERF_PICK_QUIET_PHASES], c[PERF_PICK_PICKERS]) << "%)";
+    std::cerr << std::endl;
+}
+
+#endif // defined(CHK_PERFORM)
+
+
+#if defined(PROFILE_SEARCH)
+
+ThreadProfile Profiles[MAX_THREADS];
+
+namespace {
+
+    const char* const PhaseNames[PROF_PHASE_NB] = {
+        "search", "qsearch", "do_move", "undo_move", "effect", "evaluate",
+        "mate1", "mate3", "movepick", "tt_probe"
+    };
+
+    // 空の区間を計測して、1区間あたりの計測のオーバーヘッド(サイクル数)を求める
+    double timer_overhead() {
+
+        const int N = 1000000;
+        ThreadProfile tp;
+
+        memset(&tp, 0, sizeof(tp));
+        ScopedTimer outer(tp, PROF_SEARCH);
+        const uint64_t start = cpu_cycles();
+        for (int i = 0; i < N; i++)
+            ScopedTimer t(tp, PROF_TT_PROBE);
+        return double(cpu_cycles() - start) / N;
+    }
+}
+
+
+/// search_profile() は全スレッドの区間ごとのサイクル数と回数の合計を返す.
+
+SearchProfile search_profile() {
+
+    SearchProfile sp;
+
+    for (int k = 0; k < PROF_PHASE_NB; k++)
+    {
+        sp.cycles[k] = sp.calls[k] = 0;
+        for (int i = 0; i < MAX_THREADS; i++)
+        {
+            sp.cycles[k] += Profiles[i].cycles[k];
+            sp.calls[k] += Profiles[i].calls[k];
+        }
+    }
+    return sp;
+}
+
+SearchProfile search_profile_since(const SearchProfile& start) {
+
+    SearchProfile sp = search_profile();
+
+    for (int k = 0; k < PROF_PHASE_NB; k++)
+    {
+        sp.cycles[k] -= start.cycles[k];
+        sp.calls[k] -= start.calls[k];
+    }
+    return sp;
+}
+
+
+/// search_profile_to_string() は区間ごとの時間の割合を "info string" に続けて出す
+/// 1行の文字列にする.
+
+std::string search_profile_to_string(const SearchProfile& sp) {
+
+    uint64_t total = 0;
+    char buf[64];
+    std::stringstream s;
+
+    for (int k = 0; k < PROF_PHASE_NB; k++)
+        total += sp.cycles[k];
+
+    s << "profile";
+    for (int k = 0; k < PROF_PHASE_NB; k++)
+    {
+        snprintf(buf, sizeof(buf), " %s %.1f%%", PhaseNames[k], total ? 100.0 * double(sp.cycles[k]) / double(total) : 0.0);
+        s << buf;
+    }
+    s << " cycles " << total;
+    return s.str();
+}
+
+
+/// print_search_profile() は区間ごとのサイクル数、回数、1回あたりのサイクル数と
+/// 割合を表にして標準エラー出力に出す. 表の値からは計測のオーバーヘッドを差し引かない
+/// ので、短い区間ほど大きめに出る. 続けて出す利き更新の割合は差し引いた値.
+
+void print_search_profile(const SearchProfile& sp) {
+
+    uint64_t total = 0;
+    char buf[128];
+
+    for (int k = 0; k < PROF_PHASE_NB; k++)
+        total += sp.cycles[k];
+
+    std::cerr << "\nSearch profile (self cycles)" << std::endl;
+    snprintf(buf, sizeof(buf), "%-10s %16s %7s %14s %10s", "phase", "cycles", "share", "calls", "cyc/call");
+    std::cerr << buf << std::endl;
+    for (int k = 0; k < PROF_PHASE_NB; k++)
+    {
+        snprintf(buf, sizeof(buf), "%-10s %16" PRId64 " %6.1f%% %14" PRId64 " %10.1f",
+                 PhaseNames[k], int64_t(sp.cycles[k]), total ? 100.0 * double(sp.cycles[k]) / double(total) : 0.0,
+                 int64_t(sp.calls[k]), sp.calls[k] ? double(sp.cycles[k]) / double(sp.calls[k]) : 0.0);
+        std::cerr << buf << std::endl;
+    }
+    snprintf(buf, sizeof(buf), "%-10s %16" PRId64, "total", int64_t(total));
+    std::cerr << buf << std::endl;
+
+    // 利き更新が do_move()/undo_move() に占める割合. 利き更新の区間は do_move()/undo_move() の
+    // 中にあるので、どちらの回数の分も計測のオーバーヘッドを差し引く
+    const double ovh = timer_overhead();
+    const uint64_t effectCount = sp.calls[PROF_EFFECT];
+    const uint64_t moveCount = sp.calls[PROF_DO_MOVE] + sp.calls[PROF_UNDO_MOVE];
+    const double effect = std::max(0.0, double(sp.cycles[PROF_EFFECT]) - ovh * effectCount);
+    const double move = std::max(1.0, double(sp.cycles[PROF_DO_MOVE] + sp.cycles[PROF_UNDO_MOVE] + sp.cycles[PROF_EFFECT])
+                                      - ovh * (moveCount + effectCount));
+
+    std::cerr << "Effect updates  : " << effectCount
+              << "\nEffect cycles   : " << uint64_t(effect)
+              << " (" << uint64_t(effect / std::max<uint64_t>(1, moveCount)) << "/call)"
+              << "\nDo/undo cycles  : " << uint64_t(move)
+              << " (" << uint64_t(move / std::max<uint64_t>(1, moveCount)) << "/call)"
+              << "\nEffect share    : " << int(1000 * effect / move) / 10.0 << "%"
+              << "\nTimer overhead  : " << ovh << " cycles/scope" << std::endl;
+}
+
+#endif // defined(PROFILE_SEARCH)
+
+
+#if defined(SEARCH_STATS)
+
+ThreadSearchStats SearchStatCount[MAX_THREADS];
+
+namespace {
+
+    // 反復深化の深さごとの合計
+    SearchStats IterationStats[PLY_MAX_PLUS_2];
+
+    // 1行分の統計. prevNodes が 0 のときは実効分岐係数を出さない
+    std::string format_stats(int depth, const SearchStats& st, int64_t prevNodes) {
+
+        const int64_t* c = st.c;
+        const int64_t cut = c[STAT_CUTOFF];
+        char buf[256];
+
+        snprintf(buf, sizeof(buf),
+                 "depth %d nodes %" PRId64 " ebf %.2f fh1 %.1f%% cut tt %.1f%% killer %.1f%% capture %.1f%% quiet %.1f%%"
+                 " lmr %" PRId64 " re %.1f%% null %" PRId64 " ok %.1f%%",
+                 depth, st.nodes, prevNodes ? double(st.nodes) / double(prevNodes) : 0.0,
+                 percent(c[STAT_CUTOFF_FIRST], cut),
+                 percent(c[STAT_CUTOFF_TT], cut), percent(c[STAT_CUTOFF_KILLER], cut),
+                 percent(c[STAT_CUTOFF_CAPTURE], cut), percent(c[STAT_CUTOFF_QUIET], cut),
+                 c[STAT_LMR], percent(c[STAT_LMR_RESEARCH], c[STAT_LMR]),
+                 c[STAT_NULL_TRY], percent(c[STAT_NULL_CUT], c[STAT_NULL_TRY]));
+        return buf;
+    }
+}
+
+
+/// search_stats() は全スレッドの探索木の統計の合計を返す. 局面数は呼び出し側が渡す.
+
+SearchStats search_stats(int64_t nodes) {
+
+    SearchStats st;
+
+    st.nodes = nodes;
+    for (int k = 0; k < SEARCH_STAT_NB; k++)
+    {
+        st.c[k] = 0;
+        for (int i = 0; i < MAX_THREADS; i++)
+            st.c[k] += SearchStatCount[i].c[k];
+    }
+    return st;
+}
+
+SearchStats search_stats_since(const SearchStats& start, int64_t nodes) {
+
+    SearchStats st = search_stats(nodes);
+
+    st.nodes -= start.nodes;
+    for (int k = 0; k < SEARCH_STAT_NB; k++)
+        st.c[k] -= start.c[k];
+    return st;
+}
+
+std::string search_stats_to_string(int depth, const SearchStats& st, int64_t prevNodes) {
+
+    return "stats " + format_stats(depth, st, prevNodes);
+}
+
+
+/// record_iteration_stats() は反復深化1回分の統計を深さごとに積算する.
+/// bench で複数の局面を探索したあと print_iteration_stats() で表示する.
+
+void record_iteration_stats(int depth, const SearchStats& st) {
+
+    assert(depth >= 0 && depth < PLY_MAX_PLUS_2);
+
+    IterationStats[depth].nodes += st.nodes;
+    for (int k = 0; k < SEARCH_STAT_NB; k++)
+        IterationStats[depth].c[k] += st.c[k];
+}
+
+void clear_iteration_stats() {
+
+    memset(IterationStats, 0, sizeof(IterationStats));
+}
+
+void print_iteration_stats() {
+
+    std::cerr << "\nSearch tree statistics (per iteration depth)" << std::endl;
+    for (int d = 1; d < PLY_MAX_PLUS_2; d++)
+        if (IterationStats[d].nodes)
+            std::cerr << format_stats(d, IterationStats[d], IterationStats[d - 1].nodes) << std::endl;
+}
+
+#endif // defined(SEARCH_STATS)
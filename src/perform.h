@@ -0,0 +1,225 @@
+﻿/*
+  GodWhale, a  USI shogi(japanese-chess) playing engine derived from NanohaMini
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014 Kazuyuki Kawabata (NanohaMini author)
+  Copyright (C) 2015 ebifrier, espelade, kakiage
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  GodWhale is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(PERFORM_H_INCLUDED)
+#define PERFORM_H_INCLUDED
+
+#if defined(CHK_PERFORM) || defined(PROFILE_SEARCH) || defined(SEARCH_STATS)
+#include <cassert>
+#include <string>
+#include "thread.h"
+#endif
+
+//
+// 探索の性能カウンタ
+//
+// -DCHK_PERFORM のときだけ数える. カウンタはスレッドごとにキャッシュラインに
+// 揃えて持ち、探索中は排他なしで足し込む. 集計は perf_counters() で全スレッドの
+// 合計を取り、開始時の値との差を見る.
+// CHK_PERFORM がなければ PERF_COUNT() などは何も生成しない.
+//
+
+#if defined(CHK_PERFORM)
+
+enum PerfCounter {
+    PERF_TT_PROBE,          // 置換表を引いた回数
+    PERF_TT_HIT,            // そのうち見つかった回数
+    PERF_TT_STORE,          // 置換表に書いた回数
+    PERF_TT_HAND_MISS,      // 引いて盤面は一致したが持ち駒が違って見つからなかった回数(TT_STATS のみ)
+    PERF_TT_OVERWRITE,      // 書いたうち同じ局面のエントリを書き換えた回数
+    PERF_TT_COLLISION,      // 書いたうち別の局面のエントリを追い出した回数
+    PERF_TT_HAND_CUT,       // 持ち駒の優劣で同じ盤面の別の局面の値を使って切った回数
+    PERF_EVAL_FULL,         // 評価値を全計算した回数
+    PERF_EVAL_DIFF,         // 差分計算(または前の値の流用)で済んだ回数
+    PERF_EVAL_KING,         // 玉が動いたため差分計算できなかった回数(全計算の内数)
+    PERF_MATE1_CALL,        // Mate1ply() の呼び出し回数
+    PERF_MATE1_HIT,         // そのうち詰みが見つかった回数
+    PERF_MATE3_CALL,        // Mate3() の呼び出し回数
+    PERF_MATE3_HIT,         // そのうち詰みが見つかった回数
+    PERF_QSEARCH_NODE,      // 静止探索の局面数
+    PERF_NULL_PRUNE,        // null move で枝刈りした回数
+    PERF_FUTILITY_PRUNE,    // futility(static null move、手の数と評価値による枝刈り)で刈った回数
+    PERF_SPLIT,             // 探索を分割した回数
+    // MovePicker が生成した手の数と、そのうち実際に返した(置換表の手・killer として
+    // 既に返したものを含む)手の数. 一度も返さなかった手は生成とスコア付けが無駄になった手.
+    // GEN と TRIED は同じ並びにする
+    PERF_PICK_GEN_CAPTURE, PERF_PICK_GEN_NONCAPTURE, PERF_PICK_GEN_DROP, PERF_PICK_GEN_EVASION, PERF_PICK_GEN_QCAPTURE,
+    PERF_PICK_TRIED_CAPTURE, PERF_PICK_TRIED_NONCAPTURE, PERF_PICK_TRIED_DROP, PERF_PICK_TRIED_EVASION, PERF_PICK_TRIED_QCAPTURE,
+    PERF_PICK_PICKERS,      // 王手がかかっていない通常探索の MovePicker の数
+    PERF_PICK_QUIET_PHASES, // そのうち取らない手を生成するところまで進んだ数
+    PERF_COUNTER_NB
+};
+
+struct PerfCounters {
+    int64_t c[PERF_COUNTER_NB];
+};
+
+// スレッドごとに持ち、キャッシュラインを共有しないようにする
+struct CACHE_LINE_ALIGNMENT ThreadPerfCounters {
+    int64_t c[PERF_COUNTER_NB];
+};
+
+extern ThreadPerfCounters PerfCount[MAX_THREADS];
+
+extern PerfCounters perf_counters();                               // 全スレッドの合計
+extern PerfCounters perf_counters_since(const PerfCounters& start);
+extern std::string perf_counters_to_string(const PerfCounters& pc);  // info string に出す形
+extern std::string perf_counters_to_json(const PerfCounters& pc);
+extern void print_move_pick_stats(const PerfCounters& pc);         // MovePicker の分を cerr に出す
+
+#define PERF_COUNT(th, id)      (PerfCount[th].c[id]++)
+#define PERF_ADD(th, id, n)     (PerfCount[th].c[id] += (n))
+#else
+#define PERF_COUNT(th, id)
+#define PERF_ADD(th, id, n)
+#endif // defined(CHK_PERFORM)
+
+//
+// 探索の区間ごとのサイクル数
+//
+// -DPROFILE_SEARCH のときだけ計測する. PROFILE_SCOPE() を置いたブロックの
+// 実行時間をタイムスタンプカウンタで測り、スレッドごとに区間の種類別に積算する.
+// 区間が入れ子になったときは内側の区間の時間を外側から除く(自己時間)ので、
+// 全区間の合計が探索にかかった時間になる.
+//
+
+#if defined(PROFILE_SEARCH)
+
+enum ProfilePhase {
+    PROF_SEARCH,            // search() のうち以下の区間を除いた部分
+    PROF_QSEARCH,           // qsearch() のうち以下の区間を除いた部分
+    PROF_DO_MOVE,
+    PROF_UNDO_MOVE,
+    PROF_EFFECT,            // do_move()/undo_move() の中の利きとピン情報の更新(1手に1区間)
+    PROF_EVALUATE,
+    PROF_MATE1,
+    PROF_MATE3,             // Mate3() のうち Mate1ply()、do_move()、undo_move() を除いた部分
+    PROF_MOVE_PICK,         // MovePicker の指し手生成と並べ替え
+    PROF_TT_PROBE,
+    PROF_PHASE_NB
+};
+
+const int PROFILE_STACK_MAX = 4 * PLY_MAX_PLUS_2;
+
+struct SearchProfile {
+    uint64_t cycles[PROF_PHASE_NB];
+    uint64_t calls[PROF_PHASE_NB];
+};
+
+// スレッドごとに持ち、キャッシュラインを共有しないようにする
+struct CACHE_LINE_ALIGNMENT ThreadProfile {
+    uint64_t cycles[PROF_PHASE_NB];
+    uint64_t calls[PROF_PHASE_NB];
+    uint64_t last;                          // 直前に区間が切り替わったときのサイクル数
+    int depth;
+    unsigned char stack[PROFILE_STACK_MAX]; // 実行中の区間の入れ子
+};
+
+extern ThreadProfile Profiles[MAX_THREADS];
+
+extern SearchProfile search_profile();                                 // 全スレッドの合計
+extern SearchProfile search_profile_since(const SearchProfile& start);
+extern std::string search_profile_to_string(const SearchProfile& sp);  // info string に出す形
+extern void print_search_profile(const SearchProfile& sp);
+
+/// ScopedTimer は生存している間のサイクル数を区間 p に積算し、
+/// 外側の区間の計測をその間止める.
+class ScopedTimer {
+public:
+    ScopedTimer(ThreadProfile& tp, ProfilePhase p) : prof(tp) {
+        const uint64_t t = cpu_cycles();
+        if (prof.depth > 0)
+            prof.cycles[prof.stack[prof.depth - 1]] += t - prof.last;
+        assert(prof.depth < PROFILE_STACK_MAX);
+        prof.stack[prof.depth++] = (unsigned char)p;
+        prof.calls[p]++;
+        prof.last = t;
+    }
+    ~ScopedTimer() {
+        const uint64_t t = cpu_cycles();
+        prof.cycles[prof.stack[--prof.depth]] += t - prof.last;
+        prof.last = t;
+    }
+
+private:
+    ThreadProfile& prof;
+};
+
+// 1つのブロックに複数置けるように変数名に行番号を付ける
+#define PROFILE_CAT_(a, b)      a ## b
+#define PROFILE_CAT(a, b)       PROFILE_CAT_(a, b)
+#define PROFILE_SCOPE(th, p)    ScopedTimer PROFILE_CAT(profileTimer_, __LINE__)(Profiles[th], p)
+#else
+#define PROFILE_SCOPE(th, p)
+#endif // defined(PROFILE_SEARCH)
+
+//
+// 探索木の統計
+//
+// -DSEARCH_STATS のときだけ数える. 反復深化の1回ごとに局面数、実効分岐係数、
+// beta カットの内訳(最初の手で切れた割合、置換表の手・killer・駒を取る手・
+// それ以外の手の割合)、LMR の再探索率、null move の成功率を info string で出す.
+// bench では深さごとに合計して表にする.
+//
+
+#if defined(SEARCH_STATS)
+
+enum SearchStat {
+    STAT_CUTOFF,            // beta カットした局面
+    STAT_CUTOFF_FIRST,      // そのうち最初に探索した手で切れたもの
+    STAT_CUTOFF_TT,         // 切った手が置換表の手
+    STAT_CUTOFF_KILLER,     // 切った手が killer
+    STAT_CUTOFF_CAPTURE,    // 切った手が駒を取る手
+    STAT_CUTOFF_QUIET,      // 切った手がそれ以外(history 順の手)
+    STAT_LMR,               // 深さを減らして探索した手
+    STAT_LMR_RESEARCH,      // そのうち alpha を超えて元の深さで探索し直した手
+    STAT_NULL_TRY,          // null move を試した回数
+    STAT_NULL_CUT,          // そのうち beta カットできた回数
+    SEARCH_STAT_NB
+};
+
+struct SearchStats {
+    int64_t nodes;
+    int64_t c[SEARCH_STAT_NB];
+};
+
+// スレッドごとに持ち、キャッシュラインを共有しないようにする
+struct CACHE_LINE_ALIGNMENT ThreadSearchStats {
+    int64_t c[SEARCH_STAT_NB];
+};
+
+extern ThreadSearchStats SearchStatCount[MAX_THREADS];
+
+extern SearchStats search_stats(int64_t nodes);                        // 全スレッドの合計
+extern SearchStats search_stats_since(const SearchStats& start, int64_t nodes);
+extern std::string search_stats_to_string(int depth, const SearchStats& st, int64_t prevNodes);
+extern void record_iteration_stats(int depth, const SearchStats& st);  // 深さごとに積算する
+extern void clear_iteration_stats();
+extern void print_iteration_stats();
+
+#define STAT_COUNT(th, id)      (SearchStatCount[th].c[id]++)
+#define STAT_ADD(th, id, n)     (SearchStatCount[th].c[id] += (n))
+#else
+#define STAT_COUNT(th, id)
+#define STAT_ADD(th, id, n)
+#endif // defined(SEARCH_STATS)
+
+#endif // !defined(PERFORM_H_INCLUDED)
@@ -274,11 +274,6 @@ Position::Position(const Position& pos, int th) {
     nodes = 0;
 #if defined(NANOHA)
     tnodes = 0;
-#if defined(CHK_PERFORM)
-    count_Mate1plyDrop = 0;        // 駒打ちで詰んだ回数
-    count_Mate1plyMove = 0;        // 駒移動で詰んだ回数
-    count_Mate3ply = 0;            // Mate3()で詰んだ回数
-#endif // defined(CHK_PERFORM)
 #endif
 
     assert(is_ok());
@@ -1763,7 +1758,11 @@ void Position::do_null_move(StateInfo& backupSt) {
 #endif
 
     st->key ^= zobSideToMove;
+#if defined(NANOHA)
+    prefetch((char*)TT.first_entry(st->key, hand[flip(sideToMove)].h));
+#else
     prefetch((char*)TT.first_entry(st->key));
+#endif
 
     sideToMove = flip(sideToMove);
 #if !defined(NANOHA)
@@ -2085,11 +2084,6 @@ void Position::clear() {
     // 将棋はBLACKが先番.
     sideToMove = BLACK;
     tnodes = 0;
-#if defined(CHK_PERFORM)
-    count_Mate1plyDrop = 0;        // 駒打ちで詰んだ回数
-    count_Mate1plyMove = 0;        // 駒移動で詰んだ回数
-    count_Mate3ply = 0;            // Mate3()で詰んだ回数
-#endif // defined(CHK_PERFORM)
 #define FILL_ZERO(x)    memset(x, 0, sizeof(x))
     FILL_ZERO(banpadding);
     FILL_ZERO(ban);
@@ -2445,6 +2439,7 @@ bool Position::is_ok(int* failedStep) const {
     // What features of the position should be verified?
     const bool debugAll = false;
 #if defined(NANOHA)
+    const bool debugBitboards       = debugAll || false;
     const bool debugKingCount       = debugAll || false;
     const bool debugKingCapture     = debugAll || false;
 #else
@@ -2518,12 +2513,11 @@ bool Position::is_ok(int* failedStep) const {
     if (failedStep) (*failedStep)++;
     if (debugKingCapture)
     {
-        // TODO: 玉に相手駒の利きがあるか？
-//      Color us = side_to_move();
-//      Color them = flip(us);
-//      Square ksq = king_square(them);
-//      if (attackers_to(ksq) & pieces_of_color(us))
-//          return false;
+        Color us = side_to_move();
+        Color them = flip(us);
+        Square ksq = king_square(them);
+        if (ksq != 0 && attackers_to(us, ksq).any())
+            return false;
     }
 
     // Is there more than 2 checkers?
@@ -2531,6 +2525,27 @@ bool Position::is_ok(int* failedStep) const {
     // TODO:玉に3駒以上の利きがあったら不正な状態
 //  if (debugCheckerCount && count_1s<CNT32>(st->checkersBB) > 2)
 //      return false;
+
+    // Bitboards OK?
+    if (failedStep) (*failedStep)++;
+    if (debugBitboards)
+    {
+        // 先手と後手の駒が重なっていないか
+        if ((pieces(BLACK) & pieces(WHITE)).any())
+            return false;
+
+        // 盤面とビットボードが一致しているか
+        for (Square s = SQ_A1; s <= SQ_I9; s++) {
+            const Piece p = piece_on(s);
+            if (p == WALL) continue;
+            if (p == EMP) {
+                if (occupied_squares().test(conv_z2bb(s)))
+                    return false;
+            } else if (!pieces(p).test(conv_z2bb(s)) || !pieces(color_of(p)).test(conv_z2bb(s))) {
+                return false;
+            }
+        }
+    }
 #else
     // Do both sides have exactly one king?
     if (failedStep) (*failedStep)++;
@@ -26,9 +26,8 @@
 #include <iostream>
 #include <cstdio>
 #include <list>
-#else
-#include "bitboard.h"
 #endif
+#include "bitboard.h"
 #include "move.h"
 #include "types.h"
 #include "search.h"
@@ -53,32 +52,35 @@ struct CheckInfo {
 /// is made on the board (by calling Position::do_move), an StateInfo object
 /// must be passed as a parameter.
 ///
-/// ※ Position::do_move() の struct ReducedStateInfo と定義を合わせる
+/// ※ do_move() で前の局面からコピーするのは gamePly と pliesFromNull だけ.
+///    key 以降はその手で設定し直すか、その手を戻すときにだけ参照する.
 ///
 class Position;
 
+#if defined(NANOHA)
+typedef int16_t ListIndex;    // 評価関数用listの値(fe_end未満)
+#endif
+
 struct StateInfo {
 #if defined(NANOHA)
     int gamePly;
     int pliesFromNull;
 
-    Piece captured;
+    Key key;
     uint32_t hand;
     uint32_t effect;
-    Key key;
+    Piece captured;
     PieceNumber kncap;  // 捕った持駒の駒番号
 
 #if defined(MAKELIST_DIFF)
-    Piece capHand;     // 捕獲した持駒のPiece
-    Piece dropHand;    // 打った持駒のPiece
-    PieceNumber kndrop; // 打った持駒の駒番号
-    int oldcap[2];      // 捕獲される駒のlist
-    int oldlist[2];     // 動かす駒,打つ持駒のlist
+    ListIndex oldcap[2];    // 捕獲される駒のlist
+    ListIndex oldlist[2];   // 動かす駒,打つ持駒のlist
+    uint8_t capHand;        // 捕獲した持駒のPiece
 #endif
 #if defined(EVAL_DIFF)
-    int newcap[2];      // for cap
-    int newlist[2];     // for drop, slide
-    int changeType;     // changetype king=0, drop&nocap=1, cap=2 
+    ListIndex newcap[2];    // for cap
+    ListIndex newlist[2];   // for drop, slide
+    int changeType;         // changetype king=0, drop&nocap=1, cap=2 
 #endif
 
 #else
@@ -183,6 +185,17 @@ public:
     Square ep_square() const;
 #endif
 
+#if defined(NANOHA)
+    // ビットボード(ban[] と同期して更新する)
+    Bitboard empty_squares() const;
+    Bitboard occupied_squares() const;
+    Bitboard pieces(Color c) const;
+    Bitboard pieces(Piece p) const;
+    Bitboard pieces(PieceType pt, Color c) const;
+    Bitboard attackers_to(Color c, Square s) const;    // s に利いている c の駒
+    Bitboard attacks_from(Piece p, Square s) const;
+#endif
+
     // Current king position for each color
     Square king_square(Color c) const;
 
@@ -299,6 +312,7 @@ public:
 
     template <Color> MoveStack* generate_capture(MoveStack* mlist) const;
     template <Color> MoveStack* generate_non_capture(MoveStack* mlist) const;
+    template <Color> MoveStack* generate_board_non_capture(MoveStack* mlist) const;    // 駒を打つ手を除く
     template <Color> MoveStack* generate_evasion(MoveStack* mlist) const;
     template <Color> MoveStack* generate_non_evasion(MoveStack* mlist) const;
     template <Color> MoveStack* generate_legal(MoveStack* mlist) const;
@@ -321,6 +335,7 @@ public:
     static void init_evaluate();
     int make_list_correct(int list0[], int list1[]) const;
     int evaluate_raw_correct() const;
+    int evaluate_raw_reference() const;
     Value evaluate_correct(const Color us) const;
     int evaluate_raw_body();
     Value evaluate(const Color us, SearchStack* ss);
@@ -361,6 +376,8 @@ public:
 
     // 局面をHuffman符号化する
     int EncodeHuffman(unsigned char buf[32]) const;
+    // Huffman符号を SFEN に戻す
+    static bool DecodeHuffman(const unsigned char buf[32], std::string& sfen);
 #endif
 
     // Static exchange evaluation
@@ -410,11 +427,6 @@ public:
 #if defined(NANOHA)
     int64_t tnodes_searched() const;
     void set_tnodes_searched(int64_t n);
-#if defined(CHK_PERFORM)
-    unsigned long mate3_searched() const;
-    void set_mate3_searched(unsigned long  n);
-    void inc_mate3_searched(unsigned long  n=1);
-#endif // defined(CHK_PERFORM)
 #endif
 
     int64_t nodes_searched() const;
@@ -451,6 +463,7 @@ private:
     void init_position(const unsigned char board_ori[9][9], const int Mochigoma_ori[]);
     void make_pin_info();
     void init_effect();
+    void xor_bb(Piece p, int z);            // 位置zの駒pをビットボードに出し入れする
 #endif
 
     // Helper functions for doing and undoing moves
@@ -509,6 +522,8 @@ private:
     Hand hand[2];                    // 持駒
 #define handS    hand[BLACK]
 #define handG    hand[WHITE]
+    Bitboard byPieceBB[GRY+1];        // [駒] 駒ごとの位置
+    Bitboard byColorBB[2];            // [手番] 手番ごとの駒の位置
     Piece knkind[PIECENUMBER_MAX + 1]; // knkind[num] : 駒番号numの駒種類(EMP(0x00) ～ GRY(0x1F))
     uint8_t knpos[PIECENUMBER_MAX + 1];        // knpos[num]  : 駒番号numの盤上の座標(0:未使用、1:先手持駒、2:後手持駒、0x11-0x99:盤上)
 
@@ -540,7 +555,7 @@ private:
     int handcount[32]; //Pieceの持駒枚数
 
 #if defined(EVAL_DIFF)
-    int doapc(const int index[2]) const;
+    int doapc(const ListIndex index[2]) const;
     bool calc_difference(SearchStack* ss) const;
 #endif
 #endif
@@ -557,9 +572,6 @@ private:
     int threadID;
 #if defined(NANOHA)
     int64_t tnodes;
-    unsigned long count_Mate1plyDrop;        // 駒打ちで詰んだ回数
-    unsigned long count_Mate1plyMove;        // 駒移動で詰んだ回数
-    unsigned long count_Mate3ply;            // Mate3()で詰んだ回数
 #endif
     StateInfo* st;
 #if !defined(NANOHA)
@@ -614,18 +626,6 @@ inline void Position::set_tnodes_searched(int64_t n) {
     tnodes = n;
 }
 
-#if defined(CHK_PERFORM)
-inline unsigned long Position::mate3_searched() const {
-    return count_Mate3ply;
-}
-inline void Position::set_mate3_searched(unsigned long  n) {
-    count_Mate3ply = n;
-}
-inline void Position::inc_mate3_searched(unsigned long  n) {
-    count_Mate3ply += n;
-}
-#endif // defined(CHK_PERFORM)
-
 #endif
 
 inline Piece Position::piece_on(Square s) const {
@@ -922,14 +922,58 @@ inline int Position::SkipOverEMP(int pos, const int dir) const {
 // 二歩チェック(true:posの筋に歩がある＝二歩になる、false:posの筋に歩がない)
 inline bool Position::is_double_pawn(const Color us, const int pos) const
 {
-    const Piece *p = &(ban[(pos & ~0x0F)+1]);
-    Piece pawn = (us == BLACK) ? SFU : GFU;
-    for (int i = 0; i < 9; i++) {
-        if (*p++ == pawn) {
-            return true;
-        }
-    }
-    return false;
+    return (byPieceBB[make_piece(us, FU)] & FileBB[pos >> 4]).any();
+}
+
+// ビットボード
+inline void Position::xor_bb(Piece p, int z)
+{
+    const int sq = conv_z2bb(z);
+    byPieceBB[p].xor_bit(sq);
+    byColorBB[color_of(p)].xor_bit(sq);
+}
+
+inline Bitboard Position::occupied_squares() const {
+    return byColorBB[BLACK] | byColorBB[WHITE];
+}
+
+inline Bitboard Position::empty_squares() const {
+    return ~occupied_squares();
+}
+
+inline Bitboard Position::pieces(Color c) const {
+    return byColorBB[c];
+}
+
+inline Bitboard Position::pieces(Piece p) const {
+    return byPieceBB[p];
+}
+
+inline Bitboard Position::pieces(PieceType pt, Color c) const {
+    return byPieceBB[make_piece(c, pt)];
+}
+
+inline Bitboard Position::attacks_from(Piece p, Square s) const {
+    return attacks_bb(p, conv_z2bb(s), occupied_squares());
+}
+
+// 利きは相手の駒を s に置いたときの利きの逆引きで求める
+inline Bitboard Position::attackers_to(Color c, Square s) const
+{
+    const Color them = flip(c);
+    const int sq = conv_z2bb(s);
+    const Bitboard occ = occupied_squares();
+    const Bitboard golds = pieces(KI, c) | pieces(TO, c) | pieces(NY, c) | pieces(NK, c) | pieces(NG, c);
+    const Bitboard kings = pieces(OU, c) | pieces(UM, c) | pieces(RY, c);
+
+    return (StepAttackBB[make_piece(them, FU)][sq] & pieces(FU, c))
+         | (StepAttackBB[make_piece(them, KE)][sq] & pieces(KE, c))
+         | (StepAttackBB[make_piece(them, GI)][sq] & pieces(GI, c))
+         | (StepAttackBB[make_piece(them, KI)][sq] & golds)
+         | (StepAttackBB[make_piece(them, OU)][sq] & kings)
+         | (lance_attack(them, sq, occ) & pieces(KY, c))
+         | (bishop_attack(sq, occ) & (pieces(KA, c) | pieces(UM, c)))
+         | (rook_attack(sq, occ) & (pieces(HI, c) | pieces(RY, c)));
 }
 
 // 利き関連
@@ -1028,6 +1072,13 @@ std::vector<Move> move_list_from_uci(const Position& position,
 #if defined(NANOHA)
 extern std::string position_to_kif(const Position& pos);
 extern std::string position_to_kif_ex(const Position& pos, Move last = MOVE_NONE);
+extern std::string move_to_kif_record(Move m, Move prev = MOVE_NONE);
+extern std::string game_to_kif(const Position& start, const std::vector<Move>& moves,
+                               const std::vector<int>& msec, const std::string names[2],
+                               const std::string& endWord, int winner);
+extern std::string game_to_csa(const Position& start, const std::vector<Move>& moves,
+                               const std::vector<int>& msec, const std::string names[2],
+                               const std::string& endCmd);
 #endif
 
 #endif // !defined(POSITION_H_INCLUDED)
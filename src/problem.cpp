@@ -21,10 +21,18 @@
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "misc.h"
 #include "position.h"
 #include "search.h"
+#include "thread.h"
 #include "ucioption.h"
 #if defined(NANOHA)
 #include "movegen.h"
@@ -105,7 +113,7 @@ const string ComShogi[] = {
 void solve_problem(int argc, char* argv[]) {
     vector<string> sfenList;
     SearchLimits limits;
-    int time;
+    TimePoint time;
 
     // Assign default values to missing arguments
     string ttSize   = "128";
@@ -249,14 +257,14 @@ void solve_problem(int argc, char* argv[]) {
     // Ok, let's start the benchmark !
     int64_t totalNodes = 0;
     int64_t totalTNodes = 0;
-    time = get_system_time();
+    time = now();
 
     for (size_t i = 0; i < sfenList.size(); i++)
     {
         Move moves[MAX_MOVES] = { MOVE_NONE };
         Position pos(sfenList[i], 0);
 
-        int rap_time = get_system_time();
+        TimePoint rap_time = now();
         cerr << "\nBench position: " << i + 1 << '/' << sfenList.size() << endl;
 
         if (!think(pos, limits, moves))
@@ -264,7 +272,7 @@ void solve_problem(int argc, char* argv[]) {
 
         totalNodes  += pos.nodes_searched();
         totalTNodes += pos.tnodes_searched();
-        rap_time = get_system_time() - rap_time;
+        rap_time = now() - rap_time;
         if (bOut) {
             char buf[16];
             switch (width) {
@@ -285,28 +293,265 @@ void solve_problem(int argc, char* argv[]) {
                 sprintf(buf, "%u", i+1);
                 break;
             }
-            double nps = (rap_time > 0) ? 1000.0*(pos.nodes_searched() + pos.tnodes_searched()) / rap_time : 0;
+            double nps = (rap_time > 0) ? 1000000.0*(pos.nodes_searched() + pos.tnodes_searched()) / rap_time : 0;
             fprintf(fp, "%s%s.%s\t%s\t%6.3f\t%" PRId64 "\t%" PRId64 "\t%6.3f\t0\n",
                         prefix.c_str(), buf, suffix.c_str(),
                         move_to_kif(moves[0]).c_str(),
-                        rap_time / 1000.0,
+                        rap_time / 1000000.0,
                         pos.nodes_searched(), pos.tnodes_searched(), nps);
         }
     }
 
-    time = get_system_time() - time;
+    time = now() - time;
 
     cerr << "\n==============================="
-         << "\nTotal time (ms) : " << time
+         << "\nTotal time (ms) : " << to_msec(time)
          << "\nNodes searched  : " << totalNodes
          << "\nTNodes searched : " << totalTNodes
-         << "\nNodes/sec(all)  : " << static_cast<int>((totalNodes+totalTNodes) / (time / 1000.0)) << endl;
+         << "\nNodes/sec(all)  : " << static_cast<int>((totalNodes+totalTNodes) / (time / 1000000.0)) << endl;
 
     if (bOut) {
         fclose(fp);
     }
 }
 
+namespace {
+
+const string StartSFEN = "lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1";
+
+// 局面の行を SFEN にする. 空行とコメント行は空文字列を返す
+string analyze_line_to_sfen(string line) {
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+        line.erase(line.size() - 1);
+    }
+    const size_t first = line.find_first_not_of(" \t");
+    if (first == string::npos || line[first] == '#') {
+        return "";
+    }
+    line.erase(0, first);
+    if (line.compare(0, 8, "startpos") == 0) {
+        return StartSFEN;
+    }
+    if (line.compare(0, 5, "sfen ") == 0) {
+        line.erase(0, 5);
+    }
+    return line;
+}
+
+// 1局面を探索して、結果を JSON の1行で出力する
+bool analyze_position(size_t index, const string& sfen, const SearchLimits& limits) {
+    Move moves[MAX_MOVES] = { MOVE_NONE };
+    Position pos(sfen, 0);
+
+    mute_output(true);
+    const bool ok = think(pos, limits, moves);
+    mute_output(false);
+
+    const SearchSummary& sum = last_search_summary();
+    std::ostringstream s;
+    s << "{\"index\":" << index
+      << ",\"sfen\":\"" << json_escape(sfen) << "\""
+      << ",\"bestmove\":\"";
+    if (sum.bestMove != MOVE_NONE) {
+        s << move_to_uci(sum.bestMove);
+    } else {
+        s << (pos.IsKachi(pos.side_to_move()) ? "win" : "resign");
+    }
+    s << "\",\"score\":";
+    if (sum.mate != 0) {
+        s << "{\"mate\":" << sum.mate << "}";
+    } else {
+        s << "{\"cp\":" << sum.scoreCp << "}";
+    }
+    s << ",\"depth\":" << sum.depth
+      << ",\"nodes\":" << sum.nodes
+      << ",\"time_ms\":" << sum.usec / USEC_PER_MSEC
+      << ",\"pv\":[";
+    for (int i = 0; sum.pv[i] != MOVE_NONE; i++) {
+        s << (i ? ",\"" : "\"") << move_to_uci(sum.pv[i]) << "\"";
+    }
+    s << "]}\n";
+
+    // PIPE_BUF 以下の1回の書き込みにして、並列に動くプロセスの出力が混ざらないようにする
+    fputs(s.str().c_str(), stdout);
+    fflush(stdout);
+    return ok;
+}
+
+// 入力スレッドが読んだ行はすべて局面として get_input_line() に渡す
+bool queue_position_line(const string&) {
+    return false;
+}
+
+}
+
+/// analyze は多数の局面を探索して、局面ごとに JSON の1行を標準出力に書く.
+///
+///   analyze [-hash N] [-threads N] [-jobs N] [-depth N | -nodes N | -sec N] [file | -]
+///
+/// 局面は1行に1つの SFEN ("sfen " は省略可、"startpos" も可). "#" で始まる行は
+/// 読み飛ばす. ファイルを省略するか "-" のときは標準入力から読み、-jobs 1 なら
+/// 1行読むたびに探索して結果を返すので、パイプでつないだ解析サーバとして使える.
+///
+/// 探索の状態(置換表、スレッド、停止フラグなど)は大域変数なので、1プロセスで
+/// 同時に探索できるのは1局面だけ. -jobs N (N > 1) では局面をすべて読んでから
+/// N 個の子プロセスを fork し、i 番目の局面を i % N 番目のプロセスが探索する.
+/// 評価関数の表はプロセス間で共有され(copy-on-write)、置換表は -hash を N 等分
+/// してプロセスごとに持つ. 出力は局面の順にはならないので index で対応を取る.
+
+void analyze(int argc, char* argv[]) {
+    SearchLimits limits;
+    int ttSize   = 128;
+    int threads  = 1;
+    int jobs     = 1;
+    string sfenFile = "-";
+
+    limits.maxDepth = 10;
+    while (--argc) {
+        argv++;
+        if (argv[0][0] == '-' && argv[0][1] != '\0') {
+            if (argc < 2) {
+                cerr << "Error!:argv = " << *argv << endl;
+                exit(EXIT_FAILURE);
+            }
+            argc--;
+            const int n = atoi(argv[1]);
+            if (strcmp(*argv, "-hash") == 0) {
+                ttSize = n;
+            } else if (strcmp(*argv, "-threads") == 0) {
+                threads = n;
+            } else if (strcmp(*argv, "-jobs") == 0) {
+                jobs = n;
+            } else if (strcmp(*argv, "-depth") == 0) {
+                limits = SearchLimits();
+                limits.maxDepth = n;
+            } else if (strcmp(*argv, "-nodes") == 0) {
+                limits = SearchLimits();
+                limits.maxNodes = n;
+            } else if (strcmp(*argv, "-sec") == 0) {
+                limits = SearchLimits();
+                limits.maxTime = 1000 * n; // maxTime is in ms
+            } else {
+                cerr << "Error!:argv = " << *argv << endl;
+                exit(EXIT_FAILURE);
+            }
+            argv++;
+        } else {
+            sfenFile = argv[0];
+            break;
+        }
+    }
+    if (threads < 1 || threads > MAX_THREADS || jobs < 1 || ttSize < 1) {
+        cerr << "Error!:threads = " << threads << ", jobs = " << jobs << ", hash = " << ttSize << endl;
+        exit(EXIT_FAILURE);
+    }
+#if defined(_WIN32)
+    if (jobs > 1) {
+        cerr << "analyze: -jobs is not supported on Windows, using 1" << endl;
+        jobs = 1;
+    }
+#endif
+
+    std::ostringstream hash;
+    hash << Max(1, ttSize / jobs);
+    std::ostringstream th;
+    th << threads;
+    Options["Hash"].set_value(hash.str());
+    Options["Threads"].set_value(th.str());
+    Options["OwnBook"].set_value("false");
+
+    TimePoint time = now();
+    size_t count = 0;
+
+    if (sfenFile == "-" && jobs == 1) {
+        // 標準入力から1行ずつ読んで、すぐに探索する
+        start_input_thread(queue_position_line);
+        string line;
+        while (get_input_line(line) && line != "quit") {
+            const string sfen = analyze_line_to_sfen(line);
+            if (sfen.empty()) {
+                continue;
+            }
+            if (!analyze_position(count++, sfen, limits)) {
+                break;
+            }
+        }
+    } else {
+        vector<string> sfenList;
+        string line;
+        if (sfenFile == "-") {
+            while (getline(cin, line)) {
+                const string sfen = analyze_line_to_sfen(line);
+                if (!sfen.empty()) {
+                    sfenList.push_back(sfen);
+                }
+            }
+        } else {
+            ifstream f(sfenFile.c_str());
+            if (!f.is_open()) {
+                cerr << "Unable to open file " << sfenFile << endl;
+                exit(EXIT_FAILURE);
+            }
+            while (getline(f, line)) {
+                const string sfen = analyze_line_to_sfen(line);
+                if (!sfen.empty()) {
+                    sfenList.push_back(sfen);
+                }
+            }
+        }
+        count = sfenList.size();
+
+        // 探索中に標準入力を読まない(局面の入力と混ざるため)
+        ignore_input(true);
+        jobs = Min(jobs, Max(1, int(sfenList.size())));
+
+        if (jobs == 1) {
+            for (size_t i = 0; i < sfenList.size(); i++) {
+                if (!analyze_position(i, sfenList[i], limits)) {
+                    break;
+                }
+            }
+        }
+#if !defined(_WIN32)
+        else {
+            fflush(stdout);
+            vector<pid_t> children;
+            for (int job = 0; job < jobs; job++) {
+                const pid_t pid = fork();
+                if (pid < 0) {
+                    perror("fork");
+                    break;
+                }
+                if (pid == 0) {
+                    // fork() で複製されるのは呼び出したスレッドだけなので、
+                    // 探索スレッドを作り直す
+                    Threads.init();
+                    for (size_t i = job; i < sfenList.size(); i += jobs) {
+                        if (!analyze_position(i, sfenList[i], limits)) {
+                            break;
+                        }
+                    }
+                    fflush(stdout);
+                    _exit(EXIT_SUCCESS);
+                }
+                children.push_back(pid);
+            }
+            for (size_t i = 0; i < children.size(); i++) {
+                int status;
+                waitpid(children[i], &status, 0);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+                    cerr << "analyze: job " << i << " failed" << endl;
+                }
+            }
+        }
+#endif
+    }
+
+    time = now() - time;
+    cerr << "analyze: " << count << " positions, " << jobs << " jobs, "
+         << to_msec(time) << " ms" << endl;
+}
+
 // 静止探索のテスト.
 void test_see(int argc, char* argv[])
 {
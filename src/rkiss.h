@@ -63,16 +63,16 @@ class RKISS {
     }
 
     // Init seed and scramble a few rounds
-    void raninit() {
+    void raninit(uint64_t seed) {
 
         s.a = 0xf1ea5eed;
-        s.b = s.c = s.d = 0xd4e12c77;
+        s.b = s.c = s.d = 0xd4e12c77 ^ seed;
         for (int i = 0; i < 73; i++)
             rand64();
     }
 
 public:
-    RKISS() { raninit(); }
+    RKISS(uint64_t seed = 0) { raninit(seed); }
     template<typename T> T rand() { return T(rand64()); }
 };
 
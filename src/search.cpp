@@ -19,6 +19,7 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstring>
@@ -35,6 +36,7 @@
 #include "move.h"
 #include "movegen.h"
 #include "movepick.h"
+#include "perform.h"
 #include "search.h"
 #include "timeman.h"
 #include "thread.h"
@@ -176,6 +178,16 @@ namespace {
     // better than the second best move.
     const Value EasyMoveMargin = Value(0x200/**/);
 
+#if defined(NANOHA)
+    // 置換表になかった局面で, 同じ盤面の持ち駒が劣る局面の下限や優る局面の上限を
+    // 使って切るかどうか. USI の TT_HandDominance で選ぶ.
+    enum HandDominanceMode {
+        HAND_DOM_NONE,      // 使わない
+        HAND_DOM_MATE,      // 詰み・詰まされの値だけ使う
+        HAND_DOM_BOUND      // 十分な深さの上下限も使う
+    };
+#endif
+
 
     /// Namespace variables
 
@@ -187,11 +199,57 @@ namespace {
 
 #if defined(NANOHA)
     Value DrawValue;
+
+    // 置換表で同じ盤面の持ち駒の優劣を使う範囲(HandDominanceMode)
+    int HandDominance;
 #endif
     // Time management variables
-    bool StopOnPonderhit, FirstRootMove, StopRequest, QuitRequest, AspirationFailLow;
+    // StopRequest などは入力スレッドからも書き換えられる
+    std::atomic<bool> StopOnPonderhit, StopRequest, QuitRequest;
+    bool FirstRootMove, AspirationFailLow;
     TimeManager TimeMgr;
     SearchLimits Limits;
+    TimePoint SearchStartTime;
+
+    // 最後の think() の結果
+    SearchSummary Summary;
+
+    // 入力スレッドとの同期. "go" を受け取ってから think() が終わるまでに届いた
+    // stop/ponderhit/quit を記録し、探索中なら直ちに StopRequest などに反映する.
+    Lock InputLock;
+    WaitCondition InputCond;
+    bool GoPending, Searching, PendingStop, PendingPonderhit, PendingQuit;
+
+    // 1手目の反復が終わってから呼ぶ. それまでに届いたコマンドを反映し、
+    // 以降は handle_search_command() から直接 StopRequest などを立てる.
+    void start_accepting_commands() {
+        lock_grab(&InputLock);
+        if (PendingQuit)
+            QuitRequest = true;
+        if (PendingQuit || PendingStop)
+            StopRequest = true;
+        if (PendingQuit || PendingStop || PendingPonderhit)
+            Limits.ponder = false;
+        Searching = true;
+        lock_release(&InputLock);
+    }
+
+    // bestmove を送った直後に届く次の go を消さないよう、送る前に release() を呼ぶ.
+    // デストラクタは途中で return したときの後始末
+    struct SearchScope {
+        SearchScope() : released(false) {}
+        ~SearchScope() { release(); }
+        void release() {
+            if (released)
+                return;
+            lock_grab(&InputLock);
+            GoPending = Searching = false;
+            PendingStop = PendingPonderhit = PendingQuit = false;
+            lock_release(&InputLock);
+            released = true;
+        }
+        bool released;
+    };
 
     // Log file
     std::ofstream LogFile;
@@ -200,9 +258,8 @@ namespace {
     int SkillLevel;
     bool SkillLevelEnabled;
 
-    // Node counters, used only by thread[0] but try to keep in different cache
-    // lines (64 bytes each) from the heavy multi-thread read accessed variables.
-    int NodesSincePoll;
+    // Polling interval in nodes. Each thread counts its own nodes in
+    // Thread::nodesSincePoll.
     int NodesBetweenPolls = 30000;
 
     // History table
@@ -223,6 +280,11 @@ namespace {
     bool connected_moves(const Position& pos, Move m1, Move m2);
     Value value_to_tt(Value v, int ply);
     Value value_from_tt(Value v, int ply);
+    const TTEntry* probe_tt(const Position& pos, Key key);
+    void store_tt(const Position& pos, Key key, Value v, ValueType t, Depth d, Move m, Value statV, Value statM);
+#if defined(NANOHA)
+    Value probe_hand_tt(const Position& pos, Key key, Depth depth, Value beta, int ply);
+#endif
     bool can_return_tt(const TTEntry* tte, Depth depth, Value beta, int ply);
     bool connected_threat(const Position& pos, Move m, Move threat);
     Value refine_eval(const TTEntry* tte, Value defaultEval, int ply);
@@ -230,7 +292,7 @@ namespace {
     void update_gains(const Position& pos, Move move, Value before, Value after);
     void do_skill_level(Move* best, Move* ponder);
 
-    int current_search_time(int set = 0);
+    TimePoint current_search_time();
     string score_to_uci(Value v, Value alpha = -VALUE_INFINITE, Value beta = VALUE_INFINITE);
     string speed_to_uci(int64_t nodes);
     string pv_to_uci(const Move pv[], int pvNum, bool chess960);
@@ -399,6 +461,71 @@ void init_search() {
     // Init futility move count array
     for (d = 0; d < 32; d++)
         FutilityMoveCounts[d] = int(3.001 + 0.25 * pow(d, 2.0));
+
+    lock_init(&InputLock);
+    cond_init(&InputCond);
+}
+
+
+/// handle_search_command() is called by the input thread for every line read
+/// from stdin. "stop", "ponderhit", "gameover" and "quit" received between "go"
+/// and "bestmove" are applied to the running search at once. Returns true if
+/// the command has been consumed, otherwise it must be passed to uci_loop().
+
+bool handle_search_command(const string& cmd) {
+
+    string token;
+    std::istringstream is(cmd);
+    is >> token;
+
+    bool consumed = false;
+
+    lock_grab(&InputLock);
+
+    if (token == "go")
+    {
+        GoPending = true;
+        PendingStop = PendingPonderhit = PendingQuit = false;
+    }
+    else if (GoPending)
+    {
+        if (token == "quit")
+        {
+            // Quit the program as soon as possible, uci_loop() also gets it
+            PendingQuit = true;
+            if (Searching)
+            {
+                Limits.ponder = false;
+                QuitRequest = StopRequest = true;
+            }
+        }
+        else if (token == "stop" || token == "gameover")
+        {
+            // Stop calculating as soon as possible, but still send the "bestmove"
+            PendingStop = consumed = true;
+            if (Searching)
+            {
+                Limits.ponder = false;
+                StopRequest = true;
+            }
+        }
+        else if (token == "ponderhit")
+        {
+            // Switch from pondering to normal search
+            PendingPonderhit = consumed = true;
+            if (Searching)
+            {
+                Limits.ponder = false;
+                if (StopOnPonderhit)
+                    StopRequest = true;
+            }
+        }
+        cond_signal(&InputCond);
+    }
+
+    lock_release(&InputLock);
+
+    return consumed;
 }
 
 
@@ -438,10 +565,54 @@ int64_t perft(Position& pos, Depth depth) {
 }
 
 
+/// SearchContext は対局ごとに持ち越す探索の状態で、置換表と最後の think() の
+/// 結果を持つ. think(ctx, ...) は探索の間だけ大域の TT をこの置換表と入れ替える.
+/// 探索スレッド、USI のオプション、history などは大域のままなので、think() は
+/// 同時に1つしか呼べない.
+
+struct SearchContext {
+    TranspositionTable tt;
+    SearchSummary Summary;
+};
+
+
+/// last_search_summary() は最後の think() の結果を返す. 次の think() までは
+/// 変わらない. ctx を渡すとそのコンテキストでの最後の結果を返す.
+
+const SearchSummary& last_search_summary() {
+    return Summary;
+}
+
+const SearchSummary& last_search_summary(const SearchContext* ctx) {
+    return ctx->Summary;
+}
+
+
+/// new_search_context() は USI のエンジンとは別の置換表を持つコンテキストを作る.
+/// 置換表の大きさは think() のときの Options["Hash"] の値を使う.
+
+SearchContext* new_search_context() {
+    return new SearchContext;
+}
+
+void delete_search_context(SearchContext* ctx) {
+    delete ctx;
+}
+
+
 /// think() is the external interface to Stockfish's search, and is called when
 /// the program receives the UCI 'go' command. It initializes various global
 /// variables, and calls id_loop(). It returns false when a "quit" command is
-/// received during the search.
+/// received during the search. ctx を渡すとそのコンテキストの置換表で探索する.
+
+bool think(SearchContext* ctx, Position& pos, const SearchLimits& limits, Move searchMoves[]) {
+
+    TT.swap(ctx->tt);
+    const bool result = think(pos, limits, searchMoves);
+    TT.swap(ctx->tt);
+    ctx->Summary = Summary;
+    return result;
+}
 
 bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
 
@@ -450,10 +621,21 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
 #endif
 
     // Initialize global search-related variables
+    lock_grab(&InputLock);
     StopOnPonderhit = StopRequest = QuitRequest = AspirationFailLow = false;
-    NodesSincePoll = 0;
-    current_search_time(get_system_time());
+    SearchStartTime = now();
     Limits = limits;
+
+    // stop/quit already received are applied after the first iteration
+    if (PendingQuit || PendingStop || PendingPonderhit)
+        Limits.ponder = false;
+    lock_release(&InputLock);
+
+    // 戻るときに入力スレッドとの同期状態を片付ける
+    SearchScope scope;
+
+    memset(&Summary, 0, sizeof(Summary));
+
     TimeMgr.init(Limits, pos.startpos_ply_counter());
 
 #if !defined(NANOHA)
@@ -489,9 +671,11 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
             if (Limits.ponder)
                 wait_for_stop_or_ponderhit();
 
+            scope.release();
 #if defined(NANOHA)
-            cout << "bestmove " << move_to_uci(bookMove) << endl;
+            sync_output("bestmove " + move_to_uci(bookMove) + "\n");
             searchMoves[0] = bookMove;
+            Summary.bestMove = Summary.pv[0] = bookMove;
 #else
             cout << "bestmove " << bookMove << endl;
 #endif
@@ -505,7 +689,8 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
         if (Limits.ponder)
             wait_for_stop_or_ponderhit();
 
-        cout << "bestmove win" << endl;
+        scope.release();
+        sync_output("bestmove win\n");
         searchMoves[0] = MOVE_NONE;
         return !QuitRequest;
     }
@@ -520,8 +705,12 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
             if (Limits.ponder)
                 wait_for_stop_or_ponderhit();
 
-            cout << "bestmove " << move_to_uci(m) << endl;
+            scope.release();
+            sync_output("bestmove " + move_to_uci(m) + "\n");
             searchMoves[0] = m;
+            Summary.bestMove = Summary.pv[0] = m;
+            Summary.score = value_mate_in(1);
+            Summary.mate = 1;
             return !QuitRequest;
         }
     }
@@ -529,9 +718,11 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
 
     // Read UCI options
     UCIMultiPV = Options["MultiPV"].value<int>();
+    set_info_interval(Options["Info_Interval"].value<int>());
     SkillLevel = Options["Skill Level"].value<int>();
 #if defined(NANOHA)
     DrawValue = (Value)(Options["DrawValue"].value<int>()/* *2 */);
+    HandDominance = Options["TT_HandDominance"].value<int>();
 #endif
 
 #if !defined(NANOHA)
@@ -558,6 +749,7 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
     {
         Threads[i].wake_up();
         Threads[i].maxPly = 0;
+        Threads[i].nodesSincePoll = 0;
     }
 
     // Write to log file and keep it open to be accessed during the search
@@ -578,15 +770,27 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
 
     // We're ready to start thinking. Call the iterative deepening loop function
     Move ponderMove = MOVE_NONE;
-    Move bestMove = id_loop(pos, searchMoves, &ponderMove);
+#if defined(CHK_PERFORM)
+    PerfCounters perfStart = perf_counters();
+#endif
+#if defined(PROFILE_SEARCH)
+    SearchProfile profileStart = search_profile();
+#endif
+    Threads[0].set_state(THREAD_SEARCHING);
+    Move bestMove;
+    {
+        PROFILE_SCOPE(0, PROF_SEARCH);
+        bestMove = id_loop(pos, searchMoves, &ponderMove);
+    }
+    Threads[0].set_state(THREAD_IDLE);
 
     // Write final search statistics and close log file
     if (LogFile.is_open())
     {
-        int t = current_search_time();
+        TimePoint t = current_search_time();
 
         LogFile << "Nodes: "          << pos.nodes_searched()
-                << "\nNodes/second: " << (t > 0 ? pos.nodes_searched() * 1000 / t : 0)
+                << "\nNodes/second: " << (t > 0 ? pos.nodes_searched() * 1000000 / t : 0)
                 << "\nBest move: "    << move_to_san(pos, bestMove);
 
         StateInfo st;
@@ -599,35 +803,63 @@ bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]) {
     // This makes all the threads to go to sleep
     Threads.set_size(1);
 
+    // 結果をまとめておく(depth は id_loop() で最後に終えた反復の深さ)
+    Summary.bestMove = bestMove;
+    Summary.nodes = pos.nodes_searched();
+    Summary.usec = current_search_time();
+    if (Rml.size())
+    {
+        Summary.score = Rml[0].score;
+        if (abs(Summary.score) < VALUE_MATE_IN_PLY_MAX)
+            Summary.scoreCp = int(Summary.score) * 100 / DPawn;
+        else
+            Summary.mate = (Summary.score > 0 ? VALUE_MATE - Summary.score + 1 : -VALUE_MATE - Summary.score) / 2;
+        for (size_t i = 0; i < Rml[0].pv.size() && i < PLY_MAX; i++)
+            Summary.pv[i] = Rml[0].pv[i];
+    }
+
+#if defined(CHK_PERFORM)
+    // この探索での性能カウンタを出す. GUI を煩わせないよう USI の Perf_Counters を入れたときだけ
+    if (Options["Perf_Counters"].value<bool>())
+        sync_output("info string " + perf_counters_to_string(perf_counters_since(perfStart)) + "\n");
+#endif
+#if defined(PROFILE_SEARCH)
+    sync_output("info string " + search_profile_to_string(search_profile_since(profileStart)) + "\n");
+#endif
+
     // If we are pondering or in infinite search, we shouldn't print the
     // best move before we are told to do so.
     if (!StopRequest && (Limits.ponder || Limits.infinite))
         wait_for_stop_or_ponderhit();
 
+    std::stringstream s;
+
     // Could be MOVE_NONE when searching on a stalemate position
 #if defined(NANOHA)
     if (bestMove == MOVE_NONE) {
-        cout << "bestmove resign";
+        s << "bestmove resign";
     } else {
-        cout << "bestmove " << move_to_uci(bestMove);
+        s << "bestmove " << move_to_uci(bestMove);
     }
 #else
-    cout << "bestmove " << bestMove;
+    s << "bestmove " << bestMove;
 #endif
 
     // UCI protol is not clear on allowing sending an empty ponder move, instead
     // it is clear that ponder move is optional. So skip it if empty.
 #if defined(NANOHA)
     if (ponderMove != MOVE_NONE && Options["Ponder"].value<bool>())
-        cout << " ponder " << move_to_uci(ponderMove);
+        s << " ponder " << move_to_uci(ponderMove);
 
     searchMoves[0] = bestMove;
 #else
     if (ponderMove != MOVE_NONE)
-        cout << " ponder " << ponderMove;
+        s << " ponder " << ponderMove;
 #endif
 
-    cout << endl;
+    s << "\n";
+    scope.release();
+    sync_output(s.str());
 
     return !QuitRequest;
 }
@@ -665,8 +897,7 @@ namespace {
         {
 #if defined(NANOHA)
             // 将棋で Stalemate は投了.
-            cout << "info depth 0 score "
-                 << score_to_uci(-VALUE_MATE, alpha, beta) << endl;
+            sync_output("info depth 0 score" + score_to_uci(-VALUE_MATE, alpha, beta) + "\n");
 #else
             cout << "info" << depth_to_uci(DEPTH_ZERO)
                  << score_to_uci(pos.in_check() ? -VALUE_MATE : VALUE_DRAW, alpha, beta) << endl;
@@ -675,9 +906,18 @@ namespace {
             return MOVE_NONE;
         }
 
+#if defined(SEARCH_STATS)
+        SearchStats iterStart;
+        int64_t prevIterNodes = 0;
+#endif
+
         // Iterative deepening loop until requested to stop or target depth reached
         while (!StopRequest && ++depth <= PLY_MAX && (!Limits.maxDepth || depth <= Limits.maxDepth))
         {
+#if defined(SEARCH_STATS)
+            iterStart = search_stats(pos.nodes_searched());
+#endif
+
             // Save last iteration's scores, this needs to be done now, because in
             // the following MultiPV loop Rml moves could be reordered.
             for (size_t i = 0; i < Rml.size(); i++)
@@ -741,27 +981,30 @@ namespace {
                     // Send full PV info to GUI if we are going to leave the loop or
                     // if we have a fail high/low and we are deep in the search.
 #if defined(NANOHA)
-                    if (Options["Output_AllDepth"].value<bool>() || (value > alpha && value < beta) || current_search_time() > 500) {
+                    if (Options["Output_AllDepth"].value<bool>() || (value > alpha && value < beta) || current_search_time() > 500 * USEC_PER_MSEC) {
 #else
-                    if ((value > alpha && value < beta) || current_search_time() > 2000) {
+                    if ((value > alpha && value < beta) || current_search_time() > 2000 * USEC_PER_MSEC) {
 #endif
-                        for (int i = 0; i < Min(UCIMultiPV, MultiPVIteration + 1); i++) {
 #if !defined(GODWHALE_SERVER) || defined(GODWHALE_CLIENT)
-                            cout << "info"
-                                 << depth_to_uci(depth * ONE_PLY)
-                                 << (i == MultiPVIteration ? score_to_uci(Rml[i].score, alpha, beta) :
-                                                             score_to_uci(Rml[i].score))
-                                 << speed_to_uci(pos.nodes_searched())
+                        // MultiPV の全行をまとめて一度に出力する
+                        std::stringstream s;
+                        for (int i = 0; i < Min(UCIMultiPV, MultiPVIteration + 1); i++) {
+                            s << "info"
+                              << depth_to_uci(depth * ONE_PLY)
+                              << (i == MultiPVIteration ? score_to_uci(Rml[i].score, alpha, beta) :
+                                                          score_to_uci(Rml[i].score))
+                              << speed_to_uci(pos.nodes_searched())
 #if defined(NANOHA)
-                                 << pv_to_uci(&Rml[i].pv[0], i + 1, false)
+                              << pv_to_uci(&Rml[i].pv[0], i + 1, false)
 #else
-                                 << pv_to_uci(&Rml[i].pv[0], i + 1, pos.is_chess960())
+                              << pv_to_uci(&Rml[i].pv[0], i + 1, pos.is_chess960())
 #endif
-                                 << endl;
+                              << "\n";
+                        }
+                        info_output(s.str());
 #else
-                            //whaleの時読み表示なし
+                        //whaleの時読み表示なし
 #endif
-                        }
                     }
 
                     // In case of failing high/low increase aspiration window and research,
@@ -790,13 +1033,30 @@ namespace {
             *ponderMove = Rml[0].pv[1];
             bestValues[depth] = value;
             bestMoveChanges[depth] = Rml.bestMoveChanges;
+            if (!StopRequest)
+                Summary.depth = depth;
+
+#if defined(SEARCH_STATS)
+            // 最後まで探索した反復の探索木の統計を出す
+            if (!StopRequest)
+            {
+                SearchStats st = search_stats_since(iterStart, pos.nodes_searched());
+                record_iteration_stats(depth, st);
+                sync_output("info string " + search_stats_to_string(depth, st, prevIterNodes) + "\n");
+                prevIterNodes = st.nodes;
+            }
+#endif
+
+            // Make sure we have at least one move to send before stopping
+            if (depth == 1)
+                start_accepting_commands();
 
             // Do we need to pick now the best and the ponder moves ?
             if (SkillLevelEnabled && depth == 1 + SkillLevel)
                 do_skill_level(&skillBest, &skillPonder);
 
             if (LogFile.is_open())
-                LogFile << pretty_pv(pos, depth, value, current_search_time(), &Rml[0].pv[0]) << endl;
+                LogFile << pretty_pv(pos, depth, value, int(current_search_time() / USEC_PER_MSEC), &Rml[0].pv[0]) << endl;
 
             // Init easyMove after first iteration or drop if differs from the best move
             if (depth == 1 && (Rml.size() == 1 || Rml[0].score > Rml[1].score + EasyMoveMargin))
@@ -841,11 +1101,13 @@ namespace {
                     StopRequest = true;
 
                 // If we are allowed to ponder do not stop the search now but keep pondering
+                lock_grab(&InputLock);
                 if (StopRequest && Limits.ponder)
                 {
                     StopRequest = false;
                     StopOnPonderhit = true;
                 }
+                lock_release(&InputLock);
             }
         }
 
@@ -931,9 +1193,9 @@ namespace {
             goto split_point_start;
         }
 
-        if (pos.thread() == 0 && ++NodesSincePoll > NodesBetweenPolls)
+        if (++thread.nodesSincePoll > NodesBetweenPolls)
         {
-            NodesSincePoll = 0;
+            thread.nodesSincePoll = 0;
             poll(pos);
         }
 
@@ -994,11 +1256,10 @@ namespace {
         excludedMove = ss->excludedMove;
 #if defined(NANOHA)
         posKey = excludedMove != MOVE_NONE ? pos.get_exclusion_key() : pos.get_key();
-        tte = TT.probe(posKey, pos.hand_value_of_side());
 #else
         posKey = excludedMove ? pos.get_exclusion_key() : pos.get_key();
-        tte = TT.probe(posKey);
 #endif
+        tte = probe_tt(pos, posKey);
         ttMove = RootNode ? Rml[MultiPVIteration].pv[0] : tte ? tte->move() : MOVE_NONE;
 
         // At PV nodes we check for exact scores, while at non-PV nodes we check for
@@ -1027,6 +1288,13 @@ namespace {
             return value;
         }
 
+#if defined(NANOHA)
+        // 置換表になくても, 持ち駒の優劣から値が決まればそれで切る
+        if (   !RootNode && !PvNode && !tte && HandDominance != HAND_DOM_NONE
+            && (value = probe_hand_tt(pos, posKey, depth, beta, ss->ply)) != VALUE_NONE)
+            return value;
+#endif
+
         // Step 5. Evaluate the position statically and update parent's gain statistics
         if (inCheck)
             ss->eval = ss->evalMargin = VALUE_NONE;
@@ -1042,11 +1310,7 @@ namespace {
         {
 			refinedValue = ss->eval = pos.evaluate(pos.side_to_move(), ss);
 			ss->evalMargin = VALUE_NONE;
-#if defined(NANOHA)
-            TT.store(posKey, pos.hand_value_of_side(), VALUE_NONE, VALUE_TYPE_NONE, DEPTH_NONE, MOVE_NONE, ss->eval, ss->evalMargin);
-#else
-            TT.store(posKey, VALUE_NONE, VALUE_TYPE_NONE, DEPTH_NONE, MOVE_NONE, ss->eval, ss->evalMargin);
-#endif
+            store_tt(pos, posKey, VALUE_NONE, VALUE_TYPE_NONE, DEPTH_NONE, MOVE_NONE, ss->eval, ss->evalMargin);
         }
 
         // Save gain for the parent non-capture move
@@ -1087,7 +1351,10 @@ namespace {
 #else
             &&  pos.non_pawn_material(pos.side_to_move()))
 #endif
+        {
+            PERF_COUNT(pos.thread(), PERF_FUTILITY_PRUNE);
             return refinedValue - futility_margin(depth, 0);
+        }
 
         // Step 8. Null move search with verification search (is omitted in PV nodes)
         if (   !PvNode
@@ -1111,6 +1378,7 @@ namespace {
             if (refinedValue - PawnValueMidgame > beta)
                 R++;
 
+            STAT_COUNT(pos.thread(), STAT_NULL_TRY);
             do_null_move_with_eval(pos, st, ss);
             (ss+1)->skipNullMove = true;
             nullValue = depth-R*ONE_PLY < ONE_PLY ? -qsearch<NonPV>(pos, ss+1, -beta, -alpha, DEPTH_ZERO)
@@ -1125,7 +1393,11 @@ namespace {
                     nullValue = beta;
 
                 if (depth < 6 * ONE_PLY)
+                {
+                    PERF_COUNT(pos.thread(), PERF_NULL_PRUNE);
+                    STAT_COUNT(pos.thread(), STAT_NULL_CUT);
                     return nullValue;
+                }
 
                 // Do verification search at high depths
                 ss->skipNullMove = true;
@@ -1133,7 +1405,11 @@ namespace {
                 ss->skipNullMove = false;
 
                 if (v >= beta)
+                {
+                    PERF_COUNT(pos.thread(), PERF_NULL_PRUNE);
+                    STAT_COUNT(pos.thread(), STAT_NULL_CUT);
                     return nullValue;
+                }
             }
             else
             {
@@ -1196,11 +1472,7 @@ namespace {
             search<PvNode ? PV : NonPV>(pos, ss, alpha, beta, d);
             ss->skipNullMove = false;
 
-#if defined(NANOHA)
-            tte = TT.probe(posKey, pos.hand_value_of_side());
-#else
-            tte = TT.probe(posKey);
-#endif
+            tte = probe_tt(pos, posKey);
         }
 
 split_point_start: // At split points actual search starts from here
@@ -1271,7 +1543,7 @@ split_point_start: // At split points actual search starts from here
                 nodes = pos.nodes_searched();
 
                 // For long searches send current move info to GUI
-                if (pos.thread() == 0 && current_search_time() > 2000)
+                if (pos.thread() == 0 && current_search_time() > 2000 * USEC_PER_MSEC)
 #if defined(NANOHA)
                 {}
 #else 
@@ -1347,6 +1619,7 @@ split_point_start: // At split points actual search starts from here
 #endif
                     && bestValue > VALUE_MATED_IN_PLY_MAX) // FIXME bestValue is racy
                 {
+                    PERF_COUNT(pos.thread(), PERF_FUTILITY_PRUNE);
                     if (SpNode)
                         lock_grab(&(sp->lock));
 
@@ -1370,6 +1643,7 @@ split_point_start: // At split points actual search starts from here
 
                 if (futilityValue < beta)
                 {
+                    PERF_COUNT(pos.thread(), PERF_FUTILITY_PRUNE);
                     if (SpNode)
                     {
                         lock_grab(&(sp->lock));
@@ -1442,6 +1716,8 @@ split_point_start: // At split points actual search starts from here
 
                     ss->reduction = DEPTH_ZERO;
                     doFullDepthSearch = (value > alpha);
+                    STAT_COUNT(pos.thread(), STAT_LMR);
+                    STAT_ADD(pos.thread(), STAT_LMR_RESEARCH, doFullDepthSearch);
                 }
 
                 // Step 16. Full depth search
@@ -1560,10 +1836,23 @@ split_point_start: // At split points actual search starts from here
             vt   = bestValue <= oldAlpha ? VALUE_TYPE_UPPER
                  : bestValue >= beta ? VALUE_TYPE_LOWER : VALUE_TYPE_EXACT;
 
+            store_tt(pos, posKey, value_to_tt(bestValue, ss->ply), vt, depth, move, ss->eval, ss->evalMargin);
+
+#if defined(SEARCH_STATS)
+            // beta カットした手の種類を数える(killer の更新前に見る)
+            if (bestValue >= beta)
+            {
+                STAT_COUNT(pos.thread(), STAT_CUTOFF);
+                STAT_ADD(pos.thread(), STAT_CUTOFF_FIRST, moveCount == 1);
+                STAT_COUNT(pos.thread(), move == ttMove ? STAT_CUTOFF_TT
+                                       : move == ss->killers[0] || move == ss->killers[1] ? STAT_CUTOFF_KILLER
 #if defined(NANOHA)
-            TT.store(posKey, pos.hand_value_of_side(), value_to_tt(bestValue, ss->ply), vt, depth, move, ss->eval, ss->evalMargin);
+                                       : pos.is_capture(move) ? STAT_CUTOFF_CAPTURE
 #else
-            TT.store(posKey, value_to_tt(bestValue, ss->ply), vt, depth, move, ss->eval, ss->evalMargin);
+                                       : pos.is_capture_or_promotion(move) ? STAT_CUTOFF_CAPTURE
+#endif
+                                       : STAT_CUTOFF_QUIET);
+            }
 #endif
 
             // Update killers and history only for non capture moves that fails high
@@ -1629,6 +1918,8 @@ split_point_start: // At split points actual search starts from here
 
         ss->bestMove = ss->currentMove = MOVE_NONE;
         ss->ply = (ss-1)->ply + 1;
+        PERF_COUNT(pos.thread(), PERF_QSEARCH_NODE);
+        PROFILE_SCOPE(pos.thread(), PROF_QSEARCH);
 
 #if defined(NANOHA)
         // 手番のときに王手をかけている状態は本来ありえない(前の手で王手回避していないか、自殺手を指していることになる)
@@ -1663,11 +1954,7 @@ split_point_start: // At split points actual search starts from here
 
         // Transposition table lookup. At PV nodes, we don't use the TT for
         // pruning, but only for move ordering.
-#if defined(NANOHA)
-        tte = TT.probe(pos.get_key(), pos.hand_value_of_side());
-#else
-        tte = TT.probe(pos.get_key());
-#endif
+        tte = probe_tt(pos, pos.get_key());
         ttMove = (tte ? tte->move() : MOVE_NONE);
 
         if (!PvNode && tte && can_return_tt(tte, ttDepth, beta, ss->ply))
@@ -1676,6 +1963,12 @@ split_point_start: // At split points actual search starts from here
             return value_from_tt(tte->value(), ss->ply);
         }
 
+#if defined(NANOHA)
+        if (   !PvNode && !tte && HandDominance != HAND_DOM_NONE
+            && (value = probe_hand_tt(pos, pos.get_key(), ttDepth, beta, ss->ply)) != VALUE_NONE)
+            return value;
+#endif
+
         // Evaluate the position statically
         if (inCheck)
         {
@@ -1704,11 +1997,9 @@ split_point_start: // At split points actual search starts from here
             if (bestValue >= beta)
             {
                 if (!tte)
-#if defined(NANOHA)
-                    TT.store(pos.get_key(), pos.hand_value_of_side(), value_to_tt(bestValue, ss->ply), VALUE_TYPE_LOWER, DEPTH_NONE, MOVE_NONE, ss->eval, evalMargin);
-#else
-                    TT.store(pos.get_key(), value_to_tt(bestValue, ss->ply), VALUE_TYPE_LOWER, DEPTH_NONE, MOVE_NONE, ss->eval, evalMargin);
-#endif
+                {
+                    store_tt(pos, pos.get_key(), value_to_tt(bestValue, ss->ply), VALUE_TYPE_LOWER, DEPTH_NONE, MOVE_NONE, ss->eval, evalMargin);
+                }
 
                 return bestValue;
             }
@@ -1769,6 +2060,7 @@ split_point_start: // At split points actual search starts from here
 
                 if (futilityValue < beta)
                 {
+                    PERF_COUNT(pos.thread(), PERF_FUTILITY_PRUNE);
                     if (futilityValue > bestValue)
                         bestValue = futilityValue;
 
@@ -1873,11 +2165,7 @@ split_point_start: // At split points actual search starts from here
         vt   = bestValue <= oldAlpha ? VALUE_TYPE_UPPER
              : bestValue >= beta ? VALUE_TYPE_LOWER : VALUE_TYPE_EXACT;
 
-#if defined(NANOHA)
-        TT.store(pos.get_key(), pos.hand_value_of_side(), value_to_tt(bestValue, ss->ply), vt, ttDepth, move, ss->eval, evalMargin);
-#else
-        TT.store(pos.get_key(), value_to_tt(bestValue, ss->ply), vt, ttDepth, move, ss->eval, evalMargin);
-#endif
+        store_tt(pos, pos.get_key(), value_to_tt(bestValue, ss->ply), vt, ttDepth, move, ss->eval, evalMargin);
 
         assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
@@ -2101,6 +2389,64 @@ split_point_start: // At split points actual search starts from here
     }
 
 
+    // probe_tt() looks up the transposition table entry of the given key for
+    // the side to move's hand, counting the probe for CHK_PERFORM and timing
+    // it for PROFILE_SEARCH. Hand misses need a scan of the whole group, so
+    // they are counted only with TT_STATS.
+
+    const TTEntry* probe_tt(const Position& pos, Key key) {
+
+        PROFILE_SCOPE(pos.thread(), PROF_TT_PROBE);
+#if defined(NANOHA)
+        const TTEntry* tte = TT.probe(key, pos.hand_value_of_side());
+#else
+        const TTEntry* tte = TT.probe(key);
+#endif
+        PERF_COUNT(pos.thread(), PERF_TT_PROBE);
+        PERF_ADD(pos.thread(), PERF_TT_HIT, tte != NULL);
+#if defined(NANOHA) && defined(TT_STATS)
+        PERF_ADD(pos.thread(), PERF_TT_HAND_MISS, tte == NULL && TT.probe_key(key) != NULL);
+#endif
+        return tte;
+    }
+
+
+    // store_tt() writes the transposition table entry of the given key for
+    // the side to move's hand, counting for CHK_PERFORM whether it overwrote
+    // the same position or evicted another one.
+
+    void store_tt(const Position& pos, Key key, Value v, ValueType t, Depth d, Move m, Value statV, Value statM) {
+
+#if defined(NANOHA)
+        const TTStoreResult r = TT.store(key, pos.hand_value_of_side(), v, t, d, m, statV, statM);
+#else
+        const TTStoreResult r = TT.store(key, v, t, d, m, statV, statM);
+#endif
+        PERF_COUNT(pos.thread(), PERF_TT_STORE);
+        PERF_ADD(pos.thread(), PERF_TT_OVERWRITE, r == TT_STORE_OVERWRITE);
+        PERF_ADD(pos.thread(), PERF_TT_COLLISION, r == TT_STORE_COLLISION);
+        (void)r;
+    }
+
+
+#if defined(NANOHA)
+    // probe_hand_tt() looks for an entry of the same board with a dominated or
+    // dominating hand whose bound cuts off at beta, see TT.probe_dominance().
+    // Only mate scores are used in HAND_DOM_MATE mode. Returns the value of the
+    // entry or VALUE_NONE. The move of the entry is not used because it may be
+    // a drop of a piece that is not in hand.
+
+    Value probe_hand_tt(const Position& pos, Key key, Depth depth, Value beta, int ply) {
+
+        const Depth d = HandDominance == HAND_DOM_MATE ? DEPTH_DECISIVE : depth;
+        const TTEntry* tte = TT.probe_dominance(key, pos.hand_value_of_side(), d, value_to_tt(beta, ply));
+
+        PERF_ADD(pos.thread(), PERF_TT_HAND_CUT, tte != NULL);
+        return tte ? value_from_tt(tte->value(), ply) : VALUE_NONE;
+    }
+#endif
+
+
     // can_return_tt() returns true if a transposition table score
     // can be used to cut-off at a given point in search.
 
@@ -2185,17 +2531,12 @@ split_point_start: // At split points actual search starts from here
     }
 
 
-    // current_search_time() returns the number of milliseconds which have passed
+    // current_search_time() returns the number of microseconds which have passed
     // since the beginning of the current search.
 
-    int current_search_time(int set) {
+    TimePoint current_search_time() {
 
-        static int searchStartTime;
-
-        if (set)
-            searchStartTime = set;
-
-        return get_system_time() - searchStartTime;
+        return now() - SearchStartTime;
     }
 
 
@@ -2228,20 +2569,22 @@ split_point_start: // At split points actual search starts from here
     }
 
 
-    // speed_to_uci() returns a string with time stats of current search suitable
-    // to be sent to UCI gui.
+    // speed_to_uci() returns a string with time stats of current search and the
+    // sampled hashfull suitable to be sent to UCI gui.
 
     string speed_to_uci(int64_t nodes) {
 
         std::stringstream s;
-        int t = current_search_time();
+        TimePoint t = current_search_time();
+        int ms = int(t / USEC_PER_MSEC);
 
         s << " nodes " << nodes
-          << " nps "   << (t > 0 ? int(nodes * 1000 / t) : 0)
+          << " nps "   << (t > 0 ? int(nodes * 1000000 / t) : 0)
+          << " hashfull " << TT.hashfull()
 #if defined(NANOHA)
-          << " time "  << (t > 0 ? t : 1);
+          << " time "  << (ms > 0 ? ms : 1);
 #else
-          << " time "  << t;
+          << " time "  << ms;
 #endif
 
         return s.str();
@@ -2375,16 +2718,18 @@ split_point_start: // At split points actual search starts from here
 
     // poll() performs two different functions: It polls for user input, and it
     // looks at the time consumed so far and decides if it's time to abort the
-    // search.
+    // search. It is called by every thread every NodesBetweenPolls nodes, only
+    // the main thread reads input and only when there is no input thread.
 
     void poll(const Position& pos) {
 
-        static int lastInfoTime;
-        int t = current_search_time();
+        static TimePoint lastInfoTime;
+        TimePoint t = current_search_time();
 
 #if !defined(GODWHALE_SERVER) && !defined(GODWHALE_CLIENT)
-        //  Poll for input
-        if (input_available())
+        //  Poll for input. When the input thread is running, commands have
+        //  already been applied by handle_search_command().
+        if (pos.thread() == 0 && !input_thread_active() && input_available())
         {
             // We are line oriented, don't read single chars
             string command;
@@ -2420,21 +2765,26 @@ split_point_start: // At split points actual search starts from here
         }
 #endif
 
-        // Print search information
-        if (t < 1000)
-            lastInfoTime = 0;
+        // Print search information (only from the main thread)
+        if (pos.thread() == 0)
+        {
+            flush_info_output();
 
-        else if (lastInfoTime > t)
-            // HACK: Must be a new search where we searched less than
-            // NodesBetweenPolls nodes during the first second of search.
-            lastInfoTime = 0;
+            if (t < 1000 * USEC_PER_MSEC)
+                lastInfoTime = 0;
 
-        else if (t - lastInfoTime >= 1000)
-        {
-            lastInfoTime = t;
+            else if (lastInfoTime > t)
+                // HACK: Must be a new search where we searched less than
+                // NodesBetweenPolls nodes during the first second of search.
+                lastInfoTime = 0;
+
+            else if (t - lastInfoTime >= 1000 * USEC_PER_MSEC)
+            {
+                lastInfoTime = t;
 
-            dbg_print_mean();
-            dbg_print_hit_rate();
+                dbg_print_mean();
+                dbg_print_hit_rate();
+            }
         }
 
         // Should we stop the search?
@@ -2449,16 +2799,17 @@ split_point_start: // At split points actual search starts from here
                          || stillAtFirstMove;
 
 #if defined(NANOHA)
+        // 時間はどのスレッドからでも確認する. ノード数はスレッド0のものだけを見る
         if (!Limits.maxDepth && !Limits.infinite) {
             if ((   noMoreTime
-                && (!Limits.maxTime || t >= Limits.maxTime))
-                || (Limits.maxNodes && pos.nodes_searched() >= Limits.maxNodes))
+                && (!Limits.maxTime || t >= Limits.maxTime * USEC_PER_MSEC))
+                || (Limits.maxNodes && pos.thread() == 0 && pos.nodes_searched() >= Limits.maxNodes))
                 StopRequest = true;
         }
 #else
         if (   (Limits.useTimeManagement() && noMoreTime)
-            || (Limits.maxTime && t >= Limits.maxTime)
-            || (Limits.maxNodes && pos.nodes_searched() >= Limits.maxNodes)) // FIXME
+            || (Limits.maxTime && t >= Limits.maxTime * USEC_PER_MSEC)
+            || (Limits.maxNodes && pos.thread() == 0 && pos.nodes_searched() >= Limits.maxNodes)) // FIXME
             StopRequest = true;
 #endif
     }
@@ -2472,6 +2823,19 @@ split_point_start: // At split points actual search starts from here
     // after which the bestmove and pondermove will be printed.
     void wait_for_stop_or_ponderhit() {
 
+        if (input_thread_active())
+        {
+            // The input thread tells us when one of these commands arrives
+            lock_grab(&InputLock);
+            while (!PendingStop && !PendingPonderhit && !PendingQuit)
+                cond_wait(&InputCond, &InputLock);
+
+            if (PendingQuit)
+                QuitRequest = true;
+            lock_release(&InputLock);
+            return;
+        }
+
         string command;
 
         // Wait for a command from stdin
@@ -2690,6 +3054,9 @@ static bool all_slaves_finished(SplitPoint* sp) {
 
 void Thread::idle_loop(SplitPoint* sp) {
 
+    // Time spent here is idle, or split wait if we are the master of sp
+    const int prevState = set_state(sp ? THREAD_SPLIT_WAIT : THREAD_IDLE);
+
     while (true)
     {
         // If we are not searching, wait for a condition to be signaled
@@ -2704,6 +3071,7 @@ void Thread::idle_loop(SplitPoint* sp) {
             if (do_terminate)
             {
                 assert(!sp);
+                set_state(prevState);
                 return;
             }
 
@@ -2740,14 +3108,22 @@ void Thread::idle_loop(SplitPoint* sp) {
             memcpy(ss, tsp->ss - 1, 4 * sizeof(SearchStack));
             (ss+1)->sp = tsp;
 
-            if (tsp->nodeType == Root)
-                search<SplitPointRoot>(pos, ss+1, tsp->alpha, tsp->beta, tsp->depth);
-            else if (tsp->nodeType == PV)
-                search<SplitPointPV>(pos, ss+1, tsp->alpha, tsp->beta, tsp->depth);
-            else if (tsp->nodeType == NonPV)
-                search<SplitPointNonPV>(pos, ss+1, tsp->alpha, tsp->beta, tsp->depth);
-            else
-                assert(false);
+            set_state(THREAD_SEARCHING);
+
+            {
+                PROFILE_SCOPE(threadID, PROF_SEARCH);
+
+                if (tsp->nodeType == Root)
+                    search<SplitPointRoot>(pos, ss+1, tsp->alpha, tsp->beta, tsp->depth);
+                else if (tsp->nodeType == PV)
+                    search<SplitPointPV>(pos, ss+1, tsp->alpha, tsp->beta, tsp->depth);
+                else if (tsp->nodeType == NonPV)
+                    search<SplitPointNonPV>(pos, ss+1, tsp->alpha, tsp->beta, tsp->depth);
+                else
+                    assert(false);
+            }
+
+            set_state(sp ? THREAD_SPLIT_WAIT : THREAD_IDLE);
 
             assert(is_searching);
 
@@ -2769,6 +3145,7 @@ void Thread::idle_loop(SplitPoint* sp) {
             // be sure sp->lock has been released before to return.
             lock_grab(&(sp->lock));
             lock_release(&(sp->lock));
+            set_state(prevState);
             return;
         }
     }
@@ -23,6 +23,7 @@
 #define SEARCH_H_INCLUDED
 
 #include <cstring>
+#include <string>
 #include <vector>
 #include <algorithm>
 
@@ -74,9 +75,35 @@ struct SearchLimits {
     int time, increment, movesToGo, maxTime, maxDepth, maxNodes, infinite, ponder;
 };
 
+/// SearchSummary は最後の think() の結果. analyze などが USI の出力を読まずに
+/// 最善手、評価値、読み筋を使うためのもの.
+
+struct SearchSummary {
+    Move bestMove;
+    Value score;
+    int scoreCp;            // 評価値(歩 = 100). 詰みのときは 0
+    int mate;               // 詰みまでの手数(負は詰まされる). 詰みでなければ 0
+    int depth;              // 最後まで終えた反復の深さ. 定跡や宣言勝ちのときは 0
+    int64_t nodes;
+    int64_t usec;           // 探索時間(マイクロ秒)
+    Move pv[PLY_MAX_PLUS_2];    // MOVE_NONE で終わる
+};
+
+/// SearchContext は対局ごとに持ち越す探索の状態(置換表と最後の結果). 1プロセスで
+/// 複数の対局を順に指すときは、対局ごとに new_search_context() で作って think() に
+/// 渡す. 探索スレッドや USI のオプションは共有するので、think() は同時に1つしか呼べない.
+
+struct SearchContext;
+
 extern void init_search();
 extern int64_t perft(Position& pos, Depth depth);
 extern bool think(Position& pos, const SearchLimits& limits, Move searchMoves[]);
+extern bool think(SearchContext* ctx, Position& pos, const SearchLimits& limits, Move searchMoves[]);
+extern SearchContext* new_search_context();
+extern void delete_search_context(SearchContext* ctx);
+extern const SearchSummary& last_search_summary();
+extern const SearchSummary& last_search_summary(const SearchContext* ctx);
+extern bool handle_search_command(const std::string& cmd);
 
 #if defined(GODWHALE_SERVER) || defined(GODWHALE_CLIENT)
 struct SearchResult {
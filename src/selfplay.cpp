@@ -0,0 +1,743 @@
+﻿/*
+  GodWhale, a  USI shogi(japanese-chess) playing engine derived from NanohaMini
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2010 Marco Costalba, Joona Kiiski, Tord Romstad (Stockfish author)
+  Copyright (C) 2014 Kazuyuki Kawabata (NanohaMini author)
+  Copyright (C) 2015 ebifrier, espelade, kakiage
+
+  NanohaMini is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  GodWhale is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <sstream>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "book.h"
+#include "learn.h"
+#include "misc.h"
+#include "move.h"
+#include "movegen.h"
+#include "position.h"
+#include "rkiss.h"
+#include "search.h"
+#include "thread.h"
+#include "ucioption.h"
+
+using namespace std;
+
+#if defined(NANOHA)
+
+namespace {
+
+const string StartSFEN = "lnsgkgsnl/1r5b1/ppppppppp/9/9/9/PPPPPPPPP/1B5R1/LNSGKGSNL b - 1";
+
+enum GameResult { RESULT_BLACK, RESULT_WHITE, RESULT_DRAW, RESULT_NB };
+
+// 開始局面. SFEN と、そこから指す手順(定跡の手順など)
+struct Opening {
+    string sfen;
+    vector<string> moves;
+};
+
+struct SelfPlayConfig {
+    SearchLimits limits;
+    int maxPly;             // この手数で持将棋(引き分け)にする
+    bool adjudicateMate;    // 詰みを読み切った評価値で終局にする
+    int evalLimit;          // 評価値(centipawn)の絶対値がこれ以上になったら終局にする. 0 は無効
+    int randomPly;          // 開始局面から合法手をランダムに指す手数
+    string recordPrefix;    // 空でなければ1局ごとに棋譜を書き出す
+    bool csa;               // 棋譜の形式. false は KIF(UTF-8 なので拡張子は .kifu)
+};
+
+struct GameRecord {
+    vector<Move> moves;
+    vector<int> msec;
+    GameResult result;
+    string reason;
+    string kifEnd;          // KIF の終局の表記
+    string csaEnd;          // CSA の終局の表記
+};
+
+// "startpos [moves ...]"、"sfen <SFEN> [moves ...]"、SFEN のみの行を読む.
+// 空行とコメント行は false を返す
+bool parse_opening(const string& line, Opening& op) {
+    istringstream is(line);
+    string token;
+
+    if (!(is >> token) || token[0] == '#') {
+        return false;
+    }
+    if (token == "position") {
+        is >> token;
+    }
+    op.sfen.clear();
+    op.moves.clear();
+    if (token == "startpos") {
+        op.sfen = StartSFEN;
+        is >> token;    // "moves"
+    } else {
+        if (token != "sfen") {
+            op.sfen = token + " ";
+        }
+        while (is >> token && token != "moves") {
+            op.sfen += token + " ";
+        }
+    }
+    while (is >> token) {
+        op.moves.push_back(token);
+    }
+    return true;
+}
+
+// 子プロセスと共有するカウンタに加え、加える前の値を返す
+inline int64_t add_count(int64_t* count, int64_t n) {
+#if !defined(_WIN32)
+    return __sync_fetch_and_add(count, n);
+#else
+    const int64_t prev = *count;
+    *count += n;
+    return prev;
+#endif
+}
+
+// 1局指す. 先手・後手はそれぞれ別の SearchContext で探索する.
+// sfens が NULL でなければ、探索した局面(王手がかかっている局面を除く)を教師局面として加える
+GameRecord play_game(const Opening& op, const SelfPlayConfig& cfg, RKISS& rk,
+                     vector<PackedSfenValue>* sfens) {
+    GameRecord rec;
+    Position pos(op.sfen, 0);
+    list<StateInfo> states;
+
+    vector<Move> opening = move_list_from_uci(pos, op.moves.begin(), op.moves.end());
+    for (size_t i = 0; i < opening.size(); i++) {
+        states.push_back(StateInfo());
+        pos.do_move(opening[i], states.back());
+        rec.moves.push_back(opening[i]);
+        rec.msec.push_back(0);
+    }
+    for (int i = 0; i < cfg.randomPly; i++) {
+        MoveList<MV_LEGAL> ml(pos);
+        if (ml.size() == 0) {
+            break;
+        }
+        for (int n = int(rk.rand<unsigned>() % unsigned(ml.size())); n > 0; n--) {
+            ++ml;
+        }
+        const Move m = ml.move();
+        states.push_back(StateInfo());
+        pos.do_move(m, states.back());
+        rec.moves.push_back(m);
+        rec.msec.push_back(0);
+    }
+
+    SearchContext* ctx[2] = { new_search_context(), new_search_context() };
+
+    while (true) {
+        const Color us = pos.side_to_move();
+        const GameResult win  = (us == BLACK ? RESULT_BLACK : RESULT_WHITE);
+        const GameResult lose = (us == BLACK ? RESULT_WHITE : RESULT_BLACK);
+
+        if (int(rec.moves.size()) >= cfg.maxPly) {
+            rec.result = RESULT_DRAW;
+            rec.reason = "maxply";
+            rec.kifEnd = "持将棋";
+            rec.csaEnd = "%JISHOGI";
+            break;
+        }
+        if (pos.IsKachi(us)) {
+            rec.result = win;
+            rec.reason = "kachi";
+            rec.kifEnd = "入玉勝ち";
+            rec.csaEnd = "%KACHI";
+            break;
+        }
+
+        Move moves[MAX_MOVES] = { MOVE_NONE };
+        mute_output(true);
+        const bool ok = think(ctx[us], pos, cfg.limits, moves);
+        mute_output(false);
+        const SearchSummary& sum = last_search_summary(ctx[us]);
+
+        if (!ok) {
+            rec.result = RESULT_DRAW;
+            rec.reason = "aborted";
+            rec.kifEnd = "中断";
+            rec.csaEnd = "%CHUDAN";
+            break;
+        }
+        if (sfens && sum.bestMove != MOVE_NONE && !pos.in_check()) {
+            PackedSfenValue psv;
+            memset(&psv, 0, sizeof(psv));
+            pos.EncodeHuffman(psv.sfen);
+            psv.score = int16_t(sum.score);
+            psv.move = pack_move16(sum.bestMove);
+            psv.gamePly = uint16_t(rec.moves.size() + 1);
+            sfens->push_back(psv);
+        }
+        if (sum.bestMove == MOVE_NONE || (cfg.adjudicateMate && sum.mate < 0)) {
+            rec.result = lose;
+            rec.reason = (sum.bestMove == MOVE_NONE ? "resign" : "mate");
+            rec.kifEnd = "投了";
+            rec.csaEnd = "%TORYO";
+            break;
+        }
+        if (cfg.evalLimit > 0 && sum.mate == 0 && abs(sum.scoreCp) >= cfg.evalLimit) {
+            rec.result = (sum.scoreCp > 0 ? win : lose);
+            rec.reason = "eval";
+            rec.kifEnd = "投了";
+            rec.csaEnd = "%TORYO";
+            break;
+        }
+
+        states.push_back(StateInfo());
+        pos.do_move(sum.bestMove, states.back());
+        rec.moves.push_back(sum.bestMove);
+        rec.msec.push_back(int(sum.usec / USEC_PER_MSEC));
+
+        // 千日手. 連続王手の千日手は王手をかけ続けた側(us)の負け
+        int perpetualCheck = 0;
+        if (pos.is_draw(&perpetualCheck)) {
+            rec.result = RESULT_DRAW;
+            rec.reason = "repetition";
+            rec.kifEnd = "千日手";
+            rec.csaEnd = "%SENNICHITE";
+            break;
+        }
+        if (perpetualCheck) {
+            rec.result = lose;
+            rec.reason = "perpetual check";
+            rec.kifEnd = "反則勝ち";
+            rec.csaEnd = (us == BLACK ? "%+ILLEGAL_ACTION" : "%-ILLEGAL_ACTION");
+            break;
+        }
+        if (cfg.adjudicateMate && sum.mate > 0) {
+            rec.result = win;
+            rec.reason = "mate";
+            rec.kifEnd = "投了";
+            rec.csaEnd = "%TORYO";
+            break;
+        }
+    }
+
+    delete_search_context(ctx[0]);
+    delete_search_context(ctx[1]);
+
+    // 対局の結果を各局面の手番側から見た値にする
+    if (sfens) {
+        for (size_t i = 0; i < sfens->size(); i++) {
+            PackedSfenValue& psv = (*sfens)[i];
+            const GameResult win = ((psv.sfen[0] & 1) == BLACK ? RESULT_BLACK : RESULT_WHITE);
+            psv.result = int8_t(rec.result == RESULT_DRAW ? 0 : rec.result == win ? 1 : -1);
+        }
+    }
+    return rec;
+}
+
+// 結果を JSON の1行で出力し、棋譜を書き出す
+void report_game(int game, size_t opening, const Opening& op, const GameRecord& rec,
+                 const SelfPlayConfig& cfg, TimePoint time) {
+    static const char* ResultStr[] = { "black", "white", "draw" };
+    std::ostringstream s;
+
+    s << "{\"game\":" << game
+      << ",\"opening\":" << opening
+      << ",\"result\":\"" << ResultStr[rec.result] << "\""
+      << ",\"reason\":\"" << json_escape(rec.reason) << "\""
+      << ",\"plies\":" << rec.moves.size()
+      << ",\"time_ms\":" << time / USEC_PER_MSEC
+      << "}\n";
+    // PIPE_BUF 以下の1回の書き込みにして、並列に動くプロセスの出力が混ざらないようにする
+    fputs(s.str().c_str(), stdout);
+    fflush(stdout);
+
+    if (cfg.recordPrefix.empty()) {
+        return;
+    }
+    char num[16];
+    sprintf(num, "%05d", game);
+    const string file = cfg.recordPrefix + num + (cfg.csa ? ".csa" : ".kifu");
+    const string names[2] = { engine_name(), engine_name() };
+    const Position start(op.sfen, 0);
+    const int winner = (rec.result == RESULT_BLACK ? BLACK : rec.result == RESULT_WHITE ? WHITE : -1);
+
+    ofstream f(file.c_str());
+    if (!f.is_open()) {
+        cerr << "Unable to open file " << file << endl;
+        return;
+    }
+    if (cfg.csa) {
+        f << game_to_csa(start, rec.moves, rec.msec, names, rec.csaEnd);
+    } else {
+        f << game_to_kif(start, rec.moves, rec.msec, names, rec.kifEnd, winner);
+    }
+}
+
+// job 番目のプロセスが受け持つ対局(game % jobs == job)を指す
+struct SelfPlayTask {
+    int jobs;
+    int games;
+    uint64_t seed;
+    const vector<Opening>* openings;
+    const SelfPlayConfig* cfg;
+
+    void run(int job, int64_t counts[]) const {
+        RKISS rk(seed + job);
+        for (int game = job; game < games; game += jobs) {
+            const size_t opening = size_t(game) % openings->size();
+            TimePoint time = now();
+            const GameRecord rec = play_game((*openings)[opening], *cfg, rk, NULL);
+            report_game(game, opening, (*openings)[opening], rec, *cfg, now() - time);
+            add_count(&counts[rec.result], 1);
+            if (rec.reason == "aborted") {
+                break;
+            }
+        }
+    }
+};
+
+enum GenSfenCount { COUNT_POSITIONS, COUNT_GAMES, COUNT_NB };
+
+// job 番目のプロセスが教師局面を作り、<prefix>_<job>_<shard>.bin に書き出す.
+// 1局分ずつ書くので、メモリは1局分の局面しか使わない
+struct GenSfenTask {
+    int jobs;
+    int64_t positions;      // 全プロセスで作る局面数
+    int64_t shardSize;      // 1ファイルあたりの局面数
+    uint64_t seed;
+    string prefix;
+    TimePoint start;
+    const vector<Opening>* openings;
+    const SelfPlayConfig* cfg;
+
+    void run(int job, int64_t counts[]) const {
+        RKISS rk(seed + job);
+        vector<PackedSfenValue> sfens;
+        FILE* f = NULL;
+        int shard = 0;
+        int64_t inShard = 0;
+        TimePoint lastReport = start;
+
+        for (int game = job; counts[COUNT_POSITIONS] < positions; game += jobs) {
+            sfens.clear();
+            const GameRecord rec = play_game((*openings)[size_t(game) % openings->size()], *cfg, rk, &sfens);
+            if (rec.reason == "aborted") {
+                break;
+            }
+
+            // 全体で positions 局面を超えないように、書き出す分を確保する
+            const int64_t done = add_count(&counts[COUNT_POSITIONS], int64_t(sfens.size()));
+            if (done >= positions) {
+                break;
+            }
+            add_count(&counts[COUNT_GAMES], 1);
+            const size_t n = size_t(Min(int64_t(sfens.size()), positions - done));
+            for (size_t i = 0; i < n; ) {
+                if (f == NULL || inShard >= shardSize) {
+                    if (f != NULL) {
+                        fclose(f);
+                    }
+                    char name[32];
+                    sprintf(name, "_%d_%d.bin", job, shard++);
+                    const string file = prefix + name;
+                    f = fopen(file.c_str(), "wb");
+                    if (f == NULL) {
+                        cerr << "Unable to open file " << file << endl;
+                        return;
+                    }
+                    inShard = 0;
+                }
+                const size_t k = size_t(Min(int64_t(n - i), shardSize - inShard));
+                if (fwrite(&sfens[i], sizeof(PackedSfenValue), k, f) != k) {
+                    cerr << "gensfen: write error" << endl;
+                    fclose(f);
+                    return;
+                }
+                i += k;
+                inShard += k;
+            }
+
+            // 進み具合は job 0 が全体の分を表示する
+            const TimePoint t = now();
+            if (job == 0 && t - lastReport >= 10 * 1000 * USEC_PER_MSEC) {
+                const int64_t made = Min(counts[COUNT_POSITIONS], positions);
+                cerr << "gensfen: " << made << " positions, " << counts[COUNT_GAMES] << " games, "
+                     << int64_t(made * 1000000.0 / (t - start)) << " positions/sec" << endl;
+                lastReport = t;
+            }
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+    }
+};
+
+// task.run(job, counts) を jobs 個の子プロセスで分担して実行し、すべて終わるまで待つ.
+// counts[0..n-1] は子プロセスの間で共有し、終わったら書き戻す.
+// 定跡の乱数は親プロセスの状態を引き継ぐので、job ごとに task.seed + job で初期化し直す
+template <typename Task>
+void run_jobs(const char* name, int jobs, const Task& task, int64_t counts[], int n) {
+    if (jobs == 1) {
+        if (book)
+            book->reseed(task.seed);
+        task.run(0, counts);
+        return;
+    }
+#if !defined(_WIN32)
+    void* shared = mmap(NULL, n * sizeof(int64_t), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    int64_t* sharedCounts = static_cast<int64_t*>(shared);
+    memcpy(sharedCounts, counts, n * sizeof(int64_t));
+
+    fflush(stdout);
+    vector<pid_t> children;
+    for (int job = 0; job < jobs; job++) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            break;
+        }
+        if (pid == 0) {
+            // fork() で複製されるのは呼び出したスレッドだけなので、
+            // 探索スレッドを作り直す
+            Threads.init();
+            if (book)
+                book->reseed(task.seed + job);
+            task.run(job, sharedCounts);
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+        children.push_back(pid);
+    }
+    for (size_t i = 0; i < children.size(); i++) {
+        int status;
+        waitpid(children[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            cerr << name << ": job " << i << " failed" << endl;
+        }
+    }
+    memcpy(counts, sharedCounts, n * sizeof(int64_t));
+    munmap(shared, n * sizeof(int64_t));
+#endif
+}
+
+// selfplay と gensfen に共通の引数. 知らない引数なら false を返す
+bool parse_search_option(const char* opt, const char* arg, SelfPlayConfig& cfg,
+                         int& ttSize, int& threads, int& jobs) {
+    const int n = atoi(arg);
+    if (strcmp(opt, "-hash") == 0) {
+        ttSize = n;
+    } else if (strcmp(opt, "-threads") == 0) {
+        threads = n;
+    } else if (strcmp(opt, "-jobs") == 0) {
+        jobs = n;
+    } else if (strcmp(opt, "-maxply") == 0) {
+        cfg.maxPly = n;
+    } else if (strcmp(opt, "-depth") == 0) {
+        cfg.limits = SearchLimits();
+        cfg.limits.maxDepth = n;
+    } else if (strcmp(opt, "-nodes") == 0) {
+        cfg.limits = SearchLimits();
+        cfg.limits.maxNodes = n;
+    } else if (strcmp(opt, "-sec") == 0) {
+        cfg.limits = SearchLimits();
+        cfg.limits.maxTime = 1000 * n; // maxTime is in ms
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// 開始局面のファイルを読む. 空なら平手の初期局面だけにする
+vector<Opening> load_openings(const string& openingFile) {
+    vector<Opening> openings;
+    if (!openingFile.empty()) {
+        ifstream f(openingFile.c_str());
+        if (!f.is_open()) {
+            cerr << "Unable to open file " << openingFile << endl;
+            exit(EXIT_FAILURE);
+        }
+        string line;
+        Opening op;
+        while (getline(f, line)) {
+            if (parse_opening(line, op)) {
+                openings.push_back(op);
+            }
+        }
+    }
+    if (openings.empty()) {
+        Opening op;
+        op.sfen = StartSFEN;
+        openings.push_back(op);
+    }
+    return openings;
+}
+
+void setup_engine(int ttSize, int threads, bool useBook) {
+    std::ostringstream hash, th;
+    hash << ttSize;
+    th << threads;
+    Options["Hash"].set_value(hash.str());
+    Options["Threads"].set_value(th.str());
+    Options["OwnBook"].set_value(useBook ? "true" : "false");
+    if (useBook) {
+        Options["RandomBookSelect"].set_value("true");
+    }
+    Options["Ponder"].set_value("false");
+
+    // 探索中に標準入力を読まない
+    ignore_input(true);
+}
+
+}
+
+/// selfplay はエンジン同士の対局を指し、1局ごとに結果を JSON の1行で標準出力に書く.
+///
+///   selfplay [-hash N] [-threads N] [-jobs N] [-games N] [-depth N | -nodes N | -sec N]
+///            [-maxply N] [-nomate] [-book] [-seed N] [-o record prefix] [-csa] [openings file]
+///
+/// 開始局面のファイルは1行に1局面で、"startpos moves 7g7f 3c3d" のように手順も
+/// 書ける. 省略すると平手の初期局面から指す. game 局目は game % 局面数 番目の
+/// 局面から始める. 探索が決定的なときは同じ開始局面から同じ対局になるので、
+/// 開始局面を増やすか -book で定跡をランダムに選ばせる. 定跡の手と job ごとの乱数は
+/// -seed から決める. 省略すると時刻から決め、再現できるように表示する.
+///
+/// 先手・後手はそれぞれ別の SearchContext(置換表)で探索する.
+/// 探索は1プロセスで1つずつなので、-jobs N では N 個の子プロセスを fork して
+/// 対局を分担する. 評価関数の表はプロセス間で共有され(copy-on-write)、置換表は
+/// 対局の各手番ごとに -hash MB を持つ. 1手あたり -threads のスレッドで探索する.
+///
+/// 終局は投了(指し手がない)、詰みを読み切った評価値(-nomate で無効)、入玉宣言、
+/// 千日手(連続王手の千日手は王手をかけた側の負け)、-maxply 手での持将棋.
+/// -o を指定すると 1局ごとに <prefix>00000.kifu (-csa のときは .csa) を書く.
+
+void selfplay(int argc, char* argv[]) {
+    SelfPlayConfig cfg;
+    int ttSize  = 16;
+    int threads = 1;
+    int jobs    = 1;
+    int games   = 2;
+    uint64_t seed = uint64_t(now());
+    bool useBook = false;
+    string openingFile;
+
+    cfg.limits.maxDepth = 6;
+    cfg.maxPly = 256;
+    cfg.adjudicateMate = true;
+    cfg.evalLimit = 0;
+    cfg.randomPly = 0;
+    cfg.csa = false;
+
+    while (--argc) {
+        argv++;
+        if (argv[0][0] != '-') {
+            openingFile = argv[0];
+            break;
+        }
+        if (strcmp(*argv, "-nomate") == 0) {
+            cfg.adjudicateMate = false;
+            continue;
+        } else if (strcmp(*argv, "-book") == 0) {
+            useBook = true;
+            continue;
+        } else if (strcmp(*argv, "-csa") == 0) {
+            cfg.csa = true;
+            continue;
+        }
+        if (argc < 2) {
+            cerr << "Error!:argv = " << *argv << endl;
+            exit(EXIT_FAILURE);
+        }
+        argc--;
+        if (strcmp(*argv, "-games") == 0) {
+            games = atoi(argv[1]);
+        } else if (strcmp(*argv, "-seed") == 0) {
+            seed = strtoull(argv[1], NULL, 10);
+        } else if (strcmp(*argv, "-o") == 0) {
+            cfg.recordPrefix = argv[1];
+        } else if (!parse_search_option(argv[0], argv[1], cfg, ttSize, threads, jobs)) {
+            cerr << "Error!:argv = " << *argv << endl;
+            exit(EXIT_FAILURE);
+        }
+        argv++;
+    }
+    if (threads < 1 || threads > MAX_THREADS || jobs < 1 || games < 1 || ttSize < 1 || cfg.maxPly < 1) {
+        cerr << "Error!:threads = " << threads << ", jobs = " << jobs << ", games = " << games
+             << ", hash = " << ttSize << ", maxply = " << cfg.maxPly << endl;
+        exit(EXIT_FAILURE);
+    }
+#if defined(_WIN32)
+    if (jobs > 1) {
+        cerr << "selfplay: -jobs is not supported on Windows, using 1" << endl;
+        jobs = 1;
+    }
+#endif
+    jobs = Min(jobs, games);
+
+    const vector<Opening> openings = load_openings(openingFile);
+    setup_engine(ttSize, threads, useBook);
+
+    cerr << "selfplay: seed " << seed << endl;
+
+    SelfPlayTask task;
+    task.jobs = jobs;
+    task.games = games;
+    task.seed = seed;
+    task.openings = &openings;
+    task.cfg = &cfg;
+
+    int64_t counts[RESULT_NB] = { 0, 0, 0 };
+    TimePoint time = now();
+    run_jobs("selfplay", jobs, task, counts, RESULT_NB);
+
+    time = now() - time;
+    const int64_t played = counts[RESULT_BLACK] + counts[RESULT_WHITE] + counts[RESULT_DRAW];
+    cerr << "selfplay: " << played << " games, black " << counts[RESULT_BLACK]
+         << " white " << counts[RESULT_WHITE] << " draw " << counts[RESULT_DRAW]
+         << ", " << jobs << " jobs, " << to_msec(time) << " ms, "
+         << (time > 0 ? int64_t(played * 3600.0 * 1000000 / time) : 0) << " games/hour" << endl;
+}
+
+/// gensfen は評価関数の学習に使う教師局面を作る.
+///
+///   gensfen [-hash N] [-threads N] [-jobs N] [-depth N | -nodes N | -sec N] [-positions N]
+///           [-random N] [-evallimit N] [-maxply N] [-shard N] [-seed N] [-o prefix] [openings file]
+///
+/// selfplay と同じように開始局面(省略時は平手)から対局する. 開始局面から -random 手(既定 8)は
+/// 合法手をランダムに選んで指し、そこからは浅い探索(既定 -depth 6)の最善手で指し進める.
+/// 探索した局面のうち王手のかかっていない局面を、評価値・最善手・手数・対局の結果とともに
+/// PackedSfenValue(learn.h)として記録する. 評価値が -evallimit(centipawn、既定 3000)を
+/// 超えたところで、その側の勝ちとして終局する.
+///
+/// 書き出すのは全体で -positions 局面(既定 100000)で、-jobs のプロセスがそれぞれ
+/// <prefix>_<job>_<shard>.bin (既定の prefix は gensfen) に -shard 局面(既定 1000000)ずつ
+/// 分けて書く. -seed を省略すると時刻から決め、再現できるように表示する.
+/// 局面の符号は玉以外の38枚がそろっていることを前提にするので、駒落ちなどの開始局面は使えない.
+
+void gensfen(int argc, char* argv[]) {
+    SelfPlayConfig cfg;
+    int ttSize  = 16;
+    int threads = 1;
+    int jobs    = 1;
+    int64_t positions = 100000;
+    int64_t shardSize = 1000000;
+    uint64_t seed = uint64_t(now());
+    string prefix = "gensfen";
+    string openingFile;
+
+    cfg.limits.maxDepth = 6;
+    cfg.maxPly = 256;
+    cfg.adjudicateMate = true;
+    cfg.evalLimit = 3000;
+    cfg.randomPly = 8;
+    cfg.csa = false;
+
+    while (--argc) {
+        argv++;
+        if (argv[0][0] != '-') {
+            openingFile = argv[0];
+            break;
+        }
+        if (argc < 2) {
+            cerr << "Error!:argv = " << *argv << endl;
+            exit(EXIT_FAILURE);
+        }
+        argc--;
+        if (strcmp(*argv, "-positions") == 0) {
+            positions = atoll(argv[1]);
+        } else if (strcmp(*argv, "-random") == 0) {
+            cfg.randomPly = atoi(argv[1]);
+        } else if (strcmp(*argv, "-evallimit") == 0) {
+            cfg.evalLimit = atoi(argv[1]);
+        } else if (strcmp(*argv, "-shard") == 0) {
+            shardSize = atoll(argv[1]);
+        } else if (strcmp(*argv, "-seed") == 0) {
+            seed = strtoull(argv[1], NULL, 10);
+        } else if (strcmp(*argv, "-o") == 0) {
+            prefix = argv[1];
+        } else if (!parse_search_option(argv[0], argv[1], cfg, ttSize, threads, jobs)) {
+            cerr << "Error!:argv = " << *argv << endl;
+            exit(EXIT_FAILURE);
+        }
+        argv++;
+    }
+    if (threads < 1 || threads > MAX_THREADS || jobs < 1 || positions < 1 || shardSize < 1
+        || ttSize < 1 || cfg.maxPly < 1 || cfg.randomPly < 0) {
+        cerr << "Error!:threads = " << threads << ", jobs = " << jobs << ", positions = " << positions
+             << ", shard = " << shardSize << ", hash = " << ttSize << ", maxply = " << cfg.maxPly
+             << ", random = " << cfg.randomPly << endl;
+        exit(EXIT_FAILURE);
+    }
+#if defined(_WIN32)
+    if (jobs > 1) {
+        cerr << "gensfen: -jobs is not supported on Windows, using 1" << endl;
+        jobs = 1;
+    }
+#endif
+
+    // 符号化して元に戻せない開始局面(駒が38枚そろっていない)を除く
+    vector<Opening> openings = load_openings(openingFile);
+    for (size_t i = 0; i < openings.size(); ) {
+        const Position pos(openings[i].sfen, 0);
+        unsigned char buf[32];
+        string sfen;
+        if (pos.EncodeHuffman(buf) > 0 && Position::DecodeHuffman(buf, sfen) && Position(sfen, 0) == pos) {
+            i++;
+            continue;
+        }
+        cerr << "gensfen: skipped opening " << openings[i].sfen << endl;
+        openings.erase(openings.begin() + i);
+    }
+    if (openings.empty()) {
+        exit(EXIT_FAILURE);
+    }
+    setup_engine(ttSize, threads, false);
+
+    cerr << "gensfen: seed " << seed << endl;
+
+    GenSfenTask task;
+    task.jobs = jobs;
+    task.positions = positions;
+    task.shardSize = shardSize;
+    task.seed = seed;
+    task.prefix = prefix;
+    task.start = now();
+    task.openings = &openings;
+    task.cfg = &cfg;
+
+    int64_t counts[COUNT_NB] = { 0, 0 };
+    run_jobs("gensfen", jobs, task, counts, COUNT_NB);
+
+    const TimePoint time = now() - task.start;
+    const int64_t made = Min(counts[COUNT_POSITIONS], positions);
+    cerr << "gensfen: " << made << " positions, " << counts[COUNT_GAMES] << " games, "
+         << jobs << " jobs, " << to_msec(time) << " ms, "
+         << (time > 0 ? int64_t(made * 1000000.0 / time) : 0) << " positions/sec" << endl;
+}
+
+#endif
@@ -23,8 +23,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
+#include <cstddef>
 #include <cstring>
 #include <cassert>
+#include "perform.h"
 #include "position.h"
 #include "tt.h"
 #include "book.h"
@@ -183,6 +185,17 @@ namespace NanohaTbl {
         EMP, GFU, GKY, GKE, GGI, GKI, GKA, GHI,
         GOU, GKI, GKI, GKI, GKI, EMP, GUM, GRY,
     };
+    // 指し手のビット16～21(成フラグと動かす駒)から直接引く. 成る手は成った後の駒になる
+    const int MovePiece2Index[64] = {
+        EMP, SOU, SFU, SKI, SKY, SKI, SKE, SKI,
+        SGI, SKI, SKI, EMP, SKA, SUM, SHI, SRY,
+        SOU, SOU, SKI, SKI, SKI, SKI, SKI, SKI,
+        SKI, SKI, EMP, EMP, SUM, SUM, SRY, SRY,
+        EMP, GOU, GFU, GKI, GKY, GKI, GKE, GKI,
+        GGI, GKI, GKI, EMP, GKA, GUM, GHI, GRY,
+        GOU, GOU, GKI, GKI, GKI, GKI, GKI, GKI,
+        GKI, GKI, EMP, EMP, GUM, GUM, GRY, GRY,
+    };
 }
 
 static FILE *fp_info = stdout;
@@ -222,6 +235,7 @@ int foutput_log(FILE *fp, const char *fmt, ...)
 // 実行ファイル起動時に行う初期化.
 void init_application_once()
 {
+    init_bitboards();             // ビットボードの表の初期化
     Position::init_evaluate();    // 評価ベクトルの読み込み
     Position::initMate1ply();
 
@@ -393,6 +407,13 @@ void Position::init_position(const unsigned char board_ori[9][9], const int Moch
 #undef KNABORT
 #undef KNHANDSET
 
+    // ビットボードの初期化
+    memset(byPieceBB, 0, sizeof(byPieceBB));
+    memset(byColorBB, 0, sizeof(byColorBB));
+    for (z = 0x11; z <= 0x99; z++) {
+        if (ban[z] != EMP && ban[z] != WALL) xor_bb(ban[z], z);
+    }
+
     // effectB/effectWの初期化
     init_effect();
 
@@ -783,6 +804,7 @@ void Position::del_effect(const int z, const Piece kind)
 
 void Position::do_move(Move m, StateInfo& newSt)
 {
+    PROFILE_SCOPE(threadID, PROF_DO_MOVE);
     assert(is_ok());
     assert(&newSt != st);
     assert(!at_checking());
@@ -797,31 +819,11 @@ void Position::do_move(Move m, StateInfo& newSt)
     // Copy some fields of old state to our new StateInfo object except the
     // ones which are recalculated from scratch anyway, then switch our state
     // pointer to point to the new, ready to be updated, state.
-    /// ※ position.cpp の struct StateInfo と定義を合わせる
-    struct ReducedStateInfo {
-        int gamePly;
-        int pliesFromNull;
-        Piece captured;
-        uint32_t hand;
-        uint32_t effect;
-        Key key;
-        PieceNumber kncap;  // 捕った持駒の駒番号
-
-#if defined(MAKELIST_DIFF)
-        Piece cap_hand;     // 捕獲した持駒のPiece
-        Piece drop_hand;    // 打った持駒のPiece
-        PieceNumber kndrop; // 打った持駒の駒番号
-        int oldcap[2];      // 捕獲される駒のlist
-        int oldlist[2];     // 動かす駒,打つ持駒のlist
-#endif
-#if defined(EVAL_DIFF)
-        int newcap[2];      // for cap
-        int newlist[2];     // for drop, slide
-        int changeType;     // changetype king=0, drop&nocap=1, cap=2 
-#endif
-    };
-
-    memcpy(&newSt, st, sizeof(ReducedStateInfo));
+    // 引き継ぐのは key より前のメンバだけ. メンバを追加したときはここで検出する
+    static_assert(offsetof(StateInfo, key) == offsetof(StateInfo, pliesFromNull) + sizeof(int)
+               && offsetof(StateInfo, pliesFromNull) == offsetof(StateInfo, gamePly) + sizeof(int),
+                  "StateInfo: only gamePly and pliesFromNull may precede key");
+    memcpy(&newSt, st, offsetof(StateInfo, key));
 
     newSt.previous = st;
     st = &newSt;
@@ -862,6 +864,9 @@ void Position::do_move(Move m, StateInfo& newSt)
     assert(color_of(piece_on(from)) == us);
     assert(color_of(piece_on(to)) == flip(us) || square_is_empty(to));
 
+    // ここから最後までを利きとピン情報の更新として測る. 盤面とハッシュの更新も間に少し入る
+    PROFILE_SCOPE(threadID, PROF_EFFECT);
+
     // ピン情報のクリア
     if (piece == SOU) {
         // 先手玉を動かす
@@ -1001,7 +1006,12 @@ void Position::do_move(Move m, StateInfo& newSt)
     key ^= zobrist[ban[from]][from] ^ zobrist[piece][to];
 
     // Prefetch TT access as soon as we know key is updated
-    prefetch(reinterpret_cast<char*>(TT.first_entry(key)));
+    prefetch(reinterpret_cast<char*>(TT.first_entry(key, hand[flip(sideToMove)].h)));
+
+    // ビットボード更新
+    if (capture) xor_bb(capture, to);
+    xor_bb(ban[from], from);
+    xor_bb(piece, to);
 
     // Move the piece
     ban[to]   = piece;
@@ -1131,6 +1141,8 @@ void Position::do_drop(Move m)
     unsigned long id;
     unsigned long tkiki;
 
+    PROFILE_SCOPE(threadID, PROF_EFFECT);
+
     // ピン情報のクリア
     if (EFFECT_KING_S(to)/* && EFFECT_KING_S(to) == ((effectW[to] & EFFECT_LONG_MASK) >> EFFECT_LONG_SHIFT)*/) {
         _BitScanForward(&id, EFFECT_KING_S(to));
@@ -1270,6 +1282,7 @@ void Position::do_drop(Move m)
     knpos[kn] = to;
     ban[to] = piece;
     komano[to] = kn;
+    xor_bb(piece, to);
 
     // 利きを更新
     add_effect(to);
@@ -1291,7 +1304,7 @@ void Position::do_drop(Move m)
     st->key ^= zobrist[piece][to];
 
     // Prefetch TT access as soon as we know key is updated
-    prefetch(reinterpret_cast<char*>(TT.first_entry(st->key)));
+    prefetch(reinterpret_cast<char*>(TT.first_entry(st->key, hand[flip(sideToMove)].h)));
 
     // Finish
     sideToMove = flip(sideToMove);
@@ -1303,6 +1316,7 @@ void Position::do_drop(Move m)
 /// be restored to exactly the same state as before the move was made.
 
 void Position::undo_move(Move m) {
+    PROFILE_SCOPE(threadID, PROF_UNDO_MOVE);
 
 #if defined(EVAL_DIFF)
     st->changeType = INT_MAX;
@@ -1341,6 +1355,8 @@ void Position::undo_move(Move m) {
     assert(square_is_empty(from));
     assert(color_of(piece_on(to)) == us);
 
+    PROFILE_SCOPE(threadID, PROF_EFFECT);
+
     // ピン情報のクリア
     if (piece == SOU) {
         DelPinInfS(DIR_UP);
@@ -1428,6 +1444,10 @@ void Position::undo_move(Move m) {
     knkind[kn] = piece;
     knpos[kn] = from;
 
+    xor_bb(ban[to], to);
+    xor_bb(piece, from);
+    if (captured) xor_bb(captured, to);
+
     ban[to] = captured;
     komano[from] = komano[to];
     ban[from] = piece;
@@ -1577,6 +1597,8 @@ void Position::undo_drop(Move m)
 
     assert(color_of(piece_on(to)) == us);
 
+    PROFILE_SCOPE(threadID, PROF_EFFECT);
+
     // 移動元、移動先が玉の延長線上にあったときにそこのピン情報を削除する
     if (EFFECT_KING_S(to)) {
         _BitScanForward(&id, EFFECT_KING_S(to));
@@ -1622,6 +1644,7 @@ void Position::undo_drop(Move m)
     knpos[kn] = (us == BLACK) ? 1 : 2;
     ban[to] = EMP;
     komano[to] = PIECENUMBER_NONE;
+    xor_bb(piece, to);
     del_effect(to, piece);  // 動かした駒の利きを消す
 
 #if defined(MAKELIST_DIFF)
@@ -2296,6 +2319,28 @@ int set_bit(const int start_bit, const int bits, const int data, unsigned char b
     }
     return start_bit + bits;
 }
+
+// buf[] の bit ビット目を取り出す
+inline int get_bit(const int bit, const unsigned char buf[])
+{
+    return (buf[bit / 8] >> (bit % 8)) & 1;
+}
+
+// start_bit から1ビットずつ読み、表の符号と一致した駒を返す(set_bit() の逆).
+// 一致する駒がないときやバッファの終わりを越えたときは -1 を返す
+template <typename T>
+int get_code(int& start_bit, const T tbl[], const unsigned char buf[], const int size)
+{
+    int code = 0;
+    for (int bits = 1; bits <= 8; bits++) {
+        if (start_bit >= 8*size) return -1;
+        code |= get_bit(start_bit++, buf) << (bits - 1);
+        for (int piece = EMP; piece <= GRY; piece++) {
+            if (tbl[piece].bits == bits && tbl[piece].code == code) return piece;
+        }
+    }
+    return -1;
+}
 }
 
 // 機能：局面をハフマン符号化する(定跡ルーチン用)
@@ -2383,4 +2428,109 @@ int Position::EncodeHuffman(unsigned char buf[32]) const
     return start_bit;
 }
 
+// 機能：EncodeHuffman() で符号化した局面を SFEN 文字列に戻す(教師局面の読み込み用)
+//
+// 持駒の終わりは記録されないので、玉以外の38枚がすべて盤上か持駒にある局面に限る.
+// 手数は記録されないので 1 とする.
+//
+// 戻り値
+//   true：成功
+//   false：符号が不正
+//
+bool Position::DecodeHuffman(const unsigned char buf[32], std::string& sfen)
+{
+    static const char* const PieceStr[] = {
+        "", "P", "L", "N", "S", "G", "B", "R", "K", "+P", "+L", "+N", "+S", "", "+B", "+R",
+        "", "p", "l", "n", "s", "g", "b", "r", "k", "+p", "+l", "+n", "+s", "", "+b", "+r",
+    };
+    static const int MaxPieces[] = { 0, 18, 4, 4, 4, 4, 2, 2 };    // [駒の種類(成駒は生駒)]
+    static const int HandOrder[] = { HI, KA, KI, GI, KE, KY, FU };
+    const int size = 32;    // buf[] のサイズ
+
+    int board[10][10];      // [筋][段]
+    int hand[2][8];         // [先手/後手][駒の種類]
+    int count[8];           // [駒の種類] 盤上と持駒の枚数
+    memset(board, 0, sizeof(board));
+    memset(hand, 0, sizeof(hand));
+    memset(count, 0, sizeof(count));
+
+    int start_bit = 0;
+    const int color = get_bit(start_bit++, buf);
+    int KingS = 0, KingG = 0;
+    for (int i = 0; i < 7; i++) KingS |= get_bit(start_bit++, buf) << i;
+    for (int i = 0; i < 7; i++) KingG |= get_bit(start_bit++, buf) << i;
+    if (KingS < 1 || KingS > 81 || KingG < 1 || KingG > 81 || KingS == KingG) {
+        return false;
+    }
+    board[(KingS-1)/9+1][(KingS-1)%9+1] = SOU;
+    board[(KingG-1)/9+1][(KingG-1)%9+1] = GOU;
+
+    // 盤上
+    int total = 0;
+    for (int suji = 1; suji <= 9; suji++) {
+        for (int dan = 1; dan <= 9; dan++) {
+            if (board[suji][dan] != EMP) {
+                // 玉は別途
+                continue;
+            }
+            const int piece = get_code(start_bit, HB_tbl, buf, size);
+            if (piece < 0) return false;
+            board[suji][dan] = piece;
+            if (piece != EMP) {
+                count[piece & NAMAMASK]++;
+                total++;
+            }
+        }
+    }
+
+    // 持駒. 38枚になるまで読む
+    while (total < 38) {
+        const int piece = get_code(start_bit, HH_tbl, buf, size);
+        if (piece <= EMP) return false;
+        hand[(piece & GOTE) ? 1 : 0][piece & NAMAMASK]++;
+        count[piece & NAMAMASK]++;
+        total++;
+    }
+    for (int kind = FU; kind <= HI; kind++) {
+        if (count[kind] > MaxPieces[kind]) return false;
+    }
+
+    // SFEN にする
+    sfen.clear();
+    for (int dan = 1; dan <= 9; dan++) {
+        int empty = 0;
+        for (int suji = 9; suji >= 1; suji--) {
+            const int piece = board[suji][dan];
+            if (piece == EMP) {
+                empty++;
+                continue;
+            }
+            if (empty > 0) sfen += char('0' + empty);
+            empty = 0;
+            sfen += PieceStr[piece];
+        }
+        if (empty > 0) sfen += char('0' + empty);
+        if (dan < 9) sfen += '/';
+    }
+    sfen += (color == BLACK ? " b " : " w ");
+    bool hasHand = false;
+    for (int sg = 0; sg < 2; sg++) {
+        for (int i = 0; i < 7; i++) {
+            const int kind = HandOrder[i];
+            const int n = hand[sg][kind];
+            if (n == 0) continue;
+            if (n > 1) {
+                char num[12];
+                snprintf(num, sizeof(num), "%d", n);
+                sfen += num;
+            }
+            sfen += PieceStr[kind | (sg ? GOTE : SENTE)];
+            hasHand = true;
+        }
+    }
+    if (!hasHand) sfen += '-';
+    sfen += " 1";
+    return true;
+}
+
 
@@ -0,0 +1,135 @@
+#if defined(USE_GTEST)
+#include <gtest/gtest.h>
+
+#include "../position.h"
+#include "../movegen.h"
+#include "../rkiss.h"
+
+#define SQ make_square
+
+using namespace std;
+
+namespace test {
+
+// 盤上の駒とビットボードが一致しているか確認します。
+static void check_bitboard(const Position& pos)
+{
+    for (int f = 1; f <= 9; f++) {
+        for (int r = 1; r <= 9; r++) {
+            const Square s = SQ(f, r);
+            const Piece p = pos.piece_on(s);
+            const int sq = conv_z2bb(s);
+            ASSERT_EQ(p == EMP, pos.empty_squares().test(sq));
+            if (p != EMP) {
+                ASSERT_TRUE(pos.pieces(p).test(sq));
+                ASSERT_TRUE(pos.pieces(color_of(p)).test(sq));
+            }
+        }
+    }
+}
+
+///
+/// @brief 座標変換とビット番号の順序を確認します。
+///
+TEST (BitboardTest, square_index_test)
+{
+    for (int i = 0; i < 81; i++) {
+        ASSERT_EQ(i, conv_z2bb(conv_bb2z(i)));
+    }
+    ASSERT_EQ(0,  conv_z2bb(SQ(1,1)));
+    ASSERT_EQ(8,  conv_z2bb(SQ(1,9)));
+    ASSERT_EQ(80, conv_z2bb(SQ(9,9)));
+    ASSERT_EQ(81, AllBB.count());
+    ASSERT_EQ(0,  (~AllBB).count());
+}
+
+///
+/// @brief 飛・角・香の利きを盤面の走査と比較します。
+///
+TEST (BitboardTest, slider_attack_test)
+{
+    static const int dirHI[] = {DIR_UP, DIR_DOWN, DIR_RIGHT, DIR_LEFT};
+    static const int dirKA[] = {DIR_UR, DIR_UL, DIR_DR, DIR_DL};
+    RKISS rk;
+
+    for (int n = 0; n < 2000; n++) {
+        Bitboard occ = make_bitboard(rk.rand<uint64_t>() & rk.rand<uint64_t>() & BB_MASK0,
+                                     rk.rand<uint64_t>() & rk.rand<uint64_t>() & BB_MASK1);
+        for (int sq = 0; sq < 81; sq++) {
+            Bitboard hi = make_bitboard(0, 0), ka = make_bitboard(0, 0), ky = make_bitboard(0, 0);
+            for (int d = 0; d < 4; d++) {
+                for (int z = conv_bb2z(sq) + dirHI[d]; square_is_ok(Square(z)) && (z & 0x0F) >= 1 && (z & 0x0F) <= 9; z += dirHI[d]) {
+                    hi.set(conv_z2bb(z));
+                    if (d == 0) ky.set(conv_z2bb(z));
+                    if (occ.test(conv_z2bb(z))) break;
+                }
+                for (int z = conv_bb2z(sq) + dirKA[d]; square_is_ok(Square(z)) && (z & 0x0F) >= 1 && (z & 0x0F) <= 9; z += dirKA[d]) {
+                    ka.set(conv_z2bb(z));
+                    if (occ.test(conv_z2bb(z))) break;
+                }
+            }
+            ASSERT_EQ(hi, rook_attack(sq, occ));
+            ASSERT_EQ(ka, bishop_attack(sq, occ));
+            ASSERT_EQ(ky, lance_attack(BLACK, sq, occ));
+        }
+    }
+}
+
+///
+/// @brief 指し手を進めて戻したときにビットボードが盤面と一致しているか確認します。
+///
+TEST (BitboardTest, do_undo_move_test)
+{
+    Position pos("l6nl/5+P1gk/2np1S3/p1p4Pp/3P2Sp1/1PPb2P1P/P5GS1/R8/LN4bKL w RGgsn5p 1", 0);
+    MoveStack mlist[MAX_MOVES];
+    StateInfo st;
+
+    check_bitboard(pos);
+    MoveStack* last = generate<MV_LEGAL>(pos, mlist);
+    for (MoveStack* cur = mlist; cur != last; cur++) {
+        pos.do_move(cur->move, st);
+        check_bitboard(pos);
+        pos.undo_move(cur->move);
+        check_bitboard(pos);
+    }
+}
+
+///
+/// @brief 二歩と行きどころのない駒を打つ手が生成されないことを確認します。
+///
+TEST (BitboardTest, drop_test)
+{
+    Position pos("4k4/9/9/9/9/9/P8/9/4K4 b PLN 1", 0);
+    MoveStack mlist[MAX_MOVES];
+    int fu = 0, ky = 0, ke = 0;
+
+    MoveStack* last = generate<MV_LEGAL>(pos, mlist);
+    for (MoveStack* cur = mlist; cur != last; cur++) {
+        if (!move_is_drop(cur->move)) continue;
+        const Square to = move_to(cur->move);
+        switch (type_of(move_piece(cur->move))) {
+        case FU:
+            ASSERT_NE(FILE_9, file_of(to));
+            ASSERT_NE(RANK_1, rank_of(to));
+            fu++;
+            break;
+        case KY:
+            ASSERT_NE(RANK_1, rank_of(to));
+            ky++;
+            break;
+        case KE:
+            ASSERT_GT(rank_of(to), RANK_2);
+            ke++;
+            break;
+        default:
+            break;
+        }
+    }
+    // 歩は1～8筋の2～9段目から玉の位置を除く
+    ASSERT_EQ(8 * 8 - 1, fu);
+    ASSERT_EQ(9 * 8 - 2, ky);
+    ASSERT_EQ(9 * 7 - 2, ke);
+}
+
+}
+#endif
@@ -0,0 +1,55 @@
+﻿#if defined(USE_GTEST)
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../evalfile.h"
+
+using namespace std;
+
+namespace test {
+
+///
+/// @brief 可変長の符号化で値が元に戻り、短い値ほど短く書かれるか確認します。
+///
+TEST (EvalFileTest, varint_round_trip_test)
+{
+    static const int32_t values[] = {
+        0, 1, -1, 63, -64, 64, -65, 8191, -8192, 32767, -32768, 1 << 19, -(1 << 19), INT32_MAX, INT32_MIN
+    };
+    const int count = sizeof(values) / sizeof(values[0]);
+    vector<unsigned char> buf(count * 5);
+    size_t n = 0;
+    for (int i = 0; i < count; i++) {
+        n += put_varint(&buf[n], values[i]);
+    }
+    ASSERT_EQ(size_t(1 + 1 + 1 + 1 + 1 + 2 + 2 + 2 + 2 + 3 + 3 + 3 + 3 + 5 + 5), n);
+
+    const unsigned char* p = &buf[0];
+    for (int i = 0; i < count; i++) {
+        int32_t v = 0;
+        p = get_varint(p, &buf[n], v);
+        ASSERT_TRUE(p != NULL);
+        ASSERT_EQ(values[i], v);
+    }
+    ASSERT_EQ(&buf[n], p);
+
+    // 途中で切れているときは読まない
+    int32_t v;
+    ASSERT_TRUE(get_varint(&buf[0], &buf[0], v) == NULL);
+    ASSERT_TRUE(get_varint(&buf[n - 1], &buf[n - 1] + 1, v) != NULL);
+    ASSERT_TRUE(get_varint(&buf[n - 5], &buf[n - 1], v) == NULL);
+}
+
+///
+/// @brief FNV-1a が既知の値と一致し、分けて計算しても同じになるか確認します。
+///
+TEST (EvalFileTest, fnv1a_test)
+{
+    ASSERT_EQ(0xcbf29ce484222325ULL, fnv1a("", 0));
+    ASSERT_EQ(0xaf63dc4c8601ec8cULL, fnv1a("a", 1));
+    ASSERT_EQ(0x85944171f73967e8ULL, fnv1a("foobar", 6));
+    ASSERT_EQ(fnv1a("foobar", 6), fnv1a("bar", 3, fnv1a("foo", 3)));
+}
+
+}
+#endif
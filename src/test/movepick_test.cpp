@@ -0,0 +1,101 @@
+#if defined(USE_GTEST)
+#include <algorithm>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../position.h"
+#include "../movegen.h"
+#include "../movepick.h"
+#include "../rkiss.h"
+#include "../search.h"
+
+using namespace std;
+
+namespace test {
+
+static const string GENMOVE_SFEN = "l6nl/5+P1gk/2np1S3/p1p4Pp/3P2Sp1/1PPb2P1P/P5GS1/R8/LN4bKL w RGgsn5p 1";
+
+static vector<Move> to_vector(const MoveStack* first, const MoveStack* last) {
+    vector<Move> v;
+    for (; first != last; first++) {
+        v.push_back(first->move);
+    }
+    return v;
+}
+
+///
+/// @brief 取らない手が盤上の駒を動かす手と駒を打つ手に分けて生成できるか確認します。
+///
+TEST (MovePickTest, generate_split_test)
+{
+    Position pos(GENMOVE_SFEN, 0);
+    MoveStack all[MAX_MOVES], split[MAX_MOVES];
+
+    MoveStack* lastAll = generate<MV_NON_CAPTURE>(pos, all);
+    MoveStack* lastBoard = generate<MV_BOARD_NON_CAPTURE>(pos, split);
+    MoveStack* lastDrop = generate<MV_DROP>(pos, lastBoard);
+
+    for (MoveStack* cur = split; cur != lastBoard; cur++) {
+        ASSERT_FALSE(move_is_drop(cur->move));
+    }
+    for (MoveStack* cur = lastBoard; cur != lastDrop; cur++) {
+        ASSERT_TRUE(move_is_drop(cur->move));
+    }
+    ASSERT_EQ(to_vector(all, lastAll), to_vector(split, lastDrop));
+}
+
+///
+/// @brief MovePickerがすべての手を一度ずつ、historyの大きい順に返すか確認します。
+///
+TEST (MovePickTest, pick_order_test)
+{
+    Position pos(GENMOVE_SFEN, 0);
+    MoveStack mlist[MAX_MOVES];
+    History H;
+    SearchStack ss[1];
+    RKISS rk;
+
+    // 取らない手にばらばらのhistoryを付ける
+    H.clear();
+    MoveStack* last = generate<MV_NON_CAPTURE>(pos, mlist);
+    for (MoveStack* cur = mlist; cur != last; cur++) {
+        const Move m = cur->move;
+        const Piece piece = is_promotion(m) ? Piece(move_piece(m) | PROMOTED) : move_piece(m);
+        H.update(piece, move_to(m), Value(int(rk.rand<unsigned>() % 401) - 200));
+    }
+    vector<Move> expected = to_vector(mlist, last);
+    last = generate<MV_CAPTURE>(pos, mlist);
+    vector<Move> captures = to_vector(mlist, last);
+    expected.insert(expected.end(), captures.begin(), captures.end());
+
+    memset(ss, 0, sizeof(ss));
+    ss->eval = VALUE_NONE;
+    MovePicker mp(pos, MOVE_NONE, Depth(10 * ONE_PLY), H, ss, VALUE_INFINITE);
+
+    vector<Move> picked;
+    Value prev = VALUE_INFINITE;
+    bool positive = true;
+    Move m;
+    while ((m = mp.get_next_move()) != MOVE_NONE) {
+        picked.push_back(m);
+        if (find(captures.begin(), captures.end(), m) != captures.end()) continue;
+
+        // historyがプラスの手、プラスでない手の順に、それぞれ大きい順に返す
+        const Piece piece = is_promotion(m) ? Piece(move_piece(m) | PROMOTED) : move_piece(m);
+        const Value v = H.value(piece, move_to(m));
+        if (positive && v <= 0) {
+            positive = false;
+            prev = VALUE_INFINITE;
+        }
+        ASSERT_EQ(positive, v > 0);
+        ASSERT_LE(v, prev);
+        prev = v;
+    }
+
+    sort(picked.begin(), picked.end());
+    sort(expected.begin(), expected.end());
+    ASSERT_EQ(expected, picked);
+}
+
+}
+#endif
@@ -4,6 +4,8 @@
 #include <gtest/gtest.h>
 
 #include "../position.h"
+#include "../learn.h"
+#include "../rkiss.h"
 
 #define SQ make_square
 
@@ -183,5 +185,43 @@ TEST (SFENTest, complex_test)
         "6b5b 6c5b 5a5b P*5c S*5f L*8f 8i7i B*4f P*5g P*8g 5f4e");
 }
 
+///
+/// @brief Huffman符号の局面と16ビットの指し手が元に戻るか確認します。
+///
+TEST (SFENTest, huffman_round_trip_test)
+{
+    std::list<StateInfo> stList;
+    Position position(INITIAL_SFEN, 0);
+    RKISS rk;
+
+    for (int ply = 0; ply < 300; ++ply) {
+        unsigned char buf[32];
+        string sfen;
+        ASSERT_LT(0, position.EncodeHuffman(buf));
+        ASSERT_TRUE(Position::DecodeHuffman(buf, sfen));
+        ASSERT_EQ(position, Position(sfen, 0));
+
+        MoveStack mlist[MAX_MOVES];
+        MoveStack* last = generate<MV_LEGAL>(position, mlist);
+        if (last == mlist) {
+            break;
+        }
+        for (MoveStack* cur = mlist; cur != last; cur++) {
+            ASSERT_EQ(cur->move, unpack_move16(position, pack_move16(cur->move)));
+        }
+
+        // 取る手を多めに選んで、持駒の多い局面も作ります。
+        Move move = mlist[rk.rand<unsigned>() % (last - mlist)].move;
+        for (MoveStack* cur = mlist; cur != last; cur++) {
+            if (move_captured(cur->move) != EMP && rk.rand<unsigned>() % 2) {
+                move = cur->move;
+                break;
+            }
+        }
+        stList.push_back(StateInfo());
+        position.do_move(move, stList.back());
+    }
+}
+
 }
 #endif
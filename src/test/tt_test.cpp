@@ -0,0 +1,160 @@
+﻿#if defined(USE_GTEST)
+#include <cstdio>
+#include <gtest/gtest.h>
+
+#include "../rkiss.h"
+#include "../tt.h"
+
+using namespace std;
+
+namespace test {
+
+static const char* TT_FILE = "tt_test.bin";
+
+///
+/// @brief 置換表を保存して読み直すと同じ内容が引け、世代が現在より古くなるか確認します。
+///
+TEST (TTTest, save_load_test)
+{
+    const int N = 2000;
+    TranspositionTable src, dst;
+    RKISS rk;
+    Key keys[N];
+
+    src.set_size(1);
+    for (int i = 0; i < N; i++) {
+        if (i % 500 == 0) src.new_search();
+        keys[i] = rk.rand<Key>() | 1;
+        src.store(keys[i], uint32_t(i), Value(i - N / 2), VALUE_TYPE_EXACT, Depth(i % 20), Move(i + 1), Value(i), VALUE_ZERO);
+    }
+    const int64_t saved = src.save(TT_FILE, DEPTH_ZERO);
+    ASSERT_GT(saved, 0);
+
+    dst.set_size(1);
+    dst.new_search();
+    ASSERT_EQ(saved, dst.load(TT_FILE));
+
+    int found = 0;
+    for (int i = 0; i < N; i++) {
+        const TTEntry* s = src.probe(keys[i], uint32_t(i));
+        const TTEntry* d = dst.probe(keys[i], uint32_t(i));
+        ASSERT_EQ(s == NULL, d == NULL);
+        if (s == NULL) continue;
+        ASSERT_EQ(s->move(), d->move());
+        ASSERT_EQ(s->value(), d->value());
+        ASSERT_EQ(s->depth(), d->depth());
+        ASSERT_EQ(s->static_value(), d->static_value());
+        ASSERT_NE(1, d->generation());
+        found++;
+    }
+    ASSERT_EQ(saved, found);
+
+    // 深さで絞って保存する
+    const int64_t deep = src.save(TT_FILE, Depth(10));
+    ASSERT_LT(deep, saved);
+    dst.clear();
+    ASSERT_EQ(deep, dst.load(TT_FILE));
+    for (int i = 0; i < N; i++) {
+        const TTEntry* d = dst.probe(keys[i], uint32_t(i));
+        if (d != NULL) ASSERT_GE(d->depth(), Depth(10));
+    }
+
+    // 保存したものより小さい表には読めるが, 大きい表には読めない
+    TranspositionTable small, large;
+    small.set_size(0);
+    large.set_size(4);
+    ASSERT_EQ(deep, small.load(TT_FILE));
+    ASSERT_EQ(-1, large.load(TT_FILE));
+
+    remove(TT_FILE);
+}
+
+///
+/// @brief store() の結果と stats() の世代・深さの数え方を確認します。
+///
+TEST (TTTest, store_result_stats_test)
+{
+    TranspositionTable tt;
+    const Key key = 0x123456789ULL << 32;
+
+    tt.set_size(0);
+    tt.new_search();
+
+    // 同じクラスタに別の局面を入れていき、あふれたら追い出す
+    for (int i = 0; i < ClusterSize; i++) {
+        ASSERT_EQ(TT_STORE_NEW, tt.store(key + (Key(i) << 32), 0, VALUE_ZERO, VALUE_TYPE_EXACT, Depth(i * ONE_PLY), MOVE_NONE, VALUE_ZERO, VALUE_ZERO));
+    }
+    ASSERT_EQ(TT_STORE_OVERWRITE, tt.store(key, 0, VALUE_ZERO, VALUE_TYPE_LOWER, Depth(5 * ONE_PLY), MOVE_NONE, VALUE_ZERO, VALUE_ZERO));
+    ASSERT_EQ(TT_STORE_NEW, tt.store(key + 1, 0, VALUE_ZERO, VALUE_TYPE_NONE, DEPTH_NONE, MOVE_NONE, VALUE_ZERO, VALUE_ZERO));
+    tt.new_search();
+
+    // 持ち駒が違っても同じクラスタに入るものなら追い出す
+    uint32_t h1 = 1;
+    while (hand_bucket(h1) != hand_bucket(0)) h1++;
+    ASSERT_EQ(TT_STORE_COLLISION, tt.store(key, h1, VALUE_ZERO, VALUE_TYPE_UPPER, Depth(7 * ONE_PLY), MOVE_NONE, VALUE_ZERO, VALUE_ZERO));
+    ASSERT_TRUE(tt.probe(key, h1) != NULL);
+    ASSERT_TRUE(tt.probe(key, 0) == NULL);
+    ASSERT_TRUE(tt.probe_key(key) != NULL);
+
+    const TTStats st = tt.stats();
+    ASSERT_EQ(uint64_t(1024 * ClusterSize), st.entries);
+    ASSERT_EQ(uint64_t(ClusterSize + 1), st.used);
+    ASSERT_EQ(uint64_t(1), st.current);
+    ASSERT_EQ(uint64_t(ClusterSize), st.age[1]);
+    ASSERT_EQ(uint64_t(1), st.depth[0]);                // 静的評価値だけ
+    ASSERT_EQ(uint64_t(0), st.depth[1]);                // 深さ0のものは追い出された
+    ASSERT_EQ(uint64_t(1), st.depth[1 + 1]);            // 1手
+    ASSERT_EQ(uint64_t(1), st.depth[1 + 7]);            // 7手
+    ASSERT_EQ(1, tt.hashfull());
+}
+
+///
+/// @brief 持ち駒だけが違う局面が同じ組のクラスタに分かれ、持ち駒の優劣で上下限を引けるか確認します。
+///
+TEST (TTTest, hand_group_test)
+{
+    TranspositionTable tt;
+    const Key key = (0x9876ULL << 32) | 0x35;
+    const uint32_t small = 1 * HAND_FU_INC;
+    const uint32_t big = 2 * HAND_FU_INC + HAND_KI_INC;
+    const uint32_t other = HAND_HI_INC;
+    const Depth d3 = Depth(3 * ONE_PLY), d5 = Depth(5 * ONE_PLY);
+
+    tt.set_size(0);
+    tt.new_search();
+
+    // 持ち駒ごとのクラスタはどれも盤面の組の中にある
+    for (uint32_t h = 0; h < 64; h++) {
+        const TTEntry* first = tt.first_group_entry(key);
+        const TTEntry* tte = tt.first_entry(key, h);
+        ASSERT_TRUE(first <= tte && tte < first + TTGroupSize * ClusterSize);
+        ASSERT_EQ(0, (tte - first) % ClusterSize);
+    }
+
+    // 少ない持ち駒での下限は多い持ち駒でも成り立つ. 持ち駒の比べられないものは使わない
+    tt.store(key, small, Value(300), VALUE_TYPE_LOWER, d3, MOVE_NONE, VALUE_ZERO, VALUE_ZERO);
+    ASSERT_TRUE(tt.probe(key, big) == NULL);
+    ASSERT_TRUE(tt.probe_key(key) != NULL);
+    ASSERT_TRUE(tt.probe_dominance(key, big, d3, Value(300)) != NULL);
+    ASSERT_TRUE(tt.probe_dominance(key, big, d3, Value(301)) == NULL);
+    ASSERT_TRUE(tt.probe_dominance(key, big, d5, Value(300)) == NULL);
+    ASSERT_TRUE(tt.probe_dominance(key, 0, d3, Value(300)) == NULL);
+    ASSERT_TRUE(tt.probe_dominance(key, other, d3, Value(300)) == NULL);
+    ASSERT_TRUE(tt.probe_dominance(key, small, d3, Value(300)) == NULL);
+
+    // 詰みなら深さによらず使う
+    tt.clear();
+    tt.store(key, small, VALUE_MATE - 5, VALUE_TYPE_LOWER, d3, MOVE_NONE, VALUE_ZERO, VALUE_ZERO);
+    ASSERT_TRUE(tt.probe_dominance(key, big, DEPTH_DECISIVE, Value(300)) != NULL);
+
+    // 多い持ち駒での上限は少ない持ち駒でも成り立つ
+    tt.clear();
+    tt.store(key, big, -VALUE_MATE + 4, VALUE_TYPE_UPPER, d3, MOVE_NONE, VALUE_ZERO, VALUE_ZERO);
+    ASSERT_TRUE(tt.probe_dominance(key, small, DEPTH_DECISIVE, Value(-300)) != NULL);
+    ASSERT_TRUE(tt.probe_dominance(key, 0, DEPTH_DECISIVE, Value(-300)) != NULL);
+    ASSERT_TRUE(tt.probe_dominance(key, big | HAND_HI_INC, DEPTH_DECISIVE, Value(-300)) == NULL);
+    ASSERT_TRUE(tt.probe_dominance(key, small, DEPTH_DECISIVE, -VALUE_MATE + 4) == NULL);
+}
+
+}
+#endif
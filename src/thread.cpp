@@ -21,6 +21,7 @@
 
 #include <iostream>
 
+#include "perform.h"
 #include "thread.h"
 #include "ucioption.h"
 
@@ -159,6 +160,8 @@ void ThreadsManager::init() {
     {
         lock_init(&threads[i].sleepLock);
         cond_init(&threads[i].sleepCond);
+        threads[i].state = THREAD_IDLE;
+        threads[i].stateStart = now();
 
         for (int j = 0; j < MAX_ACTIVE_SPLIT_POINTS; j++)
             lock_init(&(threads[i].splitPoints[j].lock));
@@ -335,7 +338,13 @@ Value ThreadsManager::split(Position& pos, SearchStack* ss, Value alpha, Value b
 
     // We failed to allocate even one slave, return
     if (!Fake && workersCnt == 1)
+    {
+        masterThread.failedSplits++;
         return bestValue;
+    }
+
+    masterThread.splits++;
+    PERF_COUNT(master, PERF_SPLIT);
 
     masterThread.splitPoint = sp;
     masterThread.activeSplitPoints++;
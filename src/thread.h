@@ -28,6 +28,7 @@
 #if !defined(NANOHA)
 #include "material.h"
 #endif
+#include "misc.h"
 #include "movepick.h"
 #if !defined(NANOHA)
 #include "pawns.h"
@@ -41,6 +42,14 @@ const int MAX_THREADS = 32;
 #endif
 const int MAX_ACTIVE_SPLIT_POINTS = 8;
 
+// スレッドの状態. 状態ごとの経過時間を bench scaling で表示する
+enum ThreadState {
+    THREAD_IDLE,            // 仕事を待っている
+    THREAD_SEARCHING,       // 探索している
+    THREAD_SPLIT_WAIT,      // 分岐点のマスターとして他のスレッドの終了を待っている
+    THREAD_STATE_NB
+};
+
 struct SplitPoint {
 
     // Const data after splitPoint has been setup
@@ -79,6 +88,7 @@ struct Thread {
     bool cutoff_occurred() const;
     bool is_available_to(int master) const;
     void idle_loop(SplitPoint* sp);
+    int set_state(int s);
 
     SplitPoint splitPoints[MAX_ACTIVE_SPLIT_POINTS];
 #if !defined(NANOHA)
@@ -87,6 +97,7 @@ struct Thread {
 #endif
     int threadID;
     int maxPly;
+    int nodesSincePoll;
     Lock sleepLock;
     WaitCondition sleepCond;
     SplitPoint* volatile splitPoint;
@@ -95,6 +106,12 @@ struct Thread {
     volatile bool do_sleep;
     volatile bool do_terminate;
 
+    // 統計. 自分のスレッドからだけ更新し、他のスレッドからは読むだけ
+    volatile int64_t splits, failedSplits;
+    volatile TimePoint stateTime[THREAD_STATE_NB];
+    TimePoint stateStart;
+    int state;
+
 #if defined(_MSC_VER)
     HANDLE handle;
 #else
@@ -103,6 +120,19 @@ struct Thread {
 };
 
 
+/// Thread::set_state() は今の状態の経過時間を記録して状態を切り替え、前の状態を返す
+
+inline int Thread::set_state(int s) {
+
+    const TimePoint t = now();
+    const int prev = state;
+    stateTime[prev] += t - stateStart;
+    stateStart = t;
+    state = s;
+    return prev;
+}
+
+
 /// ThreadsManager class is used to handle all the threads related stuff like init,
 /// starting, parking and, the most important, launching a slave thread at a split
 /// point. All the access to shared thread data is done through this class.
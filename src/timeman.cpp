@@ -20,7 +20,7 @@
 */
 
 #include <cmath>
-#include <iostream>
+#include <sstream>
 
 #include "misc.h"
 #include "search.h"
@@ -108,6 +108,7 @@ void TimeManager::init(const SearchLimits& limits, int currentPly)
     */
 
     int hypMTG, hypMyTime, t1, t2;
+    int optimumTime, maximumTime;   // ミリ秒. 最後にマイクロ秒にする
 
     // Read uci parameters
     int emergencyMoveHorizon = Options["Emergency Move Horizon"].value<int>();
@@ -118,7 +119,7 @@ void TimeManager::init(const SearchLimits& limits, int currentPly)
 
     // Initialize to maximum values but unstablePVExtraTime that is reset
     unstablePVExtraTime = 0;
-    optimumSearchTime = maximumSearchTime = limits.time;
+    optimumTime = maximumTime = limits.time;
 
     // We calculate optimum time usage for different hypothetic "moves to go"-values and choose the
     // minimum of calculated search time values. Usually the greatest hypMTG gives the minimum values.
@@ -137,20 +138,25 @@ void TimeManager::init(const SearchLimits& limits, int currentPly)
         t1 = minThinkingTime + remaining<OptimumTime>(hypMyTime, hypMTG, currentPly, slowMover);
         t2 = minThinkingTime + remaining<MaxTime>(hypMyTime, hypMTG, currentPly, slowMover);
 
-        optimumSearchTime = Min(optimumSearchTime, t1);
-        maximumSearchTime = Min(maximumSearchTime, t2);
+        optimumTime = Min(optimumTime, t1);
+        maximumTime = Min(maximumTime, t2);
     }
 
     if (Options["Ponder"].value<bool>())
-        optimumSearchTime += optimumSearchTime / 4;
+        optimumTime += optimumTime / 4;
 
     // 最大思考時間を秒読み分延長することでtimeが0付近に暴発する事を阻止
-    maximumSearchTime += limits.maxTime;
+    maximumTime += limits.maxTime;
     // Make sure that maxSearchTime is not over absoluteMaxSearchTime
-    optimumSearchTime = Min(optimumSearchTime, maximumSearchTime);
+    optimumTime = Min(optimumTime, maximumTime);
 
-	std::cout << "info string optimum_search_time = " << optimumSearchTime << std::endl;
-    std::cout << "info string maximum_search_time = " << maximumSearchTime << std::endl;
+    std::stringstream s;
+    s << "info string optimum_search_time = " << optimumTime
+      << "\ninfo string maximum_search_time = " << maximumTime << "\n";
+    sync_output(s.str());
+
+    optimumSearchTime = TimePoint(optimumTime) * USEC_PER_MSEC;
+    maximumSearchTime = TimePoint(maximumTime) * USEC_PER_MSEC;
 }
 
 
@@ -22,20 +22,24 @@
 #if !defined(TIMEMAN_H_INCLUDED)
 #define TIMEMAN_H_INCLUDED
 
+#include "misc.h"
+
 struct SearchLimits;
 
+// 時間はすべてマイクロ秒(TimePoint)
+
 class TimeManager {
 public:
 
     void init(const SearchLimits& limits, int currentPly);
     void pv_instability(int curChanges, int prevChanges);
-    int available_time() const { return optimumSearchTime + unstablePVExtraTime; }
-    int maximum_time() const { return maximumSearchTime; }
+    TimePoint available_time() const { return optimumSearchTime + unstablePVExtraTime; }
+    TimePoint maximum_time() const { return maximumSearchTime; }
 
 private:
-    int optimumSearchTime;
-    int maximumSearchTime;
-    int unstablePVExtraTime;
+    TimePoint optimumSearchTime;
+    TimePoint maximumSearchTime;
+    TimePoint unstablePVExtraTime;
 };
 
 #endif // !defined(TIMEMAN_H_INCLUDED)
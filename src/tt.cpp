@@ -19,13 +19,81 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <vector>
+
+#if defined(_MSC_VER) || defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "tt.h"
 
 TranspositionTable TT; // Our global transposition table
 
+namespace {
+
+    // 置換表ファイルのヘッダ. 後ろに count 個のレコード(クラスタ番号 + TTEntry)が続く
+    struct TTFileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t entrySize;     // sizeof(TTEntry). ビルドが違えば読めない
+        uint64_t clusters;      // 保存した表のクラスタ数
+        uint64_t count;         // レコード数
+        uint32_t generation;    // 保存したときの世代
+        int32_t minDepth;       // 保存した最小の深さ
+    };
+
+    const char TTFileMagic[8] = { 'S', 'A', 'Y', 'A', 'T', 'T', '\0', '\0' };
+    const uint32_t TTFileVersion = 2;
+    const size_t TTRecordSize = sizeof(uint32_t) + sizeof(TTEntry);
+    const size_t TTChunkRecords = 65536;
+
+    // ファイル全体を読み取り専用でマップする. できなければ NULL を返す
+    const char* map_tt_file(const std::string& fname, size_t& size) {
+
+#if defined(_MSC_VER) || defined(_WIN32)
+        HANDLE file = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return NULL;
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 ? CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+        CloseHandle(file);
+        if (mapping == NULL) return NULL;
+        const char* p = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        size = size_t(fileSize.QuadPart);
+        return p;
+#else
+        int fd = open(fname.c_str(), O_RDONLY);
+        if (fd < 0) return NULL;
+        struct stat sb;
+        void* p = fstat(fd, &sb) == 0 && sb.st_size > 0 ? mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        size = size_t(sb.st_size);
+        return (p == MAP_FAILED) ? NULL : static_cast<const char*>(p);
+#endif
+    }
+
+    void unmap_tt_file(const char* p, size_t size) {
+
+#if defined(_MSC_VER) || defined(_WIN32)
+        (void)size;
+        UnmapViewOfFile(p);
+#else
+        munmap(const_cast<char*>(p), size);
+#endif
+    }
+}
+
 TranspositionTable::TranspositionTable() {
 
     size = generation = 0;
@@ -78,6 +146,17 @@ void TranspositionTable::clear() {
 }
 
 
+/// TranspositionTable::swap() exchanges the contents of two tables. It is used
+/// to switch the global TT to the table of another search context.
+
+void TranspositionTable::swap(TranspositionTable& tt) {
+
+    std::swap(size, tt.size);
+    std::swap(entries, tt.entries);
+    std::swap(generation, tt.generation);
+}
+
+
 /// TranspositionTable::store() writes a new entry containing position key and
 /// valuable information of current position. The lowest order bits of position
 /// key are used to decide on which cluster the position will be placed.
@@ -85,17 +164,23 @@ void TranspositionTable::clear() {
 /// it replaces the least valuable of entries. A TTEntry t1 is considered to be
 /// more valuable than a TTEntry t2 if t1 is from the current search and t2 is from
 /// a previous search, or if the depth of t1 is bigger than the depth of t2.
+/// Returns whether an empty entry, the entry of the same position or the
+/// entry of another position was written.
 
 #if defined(NANOHA)
-void TranspositionTable::store(const Key posKey, uint32_t h, Value v, ValueType t, Depth d, Move m, Value statV, Value kingD) {
+TTStoreResult TranspositionTable::store(const Key posKey, uint32_t h, Value v, ValueType t, Depth d, Move m, Value statV, Value kingD) {
 #else
-void TranspositionTable::store(const Key posKey, Value v, ValueType t, Depth d, Move m, Value statV, Value kingD) {
+TTStoreResult TranspositionTable::store(const Key posKey, Value v, ValueType t, Depth d, Move m, Value statV, Value kingD) {
 #endif
     int c1, c2, c3;
     TTEntry *tte, *replace;
     uint32_t posKey32 = posKey >> 32; // Use the high 32 bits as key inside the cluster
 
+#if defined(NANOHA)
+    tte = replace = first_entry(posKey, h);
+#else
     tte = replace = first_entry(posKey);
+#endif
 
     for (int i = 0; i < ClusterSize; i++, tte++)
     {
@@ -105,6 +190,8 @@ void TranspositionTable::store(const Key posKey, Value v, ValueType t, Depth d,
         if (!tte->key() || tte->key() == posKey32) // Empty or overwrite old
 #endif
         {
+            const TTStoreResult r = tte->key() ? TT_STORE_OVERWRITE : TT_STORE_NEW;
+
             // Preserve any existing ttMove
             if (m == MOVE_NONE)
                 m = tte->move();
@@ -114,7 +201,7 @@ void TranspositionTable::store(const Key posKey, Value v, ValueType t, Depth d,
 #else
             tte->save(posKey32, v, t, d, m, generation, statV, kingD);
 #endif
-            return;
+            return r;
         }
 
         // Implement replace strategy
@@ -130,6 +217,7 @@ void TranspositionTable::store(const Key posKey, Value v, ValueType t, Depth d,
 #else
     replace->save(posKey32, v, t, d, m, generation, statV, kingD);
 #endif
+    return TT_STORE_COLLISION;
 }
 
 
@@ -140,7 +228,7 @@ void TranspositionTable::store(const Key posKey, Value v, ValueType t, Depth d,
 #if defined(NANOHA)
 TTEntry* TranspositionTable::probe(const Key posKey, uint32_t h) const {
     Key posKey32 = posKey >> 32;
-    TTEntry* tte = first_entry(posKey);
+    TTEntry* tte = first_entry(posKey, h);
 
     for (int i = 0; i < ClusterSize; i++, tte++)
         if (tte->key() == posKey32 && tte->hand() == h)
@@ -159,6 +247,59 @@ TTEntry* TranspositionTable::probe(const Key posKey) const {
 }
 
 
+#if defined(NANOHA)
+/// TranspositionTable::probe_key() looks up an entry of the same board
+/// regardless of the hand in the group of the board. Used to count probes
+/// that missed only because of the hand.
+
+TTEntry* TranspositionTable::probe_key(const Key posKey) const {
+    uint32_t posKey32 = posKey >> 32;
+    TTEntry* tte = first_group_entry(posKey);
+
+    for (int i = 0; i < TTGroupSize * ClusterSize; i++, tte++)
+        if (tte->key() == posKey32)
+            return tte;
+
+    return NULL;
+}
+
+
+/// TranspositionTable::probe_dominance() scans the group of the board for an
+/// entry of another hand whose bound carries over to h and cuts off at ttBeta
+/// (beta converted with value_to_tt()). A hand that has at least the pieces of
+/// the entry's hand is at least as good, so a lower bound of a dominated hand
+/// holds for h, and an upper bound of a dominating hand holds for h as well.
+/// Entries shallower than d are used only for mate scores, so a huge d asks
+/// for mates only. Returns NULL when no such entry is found.
+
+TTEntry* TranspositionTable::probe_dominance(const Key posKey, uint32_t h, Depth d, Value ttBeta) const {
+    uint32_t posKey32 = posKey >> 32;
+    TTEntry* tte = first_group_entry(posKey);
+
+    for (int i = 0; i < TTGroupSize * ClusterSize; i++, tte++)
+    {
+        if (tte->key() != posKey32 || tte->hand() == h)
+            continue;
+
+        const Value v = tte->value();
+
+        if (   (tte->type() & VALUE_TYPE_LOWER)
+            && v >= ttBeta
+            && (tte->depth() >= d || v >= VALUE_MATE_IN_PLY_MAX)
+            && IS_DOM_HAND(h, tte->hand()))
+            return tte;
+
+        if (   (tte->type() & VALUE_TYPE_UPPER)
+            && v < ttBeta
+            && (tte->depth() >= d || v <= VALUE_MATED_IN_PLY_MAX)
+            && IS_DOM_HAND(tte->hand(), h))
+            return tte;
+    }
+    return NULL;
+}
+#endif
+
+
 /// TranspositionTable::new_search() is called at the beginning of every new
 /// search. It increments the "generation" variable, which is used to
 /// distinguish transposition table entries from previous searches from
@@ -167,3 +308,213 @@ TTEntry* TranspositionTable::probe(const Key posKey) const {
 void TranspositionTable::new_search() {
     generation++;
 }
+
+
+/// TranspositionTable::hashfull() returns the permill of entries written in
+/// the current search, sampled from the first 1000 entries of the table.
+
+int TranspositionTable::hashfull() const {
+
+    int cnt = 0;
+
+    for (int i = 0; i < 1000 / ClusterSize; i++)
+        for (int j = 0; j < ClusterSize; j++)
+            cnt += entries[i].data[j].key() && entries[i].data[j].generation() == generation;
+
+    return cnt * 1000 / (1000 / ClusterSize * ClusterSize);
+}
+
+
+/// TranspositionTable::stats() scans the whole table and counts the used
+/// entries by age and depth. It is slow and meant for the "tt stats" command.
+
+TTStats TranspositionTable::stats() const {
+
+    const int GenerationMask = (1 << (8 * sizeof(generation))) - 1;
+    TTStats st;
+
+    memset(&st, 0, sizeof(st));
+    st.entries = uint64_t(size) * ClusterSize;
+
+    for (size_t c = 0; c < size; c++)
+        for (int i = 0; i < ClusterSize; i++)
+        {
+            const TTEntry& e = entries[c].data[i];
+            if (!e.key())
+                continue;
+
+            const int age = (generation - e.generation()) & GenerationMask;
+            const int d = e.depth() / ONE_PLY;
+
+            st.used++;
+            st.current += (age == 0);
+            st.age[std::min(age, 3)]++;
+            st.depth[  e.type() == VALUE_TYPE_NONE ? 0
+                     : d <= 0 ? 1 : 1 + std::min(d, TTStatsMaxDepth)]++;
+        }
+
+    return st;
+}
+
+
+/// TranspositionTable::save() writes the entries whose depth is at least
+/// minDepth to a file. Only non-empty entries are written, each one together
+/// with its cluster index. Returns the number of entries written or -1 on error.
+
+int64_t TranspositionTable::save(const std::string& fname, Depth minDepth) const {
+
+    FILE* fp = fopen(fname.c_str(), "wb");
+    if (fp == NULL)
+        return -1;
+
+    TTFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TTFileMagic, sizeof(h.magic));
+    h.version = TTFileVersion;
+    h.entrySize = sizeof(TTEntry);
+    h.clusters = size;
+    h.generation = generation;
+    h.minDepth = minDepth;
+
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+
+    // TTChunkRecords 個ずつまとめて書き出す
+    std::vector<char> buf(TTChunkRecords * TTRecordSize);
+    size_t n = 0;
+    for (size_t c = 0; c < size && ok; c++)
+    {
+        const uint32_t cluster = uint32_t(c);
+        for (int i = 0; i < ClusterSize; i++)
+        {
+            const TTEntry& e = entries[c].data[i];
+            if (!e.key() || e.depth() < minDepth)
+                continue;
+
+            memcpy(&buf[n * TTRecordSize], &cluster, sizeof(cluster));
+            memcpy(&buf[n * TTRecordSize + sizeof(cluster)], &e, sizeof(TTEntry));
+            h.count++;
+            if (++n == TTChunkRecords)
+            {
+                ok = fwrite(&buf[0], TTRecordSize, n, fp) == n;
+                n = 0;
+            }
+        }
+    }
+    if (ok && n > 0)
+        ok = fwrite(&buf[0], TTRecordSize, n, fp) == n;
+
+    // レコード数を書き戻す
+    if (ok)
+        ok = fseek(fp, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, fp) == 1;
+
+    ok = (fclose(fp) == 0) && ok;
+    return ok ? int64_t(h.count) : -1;
+}
+
+
+/// TranspositionTable::load() reads entries written by save() and merges them
+/// into the table. The file is mapped when possible, otherwise it is read in
+/// chunks. The table must not be bigger than the saved one because the cluster
+/// index of an entry is only known up to the saved size. Returns the number of
+/// entries read or -1 on error.
+
+int64_t TranspositionTable::load(const std::string& fname) {
+
+    TTFileHeader h;
+    size_t fileSize = 0;
+    const char* mapped = map_tt_file(fname, fileSize);
+    FILE* fp = NULL;
+
+    if (mapped != NULL)
+    {
+        if (fileSize < sizeof(h))
+        {
+            unmap_tt_file(mapped, fileSize);
+            return -1;
+        }
+        memcpy(&h, mapped, sizeof(h));
+    }
+    else if ((fp = fopen(fname.c_str(), "rb")) == NULL || fread(&h, sizeof(h), 1, fp) != 1)
+    {
+        if (fp != NULL)
+            fclose(fp);
+        return -1;
+    }
+
+    bool ok =   memcmp(h.magic, TTFileMagic, sizeof(h.magic)) == 0
+             && h.version == TTFileVersion
+             && h.entrySize == sizeof(TTEntry)
+             && h.clusters >= size;
+
+    if (!ok)
+        std::cerr << fname << ": not a transposition table file of this build or "
+                  << "the table is bigger than the saved one ("
+                  << h.clusters << " clusters)." << std::endl;
+
+    if (mapped != NULL)
+    {
+        ok = ok && (fileSize - sizeof(h)) / TTRecordSize >= h.count;
+        for (uint64_t i = 0; ok && i < h.count; i++)
+            load_record(mapped + sizeof(h) + size_t(i) * TTRecordSize, int(h.generation));
+
+        unmap_tt_file(mapped, fileSize);
+    }
+    else
+    {
+        std::vector<char> buf(TTChunkRecords * TTRecordSize);
+        for (uint64_t done = 0; ok && done < h.count; )
+        {
+            const size_t n = size_t(std::min(uint64_t(TTChunkRecords), h.count - done));
+            ok = fread(&buf[0], TTRecordSize, n, fp) == n;
+            for (size_t i = 0; ok && i < n; i++)
+                load_record(&buf[i * TTRecordSize], int(h.generation));
+
+            done += n;
+        }
+        fclose(fp);
+    }
+    return ok ? int64_t(h.count) : -1;
+}
+
+
+/// TranspositionTable::load_record() puts one saved entry into its cluster.
+/// The entry is rebased to a generation older than the current one, keeping
+/// its age relative to the saved generation, so that entries of the next
+/// search replace loaded ones first and stale ones go before recent ones.
+
+void TranspositionTable::load_record(const char* rec, int savedGeneration) {
+
+    const int GenerationMask = (1 << (8 * sizeof(generation))) - 1;
+    uint32_t cluster;
+    TTEntry e;
+
+    memcpy(&cluster, rec, sizeof(cluster));
+    memcpy(&e, rec + sizeof(cluster), sizeof(TTEntry));
+
+    const int age = (savedGeneration - e.generation()) & GenerationMask;
+    e.set_generation(generation - 1 - std::min(age, GenerationMask / 2));
+
+    TTEntry *tte = entries[cluster & (size - 1)].data, *replace = NULL;
+
+    for (int i = 0; i < ClusterSize; i++, tte++)
+    {
+#if defined(NANOHA)
+        if (!tte->key() || (tte->key() == e.key() && tte->hand() == e.hand()))
+#else
+        if (!tte->key() || tte->key() == e.key())
+#endif
+        {
+            if (!tte->key() || tte->depth() <= e.depth())
+                *tte = e;
+            return;
+        }
+
+        // 現在の探索の手は残し, 浅いものから置き換える
+        if (   tte->generation() != generation
+            && tte->depth() < e.depth()
+            && (replace == NULL || tte->depth() < replace->depth()))
+            replace = tte;
+    }
+    if (replace != NULL)
+        *replace = e;
+}
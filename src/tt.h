@@ -23,6 +23,7 @@
 #define TT_H_INCLUDED
 
 #include <iostream>
+#include <string>
 
 #include "move.h"
 #include "types.h"
@@ -128,10 +129,22 @@ private:
 
 
 /// This is the number of TTEntry slots for each cluster
-// TODO:要検証:将棋で持ち駒を別に算出する場合は、局面hash一致がするパターンが多くなるので、4から増やしたほうがいい？
 const int ClusterSize = 4;
 
 
+/// 局面のキーは盤面と手番だけから作るので, 持ち駒だけが違う局面は同じクラスタを
+/// 取り合う. そこで持ち駒のハッシュの TTHandBits ビットをクラスタの番号に混ぜ,
+/// 同じ盤面の局面を隣り合う TTGroupSize 個のクラスタ(組)に振り分ける.
+/// 同じ盤面はこの組の中にしか置かれないので, 組を走査すれば持ち駒の優劣を見られる.
+
+const int TTHandBits = 2;
+const int TTGroupSize = 1 << TTHandBits;
+
+inline uint32_t hand_bucket(uint32_t h) {
+    return uint32_t((uint64_t(h) * 0x9E3779B97F4A7C15ULL) >> (64 - TTHandBits));
+}
+
+
 /// TTCluster consists of ClusterSize number of TTEntries. Size of TTCluster
 /// must not be bigger than a cache line size. In case it is less, it should
 /// be padded to guarantee always aligned accesses.
@@ -141,6 +154,31 @@ struct TTCluster {
 };
 
 
+/// TTStoreResult tells what TranspositionTable::store() did: took an empty
+/// entry, overwrote the entry of the same position or evicted another position.
+
+enum TTStoreResult {
+    TT_STORE_NEW,
+    TT_STORE_OVERWRITE,
+    TT_STORE_COLLISION
+};
+
+
+/// TTStats は置換表全体を走査して数えた使用状況. "tt stats" コマンドで出す.
+/// depth[] は静的評価値だけのもの、静止探索のもの、1手から順に深さごと、
+/// TTStatsMaxDepth 手以上の順に数える.
+
+const int TTStatsMaxDepth = 16;
+
+struct TTStats {
+    uint64_t entries;                   // 全エントリ数
+    uint64_t used;                      // 空でないエントリ数
+    uint64_t current;                   // そのうち今の世代のもの
+    uint64_t age[4];                    // 0, 1, 2, 3以上前の世代のもの
+    uint64_t depth[TTStatsMaxDepth + 2];
+};
+
+
 /// The transposition table class. This is basically just a huge array containing
 /// TTCluster objects, and a few methods for writing and reading entries.
 
@@ -154,18 +192,32 @@ public:
     ~TranspositionTable();
     void set_size(size_t mbSize);
     void clear();
+    void swap(TranspositionTable& tt);
 #if defined(NANOHA)
-    void store(const Key posKey, uint32_t h, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD);
+    TTStoreResult store(const Key posKey, uint32_t h, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD);
     TTEntry* probe(const Key posKey, uint32_t h) const;
+    TTEntry* probe_key(const Key posKey) const;
+    TTEntry* probe_dominance(const Key posKey, uint32_t h, Depth d, Value ttBeta) const;
 #else
-    void store(const Key posKey, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD);
+    TTStoreResult store(const Key posKey, Value v, ValueType type, Depth d, Move m, Value statV, Value kingD);
     TTEntry* probe(const Key posKey) const;
 #endif
     void new_search();
+#if defined(NANOHA)
+    TTEntry* first_entry(const Key posKey, uint32_t h) const;
+    TTEntry* first_group_entry(const Key posKey) const;
+#else
     TTEntry* first_entry(const Key posKey) const;
+#endif
     void refresh(const TTEntry* tte) const;
+    int hashfull() const;
+    TTStats stats() const;
+    int64_t save(const std::string& fname, Depth minDepth) const;
+    int64_t load(const std::string& fname);
 
 private:
+    void load_record(const char* rec, int savedGeneration);
+
     size_t size;
     TTCluster* entries;
 #if defined(NANOHA)
@@ -180,12 +232,28 @@ extern TranspositionTable TT;
 
 /// TranspositionTable::first_entry() returns a pointer to the first entry of
 /// a cluster given a position. The lowest order bits of the key are used to
-/// get the index of the cluster.
+/// get the index of the cluster, with the hand bucket of the side to move
+/// mixed into the lowest TTHandBits bits.
 
+#if defined(NANOHA)
+inline TTEntry* TranspositionTable::first_entry(const Key posKey, uint32_t h) const {
+
+    return entries[(((uint32_t)posKey) ^ hand_bucket(h)) & (size - 1)].data;
+}
+
+/// TranspositionTable::first_group_entry() returns a pointer to the first entry
+/// of the group of clusters that holds every hand of the board.
+
+inline TTEntry* TranspositionTable::first_group_entry(const Key posKey) const {
+
+    return entries[((uint32_t)posKey) & (size - 1) & ~uint32_t(TTGroupSize - 1)].data;
+}
+#else
 inline TTEntry* TranspositionTable::first_entry(const Key posKey) const {
 
     return entries[((uint32_t)posKey) & (size - 1)].data;
 }
+#endif
 
 
 /// TranspositionTable::refresh() updates the 'generation' value of the TTEntry
@@ -908,6 +908,7 @@ namespace NanohaTbl {
     extern const int KomaValueEx[32];    // 取られたとき(捕獲されたとき)の価値
     extern const int KomaValuePro[32];    // 成る価値
     extern const int Piece2Index[32];    // 駒の種類に変換する({と、杏、圭、全}を金と同一視)
+    extern const int MovePiece2Index[64];    // 指し手の(駒<<1 | 成フラグ)を成った後の Piece2Index に変換する
 
     extern const short z2sq[];
     extern const KPP KppIndex0[32];    // pieceをkppのindexに変換
@@ -979,11 +980,17 @@ extern int debug_level;
 #define DEBUG_LEVEL        0
 #endif
 
-#if defined(CHK_PERFORM)
-#define COUNT_PERFORM(x)    ((x)++)
+// CPUのタイムスタンプカウンタを読む(計測用)
+inline uint64_t cpu_cycles()
+{
+#if defined(_MSC_VER) || defined(_WIN32)
+    return __rdtsc();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    return __builtin_ia32_rdtsc();
 #else
-#define COUNT_PERFORM(x)
-#endif // defined(CHK_PERFORM)
+    return 0;
+#endif
+}
 
 #endif
 
@@ -20,6 +20,7 @@
 */
 
 #include <cassert>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -28,8 +29,10 @@
 #include "evaluate.h"
 #include "misc.h"
 #include "move.h"
+#include "perform.h"
 #include "position.h"
 #include "search.h"
+#include "tt.h"
 #include "ucioption.h"
 
 using namespace std;
@@ -52,6 +55,9 @@ namespace {
     void set_position(Position& pos, istringstream& up);
     bool go(Position& pos, istringstream& up);
     void perft(Position& pos, istringstream& up);
+#if defined(NANOHA)
+    void tt_command(istringstream& up);
+#endif
 }
 
 
@@ -70,7 +76,10 @@ void uci_loop() {
     string cmd, token;
     bool quit = false;
 
-    while (!quit && getline(cin, cmd))
+    // 標準入力は入力スレッドが読み、探索中の stop/ponderhit はそこで処理する
+    start_input_thread(handle_search_command);
+
+    while (!quit && get_input_line(cmd))
     {
         istringstream is(cmd);
 
@@ -93,11 +102,19 @@ void uci_loop() {
 #if defined(NANOHA)
         else if (token == "isready") {
             // TODO:本来は時間がかかる初期化をここで行う.
-            cout << "readyok" << endl;
+            // EvalFile が変わっていれば評価関数を読み直す. 置換表の静的評価値も捨てる
+            const string evalFile = Options["EvalFile"].value<string>();
+            if (evalFile != eval_file_name()) {
+                if (load_eval_pack(evalFile))
+                    Options["Clear Hash"].set_value("true");
+                else
+                    sync_output("info string failed to load " + evalFile + "\n");
+            }
+            sync_output("readyok\n");
         }
 #else
         else if (token == "isready")
-            cout << "readyok" << endl;
+            sync_output("readyok\n");
 #endif
 
         else if (token == "position")
@@ -112,6 +129,11 @@ void uci_loop() {
         else if (token == "d")
             pos.print();
 
+#if defined(NANOHA)
+        else if (token == "tt")
+            tt_command(is);
+#endif
+
 #if !defined(NANOHA)
         else if (token == "flip")
             pos.flip_me();
@@ -121,42 +143,48 @@ void uci_loop() {
         else if (token == "eval")
         {
             read_evaluation_uci_options(pos.side_to_move());
-            cout << trace_evaluate(pos) << endl;
+            sync_output(trace_evaluate(pos) + "\n");
         }
 #endif
         else if (token == "key")
+        {
+            ostringstream ss;
 #if defined(NANOHA)
-            cout << "key: " << hex     << pos.get_key() << dec << endl;
+            ss << "key: " << hex     << pos.get_key() << endl;
 #else
-            cout << "key: " << hex     << pos.get_key()
-                 << "\nmaterial key: " << pos.get_material_key()
-                 << "\npawn key: "     << pos.get_pawn_key() << endl;
+            ss << "key: " << hex     << pos.get_key()
+               << "\nmaterial key: " << pos.get_material_key()
+               << "\npawn key: "     << pos.get_pawn_key() << endl;
 #endif
+            sync_output(ss.str());
+        }
 
 #if defined(NANOHA)
         else if (token == "usi")
 #else
         else if (token == "uci")
 #endif
-            cout << "id name "     << engine_name()
-                 << "\nid author " << engine_authors()
 #if defined(NANOHA)
-                 << Options.print_all()
-                 << "\nusiok"      << endl;
+            sync_output("id name " + engine_name()
+                      + "\nid author " + engine_authors()
+                      + Options.print_all()
+                      + "\nusiok\n");
 #else
-                 << "\n"           << Options.print_all()
-                 << "\nuciok"      << endl;
+            sync_output("id name " + engine_name()
+                      + "\nid author " + engine_authors()
+                      + "\n" + Options.print_all()
+                      + "\nuciok\n");
 #endif
 #if defined(NANOHA)
         else if (token == "stop"){
         }
         else if (token == "echo"){
             is >> token;
-            cout << token << endl;
+            sync_output(token + "\n");
         }
 #endif
         else
-            cout << "Unknown command: " << cmd << endl;
+            sync_output("Unknown command: " + cmd + "\n");
     }
 }
 
@@ -229,7 +257,7 @@ namespace {
         if (Options.find(name) != Options.end())
             Options[name].set_value(value.empty() ? "true" : value); // UCI buttons don't have "value"
         else
-            cout << "No such option: " << name << endl;
+            sync_output("No such option: " + name + "\n");
     }
 
 
@@ -273,7 +301,7 @@ namespace {
                     limits.maxTime -= mg;
                 }
             } else if (token == "mate") {
-                std::cout << "checkmate notimplemented" << std::endl;
+                sync_output("checkmate notimplemented\n");
                 return true;
             }
 #else
@@ -299,20 +327,148 @@ namespace {
 
     void perft(Position& pos, istringstream& is) {
 
-        int depth, time;
+        int depth;
+        TimePoint time;
         int64_t n;
 
         if (!(is >> depth))
             return;
 
-        time = get_system_time();
+        time = now();
 
         n = perft(pos, depth * ONE_PLY);
 
-        time = get_system_time() - time;
+        time = now() - time;
 
-        std::cout << "\nNodes " << n
-                  << "\nTime (ms) " << time
-                  << "\nNodes/second " << int(n / (time / 1000.0)) << std::endl;
+        ostringstream ss;
+        ss << "\nNodes " << n
+           << "\nTime (ms) " << to_msec(time)
+           << "\nNodes/second " << int(n / (time / 1000000.0)) << endl;
+        sync_output(ss.str());
     }
+
+
+#if defined(NANOHA)
+
+    // tt_save() is called when engine receives the "tt save <file> [depth]"
+    // command. Entries searched at least 'depth' plies deep are written, all
+    // the entries when no depth is given.
+
+    void tt_save(istringstream& is) {
+
+        string fname;
+        int depth;
+
+        if (!(is >> fname))
+            return;
+        const Depth minDepth = (is >> depth) ? depth * ONE_PLY : DEPTH_NONE;
+
+        TimePoint time = now();
+        int64_t n = TT.save(fname, minDepth);
+        time = now() - time;
+
+        ostringstream ss;
+        if (n < 0)
+            ss << "info string failed to save " << fname << "\n";
+        else
+            ss << "info string tt save " << n << " entries " << int(to_msec(time)) << "ms\n";
+        sync_output(ss.str());
+    }
+
+
+    // tt_load() is called when engine receives the "tt load <file>" command.
+    // The table is allocated with the current Hash size before loading, and a
+    // pending "Clear Hash" is done now so that it does not wipe the loaded entries.
+
+    void tt_load(istringstream& is) {
+
+        string fname;
+
+        if (!(is >> fname))
+            return;
+
+        TT.set_size(Options["Hash"].value<int>());
+        if (Options["Clear Hash"].value<bool>())
+        {
+            Options["Clear Hash"].set_value("false");
+            TT.clear();
+        }
+
+        TimePoint time = now();
+        int64_t n = TT.load(fname);
+        time = now() - time;
+
+        ostringstream ss;
+        if (n < 0)
+            ss << "info string failed to load " << fname << "\n";
+        else
+            ss << "info string tt load " << n << " entries " << int(to_msec(time)) << "ms\n";
+        sync_output(ss.str());
+    }
+
+
+    // tt_stats() is called when engine receives the "tt stats" command. It
+    // scans the table for its occupancy, ages and depths and prints them with
+    // the probe and store counters accumulated since the engine started.
+
+    void tt_stats() {
+
+        const TTStats st = TT.stats();
+        const double used = st.used > 0 ? double(st.used) : 1.0;
+        ostringstream ss;
+
+        ss << fixed << setprecision(1)
+           << "tt entries " << st.entries << " used " << st.used
+           << " (" << (st.entries > 0 ? 100.0 * st.used / st.entries : 0.0) << "%)";
+        if (st.entries > 0)
+            ss << " hashfull " << TT.hashfull();
+
+        ss << "\ntt age current " << st.current << " (" << 100.0 * st.current / used << "%)";
+        for (int i = 1; i < 4; i++)
+            ss << " " << i << (i == 3 ? "+: " : ": ") << st.age[i];
+
+        ss << "\ntt depth eval " << st.depth[0] << " qsearch " << st.depth[1];
+        for (int d = 1; d <= TTStatsMaxDepth; d++)
+            if (st.depth[d + 1])
+                ss << " " << d << (d == TTStatsMaxDepth ? "+: " : ": ") << st.depth[d + 1];
+
+#if defined(CHK_PERFORM)
+        const PerfCounters pc = perf_counters();
+        const int64_t* c = pc.c;
+        const double probes = c[PERF_TT_PROBE] > 0 ? double(c[PERF_TT_PROBE]) : 1.0;
+        const double stores = c[PERF_TT_STORE] > 0 ? double(c[PERF_TT_STORE]) : 1.0;
+
+        ss << "\ntt probe " << c[PERF_TT_PROBE]
+           << " hit " << c[PERF_TT_HIT] << " (" << 100.0 * c[PERF_TT_HIT] / probes << "%)"
+#if defined(TT_STATS)
+           << " handmiss " << c[PERF_TT_HAND_MISS] << " (" << 100.0 * c[PERF_TT_HAND_MISS] / probes << "%)"
+#endif
+           << "\ntt store " << c[PERF_TT_STORE]
+           << " overwrite " << c[PERF_TT_OVERWRITE] << " (" << 100.0 * c[PERF_TT_OVERWRITE] / stores << "%)"
+           << " collision " << c[PERF_TT_COLLISION] << " (" << 100.0 * c[PERF_TT_COLLISION] / stores << "%)";
+#endif
+        ss << "\n";
+        sync_output(ss.str());
+    }
+
+
+    // tt_command() dispatches the "tt" debug commands: "tt save <file> [depth]",
+    // "tt load <file>" and "tt stats".
+
+    void tt_command(istringstream& is) {
+
+        string token;
+
+        is >> token;
+
+        if (token == "save")
+            tt_save(is);
+        else if (token == "load")
+            tt_load(is);
+        else if (token == "stats")
+            tt_stats();
+        else
+            sync_output("Unknown command: tt " + token + "\n");
+    }
+#endif
 }
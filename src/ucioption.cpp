@@ -72,6 +72,7 @@ OptionsMap::OptionsMap() {
     o["OwnBook"]                                   = UCIOption(true);
     o["RandomBookSelect"]                          = UCIOption(true);
     o["BookFile"]                                  = UCIOption("book_40.jsk");
+    o["EvalFile"]                                  = UCIOption("saya_chan.eval");
     o["Ponder"]                                    = UCIOption(false);
     o["Threads"]                                   = UCIOption(1, 1, MAX_THREADS);
     o["Hash"]                                      = UCIOption(256, 4, 8192);
@@ -88,9 +89,14 @@ OptionsMap::OptionsMap() {
     o["Emergency Move Time"]                       = UCIOption(1000, 0, 5000);
     o["Minimum Thinking Time"]                     = UCIOption(20, 0, 5000);
     o["DrawValue"]                                 = UCIOption(0, -30000, 30000);
+    o["TT_HandDominance"]                          = UCIOption(0, 0, 2);
     o["Output_AllDepth"]                           = UCIOption(false);
     o["ByoyomiMargin"]                             = UCIOption(0, -10000, 10000);
     o["Slow_Mover"]                                = UCIOption(30, 10, 1000);
+    o["Info_Interval"]                             = UCIOption(0, 0, 10000);
+#if defined(CHK_PERFORM)
+    o["Perf_Counters"]                             = UCIOption(false);
+#endif
 }
 
 